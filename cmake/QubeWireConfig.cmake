@@ -0,0 +1,14 @@
+# QubeWire CMake package
+#
+# Copyright (c) 2017 Qube Cinema Inc. All Rights reserved
+#
+# Imports QubeWire::QubeWireStatic, the static library with the C++ interface (QubeWireClient.h), and
+# QubeWire::QubeWireShared, the shared library with the C interface (QubeWireC.h). The static library
+# carries the Boost, cpp-netlib, OpenSSL and libxml2 libraries it was built against.
+
+include(CMakeFindDependencyMacro)
+
+# Boost libraries are linked as the imported targets of FindBoost
+find_dependency(Boost 1.58 COMPONENTS system filesystem thread)
+
+include("${CMAKE_CURRENT_LIST_DIR}/QubeWireTargets.cmake")
@@ -0,0 +1,286 @@
+/**
+ * @file AssetHasher.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of AssetHasher class
+ */
+
+#include "AssetHasher.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#endif
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace filesystem = boost::filesystem;
+
+namespace
+{
+    // Large reads keep NVMe queues busy; alignment allows O_DIRECT reads into the buffer
+    const size_t READ_BLOCK_SIZE = 8 * 1024 * 1024;
+    const size_t READ_ALIGNMENT = 4096;
+
+    class Sha1
+    {
+    public:
+        Sha1() : _context(EVP_MD_CTX_create())
+        {
+            // OpenSSL selects the SHA-NI/AVX2 implementation of SHA-1 when the CPU supports it
+            if (!_context || EVP_DigestInit_ex(_context, EVP_sha1(), nullptr) != 1)
+            {
+                EVP_MD_CTX_destroy(_context);
+                throw runtime_error("Initializing SHA-1 digest failed");
+            }
+        }
+
+        ~Sha1() { EVP_MD_CTX_destroy(_context); }
+
+        void Update(const void* data, size_t size)
+        {
+            if (EVP_DigestUpdate(_context, data, size) != 1)
+            {
+                throw runtime_error("Computing SHA-1 digest failed");
+            }
+        }
+
+        string FinalBase64()
+        {
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int digestSize = 0;
+            if (EVP_DigestFinal_ex(_context, digest, &digestSize) != 1)
+            {
+                throw runtime_error("Computing SHA-1 digest failed");
+            }
+
+            char encoded[4 * ((EVP_MAX_MD_SIZE + 2) / 3) + 1];
+            int encodedSize = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(encoded), digest,
+                                              static_cast<int>(digestSize));
+
+            return string(encoded, encodedSize);
+        }
+
+    private:
+        Sha1(const Sha1&);
+        Sha1& operator=(const Sha1&);
+
+        EVP_MD_CTX* _context;
+    };
+
+#ifndef WIN32
+    struct AlignedBuffer
+    {
+        AlignedBuffer(size_t size) : data(nullptr)
+        {
+            if (posix_memalign(&data, READ_ALIGNMENT, size) != 0)
+            {
+                throw bad_alloc();
+            }
+        }
+
+        ~AlignedBuffer() { free(data); }
+
+        void* data;
+    };
+
+    struct FileDescriptor
+    {
+        FileDescriptor(int descriptor) : fd(descriptor) {}
+        ~FileDescriptor()
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        int fd;
+    };
+
+    int OpenForSequentialRead(const string& filePath)
+    {
+#ifdef O_DIRECT
+        // Asset files are read once, so bypass the page cache. Some file systems
+        // (e.g. tmpfs, some network mounts) refuse O_DIRECT; fall back to buffered reads there.
+        int fd = open(filePath.c_str(), O_RDONLY | O_DIRECT);
+        if (fd >= 0 || errno != EINVAL)
+        {
+            return fd;
+        }
+#endif
+        int bufferedFd = open(filePath.c_str(), O_RDONLY);
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (bufferedFd >= 0)
+        {
+            posix_fadvise(bufferedFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+#endif
+        return bufferedFd;
+    }
+#endif
+}
+
+AssetHasher::AssetHasher(unsigned threadCount)
+{
+    _threadCount = threadCount != 0 ? threadCount : thread::hardware_concurrency();
+    if (_threadCount == 0)
+    {
+        _threadCount = 1;
+    }
+}
+
+vector<AssetDigest> AssetHasher::HashFiles(const vector<string>& filePaths,
+                                           const CancellationToken& cancellation) const
+{
+    vector<AssetDigest> digests(filePaths.size());
+
+    // SHA-1 of one file can't be split, so hash the largest files first to keep
+    // all threads busy till the end
+    vector<pair<uintmax_t, size_t>> order;
+    order.reserve(filePaths.size());
+    for (size_t i = 0; i < filePaths.size(); ++i)
+    {
+        boost::system::error_code error;
+        uintmax_t fileSize = filesystem::file_size(filePaths[i], error);
+        order.push_back(make_pair(error ? 0 : fileSize, i));
+    }
+    sort(order.begin(), order.end(), greater<pair<uintmax_t, size_t>>());
+
+    atomic<size_t> next(0);
+    mutex errorMutex;
+    exception_ptr error;
+
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < order.size(); i = next++)
+        {
+            try
+            {
+                size_t index = order[i].second;
+                digests[index] = HashFile(filePaths[index], cancellation);
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(errorMutex);
+                if (!error)
+                {
+                    error = current_exception();
+                }
+                next = order.size();
+            }
+        }
+    };
+
+    size_t threadCount = min<size_t>(_threadCount, filePaths.size());
+    vector<thread> threads;
+    for (size_t i = 1; i < threadCount; ++i)
+    {
+        threads.push_back(thread(worker));
+    }
+    worker();
+    for (thread& t : threads)
+    {
+        t.join();
+    }
+
+    if (error)
+    {
+        rethrow_exception(error);
+    }
+
+    return digests;
+}
+
+AssetDigest AssetHasher::HashFile(const string& filePath, const CancellationToken& cancellation)
+{
+    Sha1 sha1;
+    AssetDigest digest;
+    digest.size = 0;
+
+#ifndef WIN32
+    FileDescriptor file(OpenForSequentialRead(filePath));
+    if (file.fd < 0)
+    {
+        throw runtime_error("Opening file " + filePath + " for reading failed");
+    }
+
+    AlignedBuffer buffer(READ_BLOCK_SIZE);
+    while (true)
+    {
+        cancellation.ThrowIfCancelled();
+        ssize_t bytesRead = read(file.fd, buffer.data, READ_BLOCK_SIZE);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw runtime_error("Reading file " + filePath + " failed");
+        }
+        if (bytesRead == 0)
+        {
+            break;
+        }
+
+        sha1.Update(buffer.data, static_cast<size_t>(bytesRead));
+        digest.size += static_cast<uint64_t>(bytesRead);
+    }
+#else
+    filesystem::ifstream fileStream(filePath, ios::binary);
+    if (!fileStream.is_open())
+    {
+        throw runtime_error("Opening file " + filePath + " for reading failed");
+    }
+
+    vector<char> buffer(READ_BLOCK_SIZE);
+    while (fileStream)
+    {
+        cancellation.ThrowIfCancelled();
+        fileStream.read(buffer.data(), buffer.size());
+        size_t bytesRead = static_cast<size_t>(fileStream.gcount());
+        if (bytesRead == 0)
+        {
+            break;
+        }
+
+        sha1.Update(buffer.data(), bytesRead);
+        digest.size += bytesRead;
+    }
+    if (fileStream.bad())
+    {
+        throw runtime_error("Reading file " + filePath + " failed");
+    }
+#endif
+
+    digest.hash = sha1.FinalBase64();
+    return digest;
+}
+
+AssetDigest AssetHasher::HashBuffer(const string& data)
+{
+    Sha1 sha1;
+    sha1.Update(data.data(), data.size());
+
+    AssetDigest digest;
+    digest.hash = sha1.FinalBase64();
+    digest.size = data.size();
+
+    return digest;
+}
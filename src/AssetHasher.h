@@ -0,0 +1,79 @@
+/**
+ * @file AssetHasher.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains AssetHasher, which computes the PKL hash and size of DCP asset files.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+#include "Cancellation.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Hash and size of an asset as carried in a PKL.
+ */
+struct AssetDigest
+{
+    std::string hash; ///< base64 encoded SHA-1 digest of the asset
+    uint64_t size;    ///< size of the asset in bytes
+};
+
+/**
+ * AssetHasher computes SHA-1 digests of asset files, hashing several files in parallel.
+ * Files are read in large aligned blocks, bypassing the page cache where the OS allows it.
+ */
+class AssetHasher
+{
+public:
+    /**
+     * Construct AssetHasher class object.
+     *
+     * @param[in] threadCount Number of files hashed in parallel; 0 to use one per CPU core
+     */
+    AssetHasher(unsigned threadCount = 0);
+
+    /**
+     * Hash asset files in parallel.
+     *
+     * @param[in] filePaths Paths of the asset files
+     * @param[in] cancellation Token stopping all threads between blocks once cancelled
+     *
+     * @returns digests in the same order as filePaths
+     */
+    std::vector<AssetDigest> HashFiles(const std::vector<std::string>& filePaths,
+                                       const CancellationToken& cancellation = CancellationToken()) const;
+
+    /**
+     * Hash a single asset file on the calling thread.
+     *
+     * @param[in] filePath Path of the asset file
+     * @param[in] cancellation Token stopping the hashing between blocks once cancelled
+     *
+     * @returns digest of the file
+     */
+    static AssetDigest HashFile(const std::string& filePath,
+                                const CancellationToken& cancellation = CancellationToken());
+
+    /**
+     * Hash an asset held in memory, e.g. a signed CPL.
+     *
+     * @param[in] data Content of the asset
+     *
+     * @returns digest of the content
+     */
+    static AssetDigest HashBuffer(const std::string& data);
+
+private:
+    unsigned _threadCount;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,111 @@
+/**
+ * @file Cancellation.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of Deadline and CancellationToken classes
+ */
+
+#include "Cancellation.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+Deadline::Deadline() : _isNever(true)
+{
+}
+
+Deadline Deadline::After(chrono::milliseconds timeout)
+{
+    Deadline deadline;
+    deadline._isNever = false;
+    deadline._time = Clock::now() + timeout;
+
+    return deadline;
+}
+
+bool Deadline::IsNever() const
+{
+    return _isNever;
+}
+
+bool Deadline::IsExpired() const
+{
+    return !_isNever && Clock::now() >= _time;
+}
+
+Deadline::Clock::time_point Deadline::Min(Clock::time_point time) const
+{
+    return _isNever ? time : min(_time, time);
+}
+
+struct CancellationToken::State
+{
+    State() : isCancelled(false) {}
+
+    atomic<bool> isCancelled;
+    mutex stateMutex;
+    condition_variable cancelled;
+};
+
+CancellationToken::CancellationToken()
+{
+}
+
+CancellationToken CancellationToken::Create()
+{
+    CancellationToken token;
+    token._state = make_shared<State>();
+
+    return token;
+}
+
+void CancellationToken::Cancel()
+{
+    if (!_state)
+    {
+        throw logic_error("Cancelling a token that can't be cancelled");
+    }
+
+    {
+        lock_guard<std::mutex> lock(_state->stateMutex);
+        _state->isCancelled = true;
+    }
+    _state->cancelled.notify_all();
+}
+
+bool CancellationToken::IsCancelled() const
+{
+    return _state && _state->isCancelled;
+}
+
+bool CancellationToken::IsCancellable() const
+{
+    return static_cast<bool>(_state);
+}
+
+void CancellationToken::ThrowIfCancelled() const
+{
+    if (IsCancelled())
+    {
+        throw OperationCancelledError();
+    }
+}
+
+bool CancellationToken::WaitUntil(Deadline::Clock::time_point time) const
+{
+    if (!_state)
+    {
+        this_thread::sleep_until(time);
+        return false;
+    }
+
+    unique_lock<std::mutex> lock(_state->stateMutex);
+    return _state->cancelled.wait_until(lock, time, [this]() { return _state->isCancelled.load(); });
+}
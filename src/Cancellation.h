@@ -0,0 +1,157 @@
+/**
+ * @file Cancellation.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains deadlines and cancellation tokens bounding how long client operations may take.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Thrown when an operation is abandoned because its cancellation token was cancelled.
+ */
+class OperationCancelledError : public std::runtime_error
+{
+public:
+    OperationCancelledError() : std::runtime_error("Operation cancelled") {}
+};
+
+/**
+ * Thrown when an operation is abandoned because its deadline passed.
+ */
+class DeadlineExceededError : public std::runtime_error
+{
+public:
+    DeadlineExceededError(const std::string& message) : std::runtime_error(message) {}
+};
+
+/**
+ * Point in time by which an operation must complete.
+ */
+class Deadline
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Construct a deadline that never expires.
+     */
+    Deadline();
+
+    /**
+     * Construct a deadline expiring after the given time from now.
+     *
+     * @param[in] timeout Time from now
+     *
+     * @returns the deadline
+     */
+    static Deadline After(std::chrono::milliseconds timeout);
+
+    /**
+     * Get whether the deadline never expires.
+     *
+     * @returns true if the deadline was default constructed
+     */
+    bool IsNever() const;
+
+    /**
+     * Get whether the deadline has passed.
+     *
+     * @returns true if the deadline has passed
+     */
+    bool IsExpired() const;
+
+    /**
+     * Get the earlier of this deadline and the given point in time.
+     *
+     * @param[in] time Point in time
+     *
+     * @returns the earlier point in time
+     */
+    Clock::time_point Min(Clock::time_point time) const;
+
+private:
+    bool _isNever;
+    Clock::time_point _time;
+};
+
+/**
+ * CancellationToken lets one party abandon operations that others are running or waiting on.
+ * Copies share the same state, so a single token can be handed to every job of a batch and
+ * cancelling it stops all of them. A default constructed token can never be cancelled.
+ * All methods are thread safe.
+ */
+class CancellationToken
+{
+public:
+    /**
+     * Construct a token that can never be cancelled.
+     */
+    CancellationToken();
+
+    /**
+     * Create a token that can be cancelled through CancellationToken::Cancel.
+     *
+     * @returns new token
+     */
+    static CancellationToken Create();
+
+    /**
+     * Cancel all operations using this token and wake up everyone waiting on it.
+     */
+    void Cancel();
+
+    /**
+     * Get whether the token has been cancelled.
+     *
+     * @returns true if cancelled
+     */
+    bool IsCancelled() const;
+
+    /**
+     * Get whether the token can ever be cancelled.
+     *
+     * @returns false for a default constructed token
+     */
+    bool IsCancellable() const;
+
+    /**
+     * Throw OperationCancelledError if the token has been cancelled.
+     */
+    void ThrowIfCancelled() const;
+
+    /**
+     * Sleep till the given time, waking up early if the token is cancelled.
+     *
+     * @param[in] time Point in time to sleep till
+     *
+     * @returns true if the token was cancelled
+     */
+    bool WaitUntil(Deadline::Clock::time_point time) const;
+
+private:
+    struct State;
+    std::shared_ptr<State> _state;
+};
+
+/**
+ * Bounds of a single client call or of a whole job.
+ */
+struct CallOptions
+{
+    Deadline deadline;              ///< the call fails with DeadlineExceededError after this
+    CancellationToken cancellation; ///< the call fails with OperationCancelledError once cancelled
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,162 @@
+/**
+ * @file CertificateChain.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of CertificateChain class
+ */
+
+#include "CertificateChain.h"
+
+#include <openssl/bio.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+namespace
+{
+    typedef chrono::system_clock SystemClock;
+
+    string EncodeBase64(const unsigned char* data, size_t size)
+    {
+        string encoded(4 * ((size + 2) / 3) + 1, '\0');
+        int encodedSize = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(&encoded[0]), data,
+                                          static_cast<int>(size));
+        encoded.resize(encodedSize);
+
+        return encoded;
+    }
+
+    string FormatName(X509_NAME* name)
+    {
+        unique_ptr<BIO, int (*)(BIO*)> bio(BIO_new(BIO_s_mem()), BIO_free);
+        if (!bio || X509_NAME_print_ex(bio.get(), name, 0, XN_FLAG_RFC2253) < 0)
+        {
+            throw runtime_error("Formatting certificate name failed");
+        }
+
+        char* data = nullptr;
+        long size = BIO_get_mem_data(bio.get(), &data);
+
+        return string(data, size);
+    }
+
+    string FormatSerialNumber(X509* certificate)
+    {
+        unique_ptr<BIGNUM, void (*)(BIGNUM*)> serialNumber(
+            ASN1_INTEGER_to_BN(X509_get_serialNumber(certificate), nullptr), BN_free);
+        char* decimal = serialNumber ? BN_bn2dec(serialNumber.get()) : nullptr;
+        if (!decimal)
+        {
+            throw runtime_error("Reading certificate serial number failed");
+        }
+
+        string formatted(decimal);
+        OPENSSL_free(decimal);
+
+        return formatted;
+    }
+
+    SystemClock::time_point ToTimePoint(const ASN1_TIME* time)
+    {
+        unique_ptr<ASN1_TIME, void (*)(ASN1_TIME*)> epoch(ASN1_TIME_set(nullptr, 0), ASN1_TIME_free);
+        int days = 0;
+        int seconds = 0;
+        if (!epoch || !ASN1_TIME_diff(&days, &seconds, epoch.get(), time))
+        {
+            throw runtime_error("Reading certificate validity failed");
+        }
+
+        return SystemClock::from_time_t(0) + chrono::hours(24 * static_cast<int64_t>(days)) +
+               chrono::seconds(seconds);
+    }
+
+    Certificate Describe(const shared_ptr<X509>& handle)
+    {
+        Certificate certificate;
+        certificate.handle = handle;
+
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestSize = 0;
+        if (X509_digest(handle.get(), EVP_sha1(), digest, &digestSize) != 1)
+        {
+            throw runtime_error("Computing certificate thumbprint failed");
+        }
+        certificate.thumbprint = EncodeBase64(digest, digestSize);
+
+        certificate.subjectName = FormatName(X509_get_subject_name(handle.get()));
+        certificate.issuerName = FormatName(X509_get_issuer_name(handle.get()));
+        certificate.serialNumber = FormatSerialNumber(handle.get());
+        certificate.notBefore = ToTimePoint(X509_get_notBefore(handle.get()));
+        certificate.notAfter = ToTimePoint(X509_get_notAfter(handle.get()));
+
+        return certificate;
+    }
+}
+
+CertificateChain::CertificateChain()
+{
+}
+
+CertificateChain CertificateChain::FromPem(const string& pem)
+{
+    unique_ptr<BIO, int (*)(BIO*)> bio(BIO_new_mem_buf(pem.data(), static_cast<int>(pem.size())),
+                                       BIO_free);
+    if (!bio)
+    {
+        throw runtime_error("Reading certificate chain failed");
+    }
+
+    CertificateChain chain;
+    while (X509* certificate = PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr))
+    {
+        chain._certificates.push_back(Describe(shared_ptr<X509>(certificate, X509_free)));
+    }
+
+    // Reading stops at the end of the text by failing, which leaves an error behind
+    ERR_clear_error();
+
+    if (chain._certificates.empty())
+    {
+        throw runtime_error("Certificate chain holds no certificates");
+    }
+
+    chain._pem = pem;
+
+    return chain;
+}
+
+const vector<Certificate>& CertificateChain::GetCertificates() const
+{
+    return _certificates;
+}
+
+const Certificate& CertificateChain::GetLeaf() const
+{
+    return _certificates.front();
+}
+
+const string& CertificateChain::GetPem() const
+{
+    return _pem;
+}
+
+chrono::system_clock::time_point CertificateChain::GetNotAfter() const
+{
+    chrono::system_clock::time_point notAfter = chrono::system_clock::time_point::max();
+    for (const Certificate& certificate : _certificates)
+    {
+        notAfter = min(notAfter, certificate.notAfter);
+    }
+
+    return notAfter;
+}
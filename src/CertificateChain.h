@@ -0,0 +1,89 @@
+/**
+ * @file CertificateChain.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains CertificateChain, the parsed form of a company's signing certificate chain.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef struct x509_st X509;
+
+QUBE_WIRE_NS_START
+
+/**
+ * A certificate of a chain, with the fields KDMs and signatures refer to.
+ */
+struct Certificate
+{
+    std::shared_ptr<X509> handle; ///< OpenSSL certificate, shared by copies of the chain
+    std::string thumbprint;       ///< base64 encoded SHA-1 digest of the DER encoded certificate
+    std::string subjectName;      ///< subject DN in RFC 2253 form
+    std::string issuerName;       ///< issuer DN in RFC 2253 form
+    std::string serialNumber;     ///< serial number in decimal
+    std::chrono::system_clock::time_point notBefore; ///< start of the validity window
+    std::chrono::system_clock::time_point notAfter;  ///< end of the validity window
+};
+
+/**
+ * CertificateChain holds a certificate chain parsed once with OpenSSL, leaf first as returned
+ * by QubeWireClient::GetCertificateChain.
+ * A chain is immutable, so it may be shared between threads.
+ */
+class CertificateChain
+{
+public:
+    /**
+     * Parse a chain of PEM certificates.
+     *
+     * @param[in] pem Concatenated PEM certificates, leaf first
+     *
+     * @returns parsed chain
+     */
+    static CertificateChain FromPem(const std::string& pem);
+
+    /**
+     * Get the certificates of the chain.
+     *
+     * @returns certificates, leaf first
+     */
+    const std::vector<Certificate>& GetCertificates() const;
+
+    /**
+     * Get the leaf certificate, the one signing with the company's key.
+     *
+     * @returns leaf certificate
+     */
+    const Certificate& GetLeaf() const;
+
+    /**
+     * Get the chain in its PEM form.
+     *
+     * @returns concatenated PEM certificates
+     */
+    const std::string& GetPem() const;
+
+    /**
+     * Get the time the first certificate of the chain expires.
+     *
+     * @returns earliest end of validity of the certificates
+     */
+    std::chrono::system_clock::time_point GetNotAfter() const;
+
+private:
+    CertificateChain();
+
+    std::string _pem;
+    std::vector<Certificate> _certificates;
+};
+
+QUBE_WIRE_NS_STOP
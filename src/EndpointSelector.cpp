@@ -0,0 +1,290 @@
+/**
+ * @file EndpointSelector.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of EndpointSelector class
+ */
+
+#include "EndpointSelector.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+// Weight of the latest probe in the smoothed round trip time
+const double ROUND_TRIP_SMOOTHING = 0.3;
+
+// Requests failing in a row before an endpoint is taken out of rotation
+const unsigned MAX_CONSECUTIVE_FAILURES = 2;
+
+// Traffic only moves to a faster endpoint if it takes less than this share of the current
+// one's round trip, so that jitter doesn't make requests flap between similar hosts
+const double SWITCH_THRESHOLD = 0.8;
+
+struct EndpointSelector::Impl
+{
+    Impl(const vector<string>& urls, const Probe& probe) : _probe(probe), _current(0), _isStopping(false)
+    {
+        if (urls.empty())
+        {
+            throw runtime_error("No endpoint given");
+        }
+
+        for (const string& url : urls)
+        {
+            EndpointStatus status;
+            status.url = url;
+            while (!status.url.empty() && status.url.back() == '/')
+            {
+                status.url.pop_back();
+            }
+            if (status.url.empty())
+            {
+                throw runtime_error("Invalid endpoint URL " + url);
+            }
+            status.isHealthy = true;
+            status.roundTripMilliseconds = -1;
+            status.consecutiveFailures = 0;
+            _endpoints.push_back(status);
+        }
+    }
+
+    ~Impl()
+    {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _isStopping = true;
+        }
+        _stopping.notify_all();
+
+        if (_probingThread.joinable())
+        {
+            _probingThread.join();
+        }
+    }
+
+    void Start(chrono::milliseconds interval)
+    {
+        if (_probingThread.joinable())
+        {
+            throw logic_error("Endpoint probing already started");
+        }
+
+        _probingThread = thread([this, interval]() { _ProbeLoop(interval); });
+    }
+
+    string GetEndpoint() const
+    {
+        lock_guard<mutex> lock(_mutex);
+        return _endpoints[_current].url;
+    }
+
+    void ReportSuccess(const string& requestUrl)
+    {
+        lock_guard<mutex> lock(_mutex);
+        EndpointStatus* endpoint = _Find(requestUrl);
+        if (endpoint && (endpoint->consecutiveFailures != 0 || !endpoint->isHealthy))
+        {
+            endpoint->consecutiveFailures = 0;
+            endpoint->isHealthy = true;
+            _Select();
+        }
+    }
+
+    void ReportFailure(const string& requestUrl)
+    {
+        lock_guard<mutex> lock(_mutex);
+        EndpointStatus* endpoint = _Find(requestUrl);
+        if (endpoint && ++endpoint->consecutiveFailures >= MAX_CONSECUTIVE_FAILURES)
+        {
+            endpoint->isHealthy = false;
+            _Select();
+        }
+    }
+
+    vector<EndpointStatus> GetStatus() const
+    {
+        lock_guard<mutex> lock(_mutex);
+        return _endpoints;
+    }
+
+private:
+    void _ProbeLoop(chrono::milliseconds interval)
+    {
+        while (true)
+        {
+            vector<string> urls;
+            {
+                lock_guard<mutex> lock(_mutex);
+                for (const EndpointStatus& endpoint : _endpoints)
+                {
+                    urls.push_back(endpoint.url);
+                }
+            }
+
+            for (size_t i = 0; i < urls.size(); ++i)
+            {
+                // Probes are made without the lock, requests keep using the current choice
+                Clock::time_point start = Clock::now();
+                bool isReachable = true;
+                try
+                {
+                    _probe(urls[i]);
+                }
+                catch (...)
+                {
+                    isReachable = false;
+                }
+                double roundTrip =
+                    chrono::duration<double, milli>(Clock::now() - start).count();
+
+                lock_guard<mutex> lock(_mutex);
+                if (_isStopping)
+                {
+                    return;
+                }
+                _RecordProbe(_endpoints[i], isReachable, roundTrip);
+                _Select();
+            }
+
+            unique_lock<mutex> lock(_mutex);
+            if (_stopping.wait_for(lock, interval, [this]() { return _isStopping; }))
+            {
+                return;
+            }
+        }
+    }
+
+    static void _RecordProbe(EndpointStatus& endpoint, bool isReachable, double roundTrip)
+    {
+        if (!isReachable)
+        {
+            // A host that can't be reached is taken out of rotation right away
+            ++endpoint.consecutiveFailures;
+            endpoint.isHealthy = false;
+            return;
+        }
+
+        endpoint.consecutiveFailures = 0;
+        endpoint.isHealthy = true;
+        endpoint.roundTripMilliseconds =
+            endpoint.roundTripMilliseconds < 0
+                ? roundTrip
+                : ROUND_TRIP_SMOOTHING * roundTrip +
+                      (1 - ROUND_TRIP_SMOOTHING) * endpoint.roundTripMilliseconds;
+    }
+
+    void _Select()
+    {
+        size_t best = _endpoints.size();
+        for (size_t i = 0; i < _endpoints.size(); ++i)
+        {
+            if (_endpoints[i].isHealthy && _IsFaster(_endpoints[i], best))
+            {
+                best = i;
+            }
+        }
+
+        if (best == _endpoints.size())
+        {
+            // Nothing is healthy; keep going to the preferred endpoint till one recovers
+            _current = 0;
+            return;
+        }
+
+        const EndpointStatus& current = _endpoints[_current];
+        const EndpointStatus& candidate = _endpoints[best];
+        if (current.isHealthy && current.roundTripMilliseconds >= 0 &&
+            candidate.roundTripMilliseconds >= 0 &&
+            candidate.roundTripMilliseconds > current.roundTripMilliseconds * SWITCH_THRESHOLD)
+        {
+            return;
+        }
+
+        _current = best;
+    }
+
+    // Measured endpoints rank by round trip time ahead of unmeasured ones, which keep their order
+    bool _IsFaster(const EndpointStatus& endpoint, size_t best) const
+    {
+        if (best == _endpoints.size())
+        {
+            return true;
+        }
+
+        double bestRoundTrip = _endpoints[best].roundTripMilliseconds;
+        if (endpoint.roundTripMilliseconds < 0)
+        {
+            return false;
+        }
+
+        return bestRoundTrip < 0 || endpoint.roundTripMilliseconds < bestRoundTrip;
+    }
+
+    EndpointStatus* _Find(const string& requestUrl)
+    {
+        for (EndpointStatus& endpoint : _endpoints)
+        {
+            if (boost::algorithm::starts_with(requestUrl, endpoint.url) &&
+                (requestUrl.size() == endpoint.url.size() || requestUrl[endpoint.url.size()] == '/' ||
+                 requestUrl[endpoint.url.size()] == '?'))
+            {
+                return &endpoint;
+            }
+        }
+
+        return nullptr;
+    }
+
+    Probe _probe;
+    vector<EndpointStatus> _endpoints;
+    size_t _current;
+
+    mutable mutex _mutex;
+    condition_variable _stopping;
+    bool _isStopping;
+    thread _probingThread;
+};
+
+EndpointSelector::EndpointSelector(const vector<string>& urls, const Probe& probe)
+{
+    _impl.reset(new Impl(urls, probe));
+}
+
+EndpointSelector::~EndpointSelector()
+{
+}
+
+void EndpointSelector::Start(chrono::milliseconds interval)
+{
+    _impl->Start(interval);
+}
+
+string EndpointSelector::GetEndpoint() const
+{
+    return _impl->GetEndpoint();
+}
+
+void EndpointSelector::ReportSuccess(const string& requestUrl)
+{
+    _impl->ReportSuccess(requestUrl);
+}
+
+void EndpointSelector::ReportFailure(const string& requestUrl)
+{
+    _impl->ReportFailure(requestUrl);
+}
+
+vector<EndpointStatus> EndpointSelector::GetStatus() const
+{
+    return _impl->GetStatus();
+}
@@ -0,0 +1,108 @@
+/**
+ * @file EndpointSelector.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains EndpointSelector, which picks the fastest healthy host among equivalent endpoints.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Health and latency of one endpoint.
+ */
+struct EndpointStatus
+{
+    std::string url;              ///< base URL of the endpoint
+    bool isHealthy;               ///< false after failed probes or repeated request failures
+    double roundTripMilliseconds; ///< smoothed probe round trip time, negative till measured
+    unsigned consecutiveFailures; ///< requests and probes failed since the last success
+};
+
+/**
+ * EndpointSelector chooses among equivalent endpoints (e.g. regional hosts) given as an
+ * ordered list. A background thread probes every endpoint and keeps a smoothed round trip
+ * time; requests go to the healthy endpoint with the lowest one. An endpoint is marked
+ * unhealthy as soon as a probe fails or after repeated request failures, so traffic moves
+ * to another endpoint within one probe interval plus the probe timeouts of a round.
+ * Endpoints that were never measured are preferred in the given order.
+ * All methods are thread safe.
+ */
+class EndpointSelector
+{
+public:
+    /**
+     * Probes an endpoint, throwing if it is not reachable or not healthy.
+     */
+    typedef std::function<void(const std::string& url)> Probe;
+
+    /**
+     * Construct EndpointSelector class object.
+     *
+     * @param[in] urls Base URLs of the endpoints in order of preference
+     * @param[in] probe Probe run against each endpoint from the probing thread
+     */
+    EndpointSelector(const std::vector<std::string>& urls, const Probe& probe);
+
+    /**
+     * Destruct EndpointSelector class object, stopping the probing thread.
+     */
+    ~EndpointSelector();
+
+    /**
+     * Start probing all endpoints in the background, the first round right away.
+     *
+     * @param[in] interval Time between rounds of probes
+     */
+    void Start(std::chrono::milliseconds interval);
+
+    /**
+     * Get the endpoint requests should currently be sent to.
+     *
+     * @returns base URL of the fastest healthy endpoint, or of the first one if none is healthy
+     */
+    std::string GetEndpoint() const;
+
+    /**
+     * Record a successful request. Requests to other hosts are ignored.
+     *
+     * @param[in] requestUrl Full URL of the request
+     */
+    void ReportSuccess(const std::string& requestUrl);
+
+    /**
+     * Record a failed request, i.e. one that could not connect, timed out in the HTTP client or
+     * got a server error. A caller's deadline passing isn't a failure of the host.
+     * Requests to other hosts are ignored.
+     *
+     * @param[in] requestUrl Full URL of the request
+     */
+    void ReportFailure(const std::string& requestUrl);
+
+    /**
+     * Get health and latency of all endpoints.
+     *
+     * @returns status of each endpoint in the configured order
+     */
+    std::vector<EndpointStatus> GetStatus() const;
+
+private:
+    EndpointSelector(const EndpointSelector&);
+    EndpointSelector& operator=(const EndpointSelector&);
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,106 @@
+/**
+ * @file FileHelpers.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Helpers to read the documents to be signed from files.
+ */
+
+#pragma once
+
+#include "MemoryBudget.h"
+#include "NamespaceMacros.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Read a whole file. Regular files are read with a single allocation of their size; pipes and
+ * devices, whose size can't be told, are read till their end.
+ *
+ * @param[in] filePath Path of the file
+ *
+ * @returns contents of the file
+ */
+inline std::string GetFileContents(const std::string& filePath)
+{
+    std::ifstream fileStream(filePath.c_str(), std::ios::binary);
+    if (!fileStream.is_open())
+    {
+        throw std::runtime_error("Opening file " + filePath + " for reading failed");
+    }
+
+    std::string content;
+    std::streamoff size = fileStream.seekg(0, std::ios::end) ? std::streamoff(fileStream.tellg()) : -1;
+    if (size >= 0)
+    {
+        content.resize(static_cast<size_t>(size));
+        fileStream.seekg(0);
+        if (!fileStream.read(&content[0], content.size()))
+        {
+            throw std::runtime_error("Reading file " + filePath + " failed");
+        }
+
+        return content;
+    }
+
+    fileStream.clear();
+    char buffer[64 * 1024];
+    while (fileStream.read(buffer, sizeof(buffer)) || fileStream.gcount() > 0)
+    {
+        content.append(buffer, static_cast<size_t>(fileStream.gcount()));
+    }
+    if (fileStream.bad())
+    {
+        throw std::runtime_error("Reading file " + filePath + " failed");
+    }
+
+    return content;
+}
+
+/**
+ * Read a whole file into a buffer drawn from a memory budget, waiting till the budget has room
+ * for it. Regular files are read straight into the buffer's slabs; pipes and devices, whose size
+ * can't be told, are read first and copied in.
+ *
+ * @param[in] filePath Path of the file
+ * @param[in] budget Budget to draw the buffer from
+ * @param[in] options Deadline and cancellation token of the wait for room
+ *
+ * @returns contents of the file
+ */
+inline BodyBuffer GetFileContents(const std::string& filePath, MemoryBudget& budget,
+    const CallOptions& options = CallOptions())
+{
+    std::ifstream fileStream(filePath.c_str(), std::ios::binary);
+    if (!fileStream.is_open())
+    {
+        throw std::runtime_error("Opening file " + filePath + " for reading failed");
+    }
+
+    std::streamoff size = fileStream.seekg(0, std::ios::end) ? std::streamoff(fileStream.tellg()) : -1;
+    if (size >= 0)
+    {
+        BodyBuffer content = budget.Allocate(static_cast<size_t>(size), options);
+        fileStream.seekg(0);
+        content.Append(fileStream, static_cast<size_t>(size));
+        return content;
+    }
+
+    fileStream.clear();
+    std::string data((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
+    if (fileStream.bad())
+    {
+        throw std::runtime_error("Reading file " + filePath + " failed");
+    }
+    BodyBuffer content = budget.Allocate(data.size(), options);
+    content.Append(data);
+    return content;
+}
+
+QUBE_WIRE_NS_STOP
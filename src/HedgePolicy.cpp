@@ -0,0 +1,95 @@
+/**
+ * @file HedgePolicy.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of HedgePolicy class
+ */
+
+#include "HedgePolicy.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+// Latencies of this many recent requests make up the percentile
+const size_t LATENCY_WINDOW = 200;
+
+// The percentile isn't trusted till this many latencies are known
+const size_t MIN_LATENCY_SAMPLES = 20;
+
+// Unused budget is kept for at most this many hedges, which bounds bursts of hedges
+const double MAX_AVAILABLE_HEDGES = 2;
+
+// Hedging faster responses than this only adds load
+const chrono::microseconds MIN_HEDGE_DELAY(chrono::milliseconds(10));
+
+HedgePolicy::HedgePolicy() : _budget(0), _availableHedges(0), _hedgeCount(0), _nextLatency(0)
+{
+}
+
+void HedgePolicy::SetBudget(double fraction)
+{
+    if (fraction < 0 || fraction > 1)
+    {
+        throw runtime_error("Hedge budget must be between 0 and 1");
+    }
+
+    _budget = fraction;
+}
+
+bool HedgePolicy::IsEnabled() const
+{
+    return _budget > 0;
+}
+
+chrono::microseconds HedgePolicy::GetDelay() const
+{
+    if (_latencies.size() < MIN_LATENCY_SAMPLES)
+    {
+        return chrono::microseconds::max();
+    }
+
+    vector<int64_t> latencies(_latencies);
+    vector<int64_t>::iterator percentile = latencies.begin() + latencies.size() * 95 / 100;
+    nth_element(latencies.begin(), percentile, latencies.end());
+
+    return max(chrono::microseconds(*percentile), MIN_HEDGE_DELAY);
+}
+
+void HedgePolicy::RecordRequest()
+{
+    _availableHedges = min(_availableHedges + _budget, MAX_AVAILABLE_HEDGES);
+}
+
+bool HedgePolicy::TryHedge()
+{
+    if (!IsEnabled() || _availableHedges < 1)
+    {
+        return false;
+    }
+
+    _availableHedges -= 1;
+    ++_hedgeCount;
+    return true;
+}
+
+void HedgePolicy::RecordLatency(chrono::microseconds latency)
+{
+    if (_latencies.size() < LATENCY_WINDOW)
+    {
+        _latencies.push_back(latency.count());
+        return;
+    }
+
+    _latencies[_nextLatency] = latency.count();
+    _nextLatency = (_nextLatency + 1) % LATENCY_WINDOW;
+}
+
+uint64_t HedgePolicy::GetHedgeCount() const
+{
+    return _hedgeCount;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file HedgePolicy.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains HedgePolicy, which decides when an idempotent request is sent a second time.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+QUBE_WIRE_NS_START
+
+/**
+ * HedgePolicy tracks the latency of recent requests and decides when a request that has not
+ * been answered yet is worth sending again. A hedge is sent once a request has waited longer
+ * than the 95th percentile of recent latencies, and hedges are limited to a fraction of all
+ * requests, so a slow server doesn't get much more load than it already has.
+ * It is not thread safe.
+ */
+class HedgePolicy
+{
+public:
+    /**
+     * Construct HedgePolicy class object with hedging disabled.
+     */
+    HedgePolicy();
+
+    /**
+     * Set the share of requests that may be hedged.
+     *
+     * @param[in] fraction Hedges per request, e.g. 0.05 for at most 5% extra requests;
+     *                     0 disables hedging
+     */
+    void SetBudget(double fraction);
+
+    /**
+     * Get whether hedging is enabled.
+     *
+     * @returns true if the budget is above zero
+     */
+    bool IsEnabled() const;
+
+    /**
+     * Get how long a request is waited for before a hedge is considered.
+     *
+     * @returns the 95th percentile of recent latencies; effectively never till enough
+     *          requests have been measured
+     */
+    std::chrono::microseconds GetDelay() const;
+
+    /**
+     * Record a request being sent, adding its share to the hedge budget.
+     */
+    void RecordRequest();
+
+    /**
+     * Take a hedge from the budget.
+     *
+     * @returns true if the budget allows a hedge, which is then counted
+     */
+    bool TryHedge();
+
+    /**
+     * Record how long a request took till it was answered.
+     *
+     * @param[in] latency Time from sending the request to its first response
+     */
+    void RecordLatency(std::chrono::microseconds latency);
+
+    /**
+     * Get the number of hedges sent so far.
+     *
+     * @returns hedge count
+     */
+    uint64_t GetHedgeCount() const;
+
+private:
+    double _budget;
+    double _availableHedges;
+    uint64_t _hedgeCount;
+
+    std::vector<int64_t> _latencies;
+    size_t _nextLatency;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,489 @@
+/**
+ * @file JobTable.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of JobId and JobTable classes
+ */
+
+#include "JobTable.h"
+#include "XmlHelpers.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+// Deadline tick of jobs without a deadline
+const uint32_t NO_DEADLINE = UINT32_MAX;
+
+namespace
+{
+    int GetHexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F')
+        {
+            return c - 'A' + 10;
+        }
+
+        return -1;
+    }
+
+    size_t RoundUpToPowerOfTwo(size_t value)
+    {
+        size_t power = 1;
+        while (power < value)
+        {
+            power <<= 1;
+        }
+
+        return power;
+    }
+}
+
+bool JobId::TryParse(const string& text, JobId& id)
+{
+    size_t position = text.compare(0, UUID_URN_PREFIX.size(), UUID_URN_PREFIX) == 0
+                          ? UUID_URN_PREFIX.size()
+                          : 0;
+    if (text.size() - position != 36)
+    {
+        return false;
+    }
+
+    uint64_t parts[2] = {0, 0};
+    unsigned digits = 0;
+    for (size_t i = 0; i < 36; ++i, ++position)
+    {
+        if (i == 8 || i == 13 || i == 18 || i == 23)
+        {
+            if (text[position] != '-')
+            {
+                return false;
+            }
+            continue;
+        }
+
+        int value = GetHexValue(text[position]);
+        if (value < 0)
+        {
+            return false;
+        }
+        uint64_t& part = parts[digits / 16];
+        part = (part << 4) | static_cast<uint64_t>(value);
+        ++digits;
+    }
+
+    id.high = parts[0];
+    id.low = parts[1];
+    return true;
+}
+
+JobId JobId::Parse(const string& text)
+{
+    JobId id;
+    if (!TryParse(text, id))
+    {
+        throw runtime_error("Invalid job id " + text);
+    }
+
+    return id;
+}
+
+string JobId::ToString() const
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+
+    string text;
+    text.reserve(36);
+    for (unsigned i = 0; i < 32; ++i)
+    {
+        if (i == 8 || i == 12 || i == 16 || i == 20)
+        {
+            text.push_back('-');
+        }
+        uint64_t part = i < 16 ? high : low;
+        text.push_back(HEX_DIGITS[(part >> (60 - 4 * (i % 16))) & 0xf]);
+    }
+
+    return text;
+}
+
+JobTable::JobTable(chrono::milliseconds tickDuration, unsigned wheelSlotCount)
+    : _epoch(Clock::now()), _tickDuration(tickDuration), _currentTick(0), _count(0)
+{
+    if (tickDuration.count() <= 0 || wheelSlotCount == 0)
+    {
+        throw runtime_error("Invalid job table timing wheel");
+    }
+
+    _wheel.assign(RoundUpToPowerOfTwo(wheelSlotCount), INVALID_JOB_HANDLE);
+    _index.assign(64, INVALID_JOB_HANDLE);
+}
+
+JobHandle JobTable::Add(const JobId& id, JobPriority priority)
+{
+    if (Find(id) != INVALID_JOB_HANDLE)
+    {
+        throw runtime_error("Job " + id.ToString() + " is already tracked");
+    }
+
+    JobHandle job;
+    if (!_freeHandles.empty())
+    {
+        job = _freeHandles.back();
+        _freeHandles.pop_back();
+    }
+    else
+    {
+        if (_flags.size() >= INVALID_JOB_HANDLE)
+        {
+            throw runtime_error("Job table is full");
+        }
+
+        job = static_cast<JobHandle>(_flags.size());
+        _idHigh.push_back(0);
+        _idLow.push_back(0);
+        _flags.push_back(0);
+        _states.push_back(0);
+        _priorities.push_back(0);
+        _retryCounts.push_back(0);
+        _pollTicks.push_back(0);
+        _deadlineTicks.push_back(0);
+        _next.push_back(INVALID_JOB_HANDLE);
+        _previous.push_back(INVALID_JOB_HANDLE);
+    }
+
+    _idHigh[job] = id.high;
+    _idLow[job] = id.low;
+    _flags[job] = IN_USE;
+    _states[job] = static_cast<uint8_t>(JobState::Pending);
+    _priorities[job] = static_cast<uint8_t>(priority);
+    _retryCounts[job] = 0;
+    _pollTicks[job] = 0;
+    _deadlineTicks[job] = NO_DEADLINE;
+    ++_count;
+
+    if (_count * 2 > _index.size())
+    {
+        _GrowIndex();
+    }
+    else
+    {
+        _Index(job);
+    }
+
+    return job;
+}
+
+JobHandle JobTable::Find(const JobId& id) const
+{
+    size_t mask = _index.size() - 1;
+    for (size_t slot = _GetIndexSlot(id);; slot = (slot + 1) & mask)
+    {
+        JobHandle job = _index[slot];
+        if (job == INVALID_JOB_HANDLE)
+        {
+            return INVALID_JOB_HANDLE;
+        }
+        if (_idLow[job] == id.low && _idHigh[job] == id.high)
+        {
+            return job;
+        }
+    }
+}
+
+void JobTable::Remove(JobHandle job)
+{
+    if (job >= _flags.size() || !(_flags[job] & IN_USE))
+    {
+        throw runtime_error("Invalid job handle");
+    }
+
+    Unschedule(job);
+    _Unindex(job);
+    _flags[job] = 0;
+    _freeHandles.push_back(job);
+    --_count;
+}
+
+size_t JobTable::GetCount() const
+{
+    return _count;
+}
+
+JobId JobTable::GetId(JobHandle job) const
+{
+    JobId id;
+    id.high = _idHigh.at(job);
+    id.low = _idLow.at(job);
+
+    return id;
+}
+
+JobState JobTable::GetState(JobHandle job) const
+{
+    return static_cast<JobState>(_states.at(job));
+}
+
+void JobTable::SetState(JobHandle job, JobState state)
+{
+    _states.at(job) = static_cast<uint8_t>(state);
+}
+
+JobPriority JobTable::GetPriority(JobHandle job) const
+{
+    return static_cast<JobPriority>(_priorities.at(job));
+}
+
+uint16_t JobTable::IncrementRetryCount(JobHandle job)
+{
+    uint16_t& retryCount = _retryCounts.at(job);
+    if (retryCount != UINT16_MAX)
+    {
+        ++retryCount;
+    }
+
+    return retryCount;
+}
+
+uint16_t JobTable::GetRetryCount(JobHandle job) const
+{
+    return _retryCounts.at(job);
+}
+
+void JobTable::ResetRetryCount(JobHandle job)
+{
+    _retryCounts.at(job) = 0;
+}
+
+void JobTable::SetDeadline(JobHandle job, Clock::time_point deadline)
+{
+    _deadlineTicks.at(job) = min(_ToTick(deadline), NO_DEADLINE - 1);
+}
+
+bool JobTable::IsExpired(JobHandle job, Clock::time_point now) const
+{
+    uint32_t deadline = _deadlineTicks.at(job);
+    return deadline != NO_DEADLINE && _ToElapsedTick(now) >= deadline;
+}
+
+void JobTable::Schedule(JobHandle job, Clock::time_point time)
+{
+    if (job >= _flags.size() || !(_flags[job] & IN_USE))
+    {
+        throw runtime_error("Invalid job handle");
+    }
+
+    Unschedule(job);
+
+    // Polls due before the next tick to be collected go into that tick
+    _Link(job, max(_ToTick(time), _currentTick));
+}
+
+void JobTable::Unschedule(JobHandle job)
+{
+    if (_flags.at(job) & SCHEDULED)
+    {
+        _Unlink(job);
+    }
+}
+
+bool JobTable::IsScheduled(JobHandle job) const
+{
+    return (_flags.at(job) & SCHEDULED) != 0;
+}
+
+void JobTable::CollectDue(Clock::time_point now, vector<JobHandle>& dueJobs)
+{
+    uint32_t nowTick = _ToElapsedTick(now);
+    if (nowTick < _currentTick)
+    {
+        return;
+    }
+
+    // A slot holds the jobs of every tick mapping to it, later ones stay for a later revolution
+    uint64_t slotCount = min<uint64_t>(static_cast<uint64_t>(nowTick) - _currentTick + 1, _wheel.size());
+    size_t mask = _wheel.size() - 1;
+    for (uint64_t i = 0; i < slotCount; ++i)
+    {
+        JobHandle job = _wheel[(_currentTick + i) & mask];
+        while (job != INVALID_JOB_HANDLE)
+        {
+            JobHandle next = _next[job];
+            if (_pollTicks[job] <= nowTick)
+            {
+                _Unlink(job);
+                dueJobs.push_back(job);
+            }
+            job = next;
+        }
+    }
+
+    _currentTick = nowTick + 1;
+}
+
+JobTable::Clock::time_point JobTable::GetNextDue() const
+{
+    // Slots are scanned in tick order, so the first job found due at the tick of its slot is the
+    // earliest; jobs a revolution or more away are only found when no nearer one is scheduled
+    uint32_t nextTick = UINT32_MAX;
+    size_t mask = _wheel.size() - 1;
+    for (uint64_t i = 0; i < _wheel.size() && nextTick == UINT32_MAX; ++i)
+    {
+        uint64_t tick = static_cast<uint64_t>(_currentTick) + i;
+        for (JobHandle job = _wheel[tick & mask]; job != INVALID_JOB_HANDLE; job = _next[job])
+        {
+            if (_pollTicks[job] == tick)
+            {
+                nextTick = _pollTicks[job];
+                break;
+            }
+        }
+    }
+
+    if (nextTick == UINT32_MAX)
+    {
+        for (JobHandle head : _wheel)
+        {
+            for (JobHandle job = head; job != INVALID_JOB_HANDLE; job = _next[job])
+            {
+                nextTick = min(nextTick, _pollTicks[job]);
+            }
+        }
+    }
+
+    return nextTick == UINT32_MAX ? Clock::time_point::max() : _epoch + _tickDuration * nextTick;
+}
+
+size_t JobTable::GetMemoryUsage() const
+{
+    size_t perJob = sizeof(uint64_t) * 2 + sizeof(uint8_t) * 3 + sizeof(uint16_t) +
+                    sizeof(uint32_t) * 2 + sizeof(JobHandle) * 2;
+
+    return _flags.capacity() * perJob + _freeHandles.capacity() * sizeof(JobHandle) +
+           _index.capacity() * sizeof(JobHandle) + _wheel.capacity() * sizeof(JobHandle);
+}
+
+uint32_t JobTable::_ToTick(Clock::time_point time) const
+{
+    if (time <= _epoch)
+    {
+        return 0;
+    }
+
+    // Rounded up, so a job is never collected before its time
+    uint64_t tick = static_cast<uint64_t>((time - _epoch + _tickDuration - Clock::duration(1)) / _tickDuration);
+    return static_cast<uint32_t>(min<uint64_t>(tick, UINT32_MAX - 1));
+}
+
+uint32_t JobTable::_ToElapsedTick(Clock::time_point time) const
+{
+    if (time <= _epoch)
+    {
+        return 0;
+    }
+
+    uint64_t tick = static_cast<uint64_t>((time - _epoch) / _tickDuration);
+    return static_cast<uint32_t>(min<uint64_t>(tick, UINT32_MAX - 1));
+}
+
+size_t JobTable::_GetIndexSlot(const JobId& id) const
+{
+    // UUIDs are mostly random already, mixing guards against sequential ids
+    uint64_t hash = (id.low ^ (id.high * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    return static_cast<size_t>(hash >> 32) & (_index.size() - 1);
+}
+
+void JobTable::_Link(JobHandle job, uint32_t tick)
+{
+    JobHandle& head = _wheel[tick & (_wheel.size() - 1)];
+    _pollTicks[job] = tick;
+    _previous[job] = INVALID_JOB_HANDLE;
+    _next[job] = head;
+    if (head != INVALID_JOB_HANDLE)
+    {
+        _previous[head] = job;
+    }
+    head = job;
+    _flags[job] |= SCHEDULED;
+}
+
+void JobTable::_Unlink(JobHandle job)
+{
+    if (_previous[job] != INVALID_JOB_HANDLE)
+    {
+        _next[_previous[job]] = _next[job];
+    }
+    else
+    {
+        _wheel[_pollTicks[job] & (_wheel.size() - 1)] = _next[job];
+    }
+    if (_next[job] != INVALID_JOB_HANDLE)
+    {
+        _previous[_next[job]] = _previous[job];
+    }
+
+    _next[job] = INVALID_JOB_HANDLE;
+    _previous[job] = INVALID_JOB_HANDLE;
+    _flags[job] &= static_cast<uint8_t>(~SCHEDULED);
+}
+
+void JobTable::_Index(JobHandle job)
+{
+    JobId id = GetId(job);
+    size_t mask = _index.size() - 1;
+    size_t slot = _GetIndexSlot(id);
+    while (_index[slot] != INVALID_JOB_HANDLE)
+    {
+        slot = (slot + 1) & mask;
+    }
+    _index[slot] = job;
+}
+
+void JobTable::_Unindex(JobHandle job)
+{
+    size_t mask = _index.size() - 1;
+    size_t slot = _GetIndexSlot(GetId(job));
+    while (_index[slot] != job)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    // Shift later entries of the probe sequence back, so lookups need no tombstones
+    size_t next = (slot + 1) & mask;
+    while (_index[next] != INVALID_JOB_HANDLE)
+    {
+        size_t home = _GetIndexSlot(GetId(_index[next]));
+        bool isMovable = slot <= next ? (home <= slot || home > next) : (home <= slot && home > next);
+        if (isMovable)
+        {
+            _index[slot] = _index[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    _index[slot] = INVALID_JOB_HANDLE;
+}
+
+void JobTable::_GrowIndex()
+{
+    _index.assign(_index.size() * 2, INVALID_JOB_HANDLE);
+    for (JobHandle job = 0; job < _flags.size(); ++job)
+    {
+        if (_flags[job] & IN_USE)
+        {
+            _Index(job);
+        }
+    }
+}
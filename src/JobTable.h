@@ -0,0 +1,258 @@
+/**
+ * @file JobTable.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains JobTable, which tracks the state and poll schedule of many outstanding jobs compactly.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+#include "PriorityScheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Binary form of a job, KDM or asset UUID.
+ */
+struct JobId
+{
+    uint64_t high; ///< first 8 bytes of the UUID
+    uint64_t low;  ///< last 8 bytes of the UUID
+
+    /**
+     * Parse a UUID, with or without the urn:uuid: prefix.
+     *
+     * @param[in] text UUID in its 8-4-4-4-12 hexadecimal form
+     * @param[out] id Parsed id
+     *
+     * @returns false if text isn't a UUID
+     */
+    static bool TryParse(const std::string& text, JobId& id);
+
+    /**
+     * Parse a UUID, throwing if text isn't one.
+     *
+     * @param[in] text UUID in its 8-4-4-4-12 hexadecimal form
+     *
+     * @returns parsed id
+     */
+    static JobId Parse(const std::string& text);
+
+    /**
+     * Format the id as a lower case UUID.
+     *
+     * @returns UUID in its 8-4-4-4-12 hexadecimal form
+     */
+    std::string ToString() const;
+
+    bool operator==(const JobId& other) const { return high == other.high && low == other.low; }
+    bool operator!=(const JobId& other) const { return !(*this == other); }
+};
+
+/**
+ * Signing state of a tracked job.
+ */
+enum class JobState : uint8_t
+{
+    Pending = 0, ///< submitted, not signed yet
+    Signed = 1,  ///< signed, result available
+    Failed = 2   ///< failed or given up on
+};
+
+/**
+ * Handle of a job in a JobTable, valid till the job is removed.
+ * Handles of removed jobs are reused.
+ */
+typedef uint32_t JobHandle;
+
+const JobHandle INVALID_JOB_HANDLE = UINT32_MAX;
+
+/**
+ * JobTable tracks outstanding jobs in a struct-of-arrays layout: ids are kept as binary UUIDs
+ * and state, priority, retry count, next poll and deadline are stored inline, which takes about
+ * 50 bytes per job. Polls are scheduled on an intrusive timing wheel, so scheduling a job,
+ * cancelling its poll and collecting a due job are all O(1).
+ * It is not thread safe.
+ */
+class JobTable
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Construct JobTable class object.
+     *
+     * @param[in] tickDuration Resolution of poll times
+     * @param[in] wheelSlotCount Slots of the timing wheel, rounded up to a power of two; polls
+     *                           further away than a revolution of the wheel are still supported
+     */
+    JobTable(std::chrono::milliseconds tickDuration = std::chrono::milliseconds(100),
+             unsigned wheelSlotCount = 4096);
+
+    /**
+     * Start tracking a job in Pending state, without a poll scheduled.
+     *
+     * @param[in] id Job id, which must not be tracked yet
+     * @param[in] priority Priority of the job's polls
+     *
+     * @returns handle of the job
+     */
+    JobHandle Add(const JobId& id, JobPriority priority);
+
+    /**
+     * Find a tracked job.
+     *
+     * @param[in] id Job id
+     *
+     * @returns handle of the job, or INVALID_JOB_HANDLE if it isn't tracked
+     */
+    JobHandle Find(const JobId& id) const;
+
+    /**
+     * Stop tracking a job, cancelling its poll.
+     *
+     * @param[in] job Handle of the job
+     */
+    void Remove(JobHandle job);
+
+    /**
+     * Get the number of tracked jobs.
+     *
+     * @returns job count
+     */
+    size_t GetCount() const;
+
+    /**
+     * Get the id of a job.
+     *
+     * @param[in] job Handle of the job
+     *
+     * @returns job id
+     */
+    JobId GetId(JobHandle job) const;
+
+    JobState GetState(JobHandle job) const;
+    void SetState(JobHandle job, JobState state);
+
+    JobPriority GetPriority(JobHandle job) const;
+
+    /**
+     * Count a failed poll of a job.
+     *
+     * @param[in] job Handle of the job
+     *
+     * @returns failed polls so far, saturating at 65535
+     */
+    uint16_t IncrementRetryCount(JobHandle job);
+
+    uint16_t GetRetryCount(JobHandle job) const;
+    void ResetRetryCount(JobHandle job);
+
+    /**
+     * Set the time after which the job is given up on.
+     *
+     * @param[in] job Handle of the job
+     * @param[in] deadline Deadline of the job
+     */
+    void SetDeadline(JobHandle job, Clock::time_point deadline);
+
+    /**
+     * Get whether the job's deadline has passed.
+     *
+     * @param[in] job Handle of the job
+     * @param[in] now Current time
+     *
+     * @returns true if a deadline was set and has passed
+     */
+    bool IsExpired(JobHandle job, Clock::time_point now) const;
+
+    /**
+     * Schedule the next poll of a job, replacing an earlier schedule.
+     *
+     * @param[in] job Handle of the job
+     * @param[in] time Time of the poll, rounded up to the tick
+     */
+    void Schedule(JobHandle job, Clock::time_point time);
+
+    /**
+     * Cancel the scheduled poll of a job.
+     *
+     * @param[in] job Handle of the job
+     */
+    void Unschedule(JobHandle job);
+
+    bool IsScheduled(JobHandle job) const;
+
+    /**
+     * Collect the jobs whose polls are due, removing them from the schedule.
+     *
+     * @param[in] now Current time
+     * @param[out] dueJobs Handles of the due jobs are appended here
+     */
+    void CollectDue(Clock::time_point now, std::vector<JobHandle>& dueJobs);
+
+    /**
+     * Get when the earliest scheduled poll becomes due, e.g. to sleep till then.
+     *
+     * @returns time of the earliest poll, or Clock::time_point::max() if no poll is scheduled
+     */
+    Clock::time_point GetNextDue() const;
+
+    /**
+     * Get the memory held by the table.
+     *
+     * @returns bytes allocated for jobs, index and wheel
+     */
+    size_t GetMemoryUsage() const;
+
+private:
+    enum Flags : uint8_t
+    {
+        IN_USE = 1,
+        SCHEDULED = 2
+    };
+
+    uint32_t _ToTick(Clock::time_point time) const;
+    uint32_t _ToElapsedTick(Clock::time_point time) const;
+    size_t _GetIndexSlot(const JobId& id) const;
+    void _Link(JobHandle job, uint32_t tick);
+    void _Unlink(JobHandle job);
+    void _Index(JobHandle job);
+    void _Unindex(JobHandle job);
+    void _GrowIndex();
+
+    Clock::time_point _epoch;
+    std::chrono::milliseconds _tickDuration;
+    uint32_t _currentTick;
+
+    // Job fields, one array per field indexed by handle
+    std::vector<uint64_t> _idHigh;
+    std::vector<uint64_t> _idLow;
+    std::vector<uint8_t> _flags;
+    std::vector<uint8_t> _states;
+    std::vector<uint8_t> _priorities;
+    std::vector<uint16_t> _retryCounts;
+    std::vector<uint32_t> _pollTicks;
+    std::vector<uint32_t> _deadlineTicks;
+    std::vector<JobHandle> _next;
+    std::vector<JobHandle> _previous;
+
+    std::vector<JobHandle> _freeHandles;
+    size_t _count;
+
+    // Open addressing index from id to handle
+    std::vector<JobHandle> _index;
+
+    // Heads of the job lists of each wheel slot
+    std::vector<JobHandle> _wheel;
+};
+
+QUBE_WIRE_NS_STOP
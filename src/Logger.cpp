@@ -0,0 +1,372 @@
+/**
+ * @file Logger.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of Logger class
+ */
+
+#include "Logger.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+// The writer looks for new records this often while the buffer is empty
+const chrono::milliseconds WRITER_IDLE_INTERVAL(20);
+
+namespace
+{
+    const char* const LEVEL_NAMES[] = {"debug", "info", "warning", "error", "off"};
+
+    // Fixed size, so that logging copies into the ring buffer without allocating.
+    // The sequence tells producers and the writer whose turn the slot is.
+    struct LogRecord
+    {
+        atomic<uint64_t> sequence;
+        int64_t time;
+        size_t threadId;
+        uint64_t requestId;
+        int64_t duration;
+        uint16_t status;
+        LogLevel level;
+        char event[24];
+        char method[8];
+        char endpoint[192];
+        char jobId[48];
+        char message[224];
+    };
+
+    template <size_t N>
+    void CopyField(char (&field)[N], const char* value)
+    {
+        size_t size = 0;
+        if (value)
+        {
+            while (size < N - 1 && value[size] != '\0')
+            {
+                ++size;
+            }
+            memcpy(field, value, size);
+        }
+        field[size] = '\0';
+    }
+
+    void WriteJsonString(ostream& stream, const char* value)
+    {
+        stream << '"';
+        for (const char* c = value; *c != '\0'; ++c)
+        {
+            switch (*c)
+            {
+                case '"': stream << "\\\""; break;
+                case '\\': stream << "\\\\"; break;
+                case '\n': stream << "\\n"; break;
+                case '\r': stream << "\\r"; break;
+                case '\t': stream << "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(*c) < 0x20)
+                    {
+                        stream << "\\u00" << "0123456789abcdef"[(*c >> 4) & 0xf]
+                               << "0123456789abcdef"[*c & 0xf];
+                    }
+                    else
+                    {
+                        stream << *c;
+                    }
+            }
+        }
+        stream << '"';
+    }
+
+    void WriteTime(ostream& stream, int64_t microseconds)
+    {
+        time_t seconds = static_cast<time_t>(microseconds / 1000000);
+        tm utc;
+#ifdef WIN32
+        gmtime_s(&utc, &seconds);
+#else
+        gmtime_r(&seconds, &utc);
+#endif
+        char formatted[40];
+        size_t size = strftime(formatted, sizeof(formatted), "%Y-%m-%dT%H:%M:%S", &utc);
+        snprintf(formatted + size, sizeof(formatted) - size, ".%06dZ",
+                 static_cast<int>(microseconds % 1000000));
+        stream << '"' << formatted << '"';
+    }
+}
+
+struct Logger::Impl
+{
+    Impl(const string& logFilePath, LogLevel level, size_t capacity)
+        : _logFile(logFilePath.c_str(), ios::app), _level(static_cast<uint8_t>(level)),
+          _enqueuePosition(0), _dequeuePosition(0), _writtenPosition(0), _droppedCount(0),
+          _reportedDropCount(0), _isStopping(false)
+    {
+        if (!_logFile.is_open())
+        {
+            throw runtime_error("Opening log file " + logFilePath + " for writing failed");
+        }
+
+        _capacity = 1;
+        while (_capacity < capacity)
+        {
+            _capacity *= 2;
+        }
+        _records.reset(new LogRecord[_capacity]);
+        for (size_t i = 0; i < _capacity; ++i)
+        {
+            _records[i].sequence.store(i, memory_order_relaxed);
+        }
+
+        _writer = thread([this]() { _Write(); });
+    }
+
+    ~Impl()
+    {
+        _isStopping = true;
+        _writer.join();
+    }
+
+    void SetLevel(LogLevel level) { _level.store(static_cast<uint8_t>(level), memory_order_relaxed); }
+
+    LogLevel GetLevel() const { return static_cast<LogLevel>(_level.load(memory_order_relaxed)); }
+
+    bool IsEnabled(LogLevel level) const
+    {
+        return level != LogLevel::Off && static_cast<uint8_t>(level) >= _level.load(memory_order_relaxed);
+    }
+
+    void Log(LogLevel level, const char* event, const LogFields& fields)
+    {
+        if (!IsEnabled(level))
+        {
+            return;
+        }
+
+        // Claim the next slot; a slot still holding an unwritten record means the buffer is full
+        uint64_t position = _enqueuePosition.load(memory_order_relaxed);
+        LogRecord* record;
+        while (true)
+        {
+            record = &_records[position & (_capacity - 1)];
+            int64_t lag = static_cast<int64_t>(record->sequence.load(memory_order_acquire) - position);
+            if (lag == 0)
+            {
+                if (_enqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (lag < 0)
+            {
+                _droppedCount.fetch_add(1, memory_order_relaxed);
+                return;
+            }
+            else
+            {
+                position = _enqueuePosition.load(memory_order_relaxed);
+            }
+        }
+
+        record->time = chrono::duration_cast<chrono::microseconds>(
+                           chrono::system_clock::now().time_since_epoch()).count();
+        record->threadId = hash<thread::id>()(this_thread::get_id());
+        record->requestId = fields.requestId;
+        record->duration = fields.duration.count();
+        record->status = fields.status;
+        record->level = level;
+        CopyField(record->event, event);
+        CopyField(record->method, fields.method);
+        CopyField(record->endpoint, fields.endpoint);
+        CopyField(record->jobId, fields.jobId);
+        CopyField(record->message, fields.message);
+
+        record->sequence.store(position + 1, memory_order_release);
+    }
+
+    void Flush()
+    {
+        uint64_t position = _enqueuePosition.load(memory_order_relaxed);
+        while (_writtenPosition.load(memory_order_acquire) < position)
+        {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+    }
+
+    uint64_t GetDroppedCount() const { return _droppedCount.load(memory_order_relaxed); }
+
+private:
+    void _Write()
+    {
+        while (true)
+        {
+            // Records logged before stopping are written by this last pass
+            bool isStopping = _isStopping;
+            bool isWritten = _WriteAvailable();
+            if (isStopping)
+            {
+                return;
+            }
+            if (!isWritten)
+            {
+                this_thread::sleep_for(WRITER_IDLE_INTERVAL);
+            }
+        }
+    }
+
+    bool _WriteAvailable()
+    {
+        bool isWritten = false;
+        while (true)
+        {
+            LogRecord& record = _records[_dequeuePosition & (_capacity - 1)];
+            if (record.sequence.load(memory_order_acquire) != _dequeuePosition + 1)
+            {
+                break;
+            }
+
+            _WriteRecord(record);
+            record.sequence.store(_dequeuePosition + _capacity, memory_order_release);
+            ++_dequeuePosition;
+            isWritten = true;
+        }
+
+        uint64_t droppedCount = _droppedCount.load(memory_order_relaxed);
+        if (droppedCount != _reportedDropCount)
+        {
+            _logFile << "{\"time\":";
+            WriteTime(_logFile, chrono::duration_cast<chrono::microseconds>(
+                                    chrono::system_clock::now().time_since_epoch()).count());
+            _logFile << ",\"level\":\"warning\",\"event\":\"log records dropped\",\"count\":"
+                     << droppedCount - _reportedDropCount << "}\n";
+            _reportedDropCount = droppedCount;
+            isWritten = true;
+        }
+
+        if (isWritten)
+        {
+            _logFile.flush();
+            _writtenPosition.store(_dequeuePosition, memory_order_release);
+        }
+
+        return isWritten;
+    }
+
+    void _WriteRecord(const LogRecord& record)
+    {
+        _logFile << "{\"time\":";
+        WriteTime(_logFile, record.time);
+        _logFile << ",\"level\":\"" << LEVEL_NAMES[static_cast<size_t>(record.level)]
+                 << "\",\"thread\":" << (record.threadId & 0xffffff) << ",\"event\":";
+        WriteJsonString(_logFile, record.event);
+        if (record.requestId != 0)
+        {
+            _logFile << ",\"request\":" << record.requestId;
+        }
+        if (record.method[0] != '\0')
+        {
+            _logFile << ",\"method\":";
+            WriteJsonString(_logFile, record.method);
+        }
+        if (record.endpoint[0] != '\0')
+        {
+            _logFile << ",\"endpoint\":";
+            WriteJsonString(_logFile, record.endpoint);
+        }
+        if (record.status != 0)
+        {
+            _logFile << ",\"status\":" << record.status;
+        }
+        if (record.duration >= 0)
+        {
+            _logFile << ",\"durationUs\":" << record.duration;
+        }
+        if (record.jobId[0] != '\0')
+        {
+            _logFile << ",\"job\":";
+            WriteJsonString(_logFile, record.jobId);
+        }
+        if (record.message[0] != '\0')
+        {
+            _logFile << ",\"message\":";
+            WriteJsonString(_logFile, record.message);
+        }
+        _logFile << "}\n";
+    }
+
+    ofstream _logFile;
+    atomic<uint8_t> _level;
+
+    unique_ptr<LogRecord[]> _records;
+    size_t _capacity;
+    atomic<uint64_t> _enqueuePosition;
+    uint64_t _dequeuePosition;
+    atomic<uint64_t> _writtenPosition;
+    atomic<uint64_t> _droppedCount;
+    uint64_t _reportedDropCount;
+
+    atomic<bool> _isStopping;
+    thread _writer;
+};
+
+Logger::Logger(const string& logFilePath, LogLevel level, size_t capacity)
+{
+    _impl.reset(new Impl(logFilePath, level, capacity));
+}
+
+Logger::~Logger()
+{
+}
+
+void Logger::SetLevel(LogLevel level)
+{
+    _impl->SetLevel(level);
+}
+
+LogLevel Logger::GetLevel() const
+{
+    return _impl->GetLevel();
+}
+
+bool Logger::IsEnabled(LogLevel level) const
+{
+    return _impl->IsEnabled(level);
+}
+
+void Logger::Log(LogLevel level, const char* event, const LogFields& fields)
+{
+    _impl->Log(level, event, fields);
+}
+
+void Logger::Flush()
+{
+    _impl->Flush();
+}
+
+uint64_t Logger::GetDroppedCount() const
+{
+    return _impl->GetDroppedCount();
+}
+
+LogLevel Logger::ParseLevel(const string& name)
+{
+    for (size_t i = 0; i < sizeof(LEVEL_NAMES) / sizeof(LEVEL_NAMES[0]); ++i)
+    {
+        if (name == LEVEL_NAMES[i])
+        {
+            return static_cast<LogLevel>(i);
+        }
+    }
+
+    throw runtime_error("Invalid log level " + name);
+}
@@ -0,0 +1,132 @@
+/**
+ * @file Logger.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains Logger, which records structured log records of client operations into a lock-free
+ * ring buffer and writes them as JSON lines from a background thread.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Severity of a log record.
+ */
+enum class LogLevel : uint8_t
+{
+    Debug = 0,   ///< hedges, probes and other detail
+    Info = 1,    ///< every request and job submission
+    Warning = 2, ///< server errors, expired deadlines and cancelled calls
+    Error = 3,   ///< failed requests
+    Off = 4      ///< nothing is logged
+};
+
+/**
+ * Fields of a log record. Unset fields are left out of the record. Strings are copied into the
+ * record, truncated if long, so they only need to outlive the call to Logger::Log.
+ */
+struct LogFields
+{
+    LogFields()
+        : requestId(0), method(nullptr), endpoint(nullptr), status(0),
+          duration(std::chrono::microseconds(-1)), jobId(nullptr), message(nullptr)
+    {
+    }
+
+    uint64_t requestId;                 ///< id of the HTTP request within its client
+    const char* method;                 ///< HTTP method
+    const char* endpoint;               ///< URL of the request
+    uint16_t status;                    ///< HTTP status
+    std::chrono::microseconds duration; ///< time the request or operation took
+    const char* jobId;                  ///< Qube Wire job the record belongs to
+    const char* message;                ///< error message or other text
+};
+
+/**
+ * Logger appends one JSON object per record to a log file. Records are copied into a fixed
+ * size ring buffer without locking or allocating, and written out by a background thread, so
+ * logging costs the calling thread a few hundred nanoseconds. When the writer falls behind and
+ * the buffer is full, records are dropped and the number dropped is logged instead.
+ * Levels below the current level cost an atomic load. All methods are thread safe.
+ */
+class Logger
+{
+public:
+    /**
+     * Construct Logger class object and start its writer thread.
+     *
+     * @param[in] logFilePath Path of the log file, appended to
+     * @param[in] level Least severe level recorded
+     * @param[in] capacity Records the ring buffer holds, rounded up to a power of two
+     */
+    Logger(const std::string& logFilePath, LogLevel level = LogLevel::Info, size_t capacity = 4096);
+
+    /**
+     * Destruct Logger class object. Records logged so far are written before it returns.
+     */
+    ~Logger();
+
+    /**
+     * Change the least severe level recorded. Safe to call from a signal handler.
+     *
+     * @param[in] level New level; LogLevel::Off stops logging
+     */
+    void SetLevel(LogLevel level);
+
+    LogLevel GetLevel() const;
+
+    /**
+     * Get whether records of a level are recorded, to skip building records that aren't.
+     *
+     * @param[in] level Level of a record
+     *
+     * @returns true if records of the level are recorded
+     */
+    bool IsEnabled(LogLevel level) const;
+
+    /**
+     * Record a log record, if its level is enabled.
+     *
+     * @param[in] level Level of the record
+     * @param[in] event What happened, e.g. "request"
+     * @param[in] fields Fields of the record
+     */
+    void Log(LogLevel level, const char* event, const LogFields& fields = LogFields());
+
+    /**
+     * Wait till all records logged so far are written to the log file.
+     */
+    void Flush();
+
+    /**
+     * Get the number of records dropped because the ring buffer was full.
+     *
+     * @returns dropped record count
+     */
+    uint64_t GetDroppedCount() const;
+
+    /**
+     * Parse a level name.
+     *
+     * @param[in] name debug, info, warning, error or off
+     *
+     * @returns level
+     */
+    static LogLevel ParseLevel(const std::string& name);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+QUBE_WIRE_NS_STOP
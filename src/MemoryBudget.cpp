@@ -0,0 +1,358 @@
+/**
+ * @file MemoryBudget.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of MemoryBudget and BodyBuffer classes
+ */
+
+#include "MemoryBudget.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+// Cancellation signals its token, not the pool, so waits for room wake up this often to check
+const chrono::milliseconds CANCELLATION_CHECK_INTERVAL(10);
+
+QUBE_WIRE_NS_START
+
+// Space is reserved and released in whole slabs. Released slabs are kept for reuse as long as
+// slabs in use and kept together stay within the budget, so the pool never exceeds it.
+class SlabPool
+{
+public:
+    SlabPool(size_t budget, size_t slabSize)
+        : _budgetSlabs(max<size_t>(budget / slabSize, 1)), _slabSize(slabSize), _usedSlabs(0),
+          _peakUsedSlabs(0)
+    {
+    }
+
+    ~SlabPool()
+    {
+        for (char* slab : _freeSlabs)
+        {
+            delete[] slab;
+        }
+    }
+
+    size_t GetSlabCount(size_t size) const { return (size + _slabSize - 1) / _slabSize; }
+
+    bool TryReserve(size_t slabCount)
+    {
+        lock_guard<mutex> lock(_poolMutex);
+        return _TryReserve(slabCount);
+    }
+
+    void Reserve(size_t slabCount, const CallOptions& options)
+    {
+        unique_lock<mutex> lock(_poolMutex);
+        while (!_TryReserve(slabCount))
+        {
+            options.cancellation.ThrowIfCancelled();
+            if (options.deadline.IsExpired())
+            {
+                throw DeadlineExceededError("Waiting for memory budget exceeded the deadline");
+            }
+
+            Deadline::Clock::time_point wakeUp =
+                options.deadline.Min(Deadline::Clock::time_point::max());
+            if (options.cancellation.IsCancellable())
+            {
+                wakeUp = min(wakeUp, Deadline::Clock::now() + CANCELLATION_CHECK_INTERVAL);
+            }
+            if (wakeUp == Deadline::Clock::time_point::max())
+            {
+                _released.wait(lock);
+            }
+            else
+            {
+                _released.wait_until(lock, wakeUp);
+            }
+        }
+    }
+
+    // Slabs are taken after their space is reserved, so they are within the budget
+    void TakeSlabs(size_t slabCount, vector<char*>& slabs)
+    {
+        slabs.reserve(slabCount);
+        {
+            lock_guard<mutex> lock(_poolMutex);
+            while (slabs.size() < slabCount && !_freeSlabs.empty())
+            {
+                slabs.push_back(_freeSlabs.back());
+                _freeSlabs.pop_back();
+            }
+        }
+
+        try
+        {
+            while (slabs.size() < slabCount)
+            {
+                slabs.push_back(new char[_slabSize]);
+            }
+        }
+        catch (...)
+        {
+            // The slabs taken are released with their buffer, the rest of the space right away
+            {
+                lock_guard<mutex> lock(_poolMutex);
+                _usedSlabs -= slabCount - slabs.size();
+            }
+            _released.notify_all();
+            throw;
+        }
+    }
+
+    void Release(vector<char*>& slabs)
+    {
+        {
+            lock_guard<mutex> lock(_poolMutex);
+            _usedSlabs -= slabs.size();
+            while (!slabs.empty() && _usedSlabs + _freeSlabs.size() < _budgetSlabs)
+            {
+                _freeSlabs.push_back(slabs.back());
+                slabs.pop_back();
+            }
+        }
+        _released.notify_all();
+
+        for (char* slab : slabs)
+        {
+            delete[] slab;
+        }
+        slabs.clear();
+    }
+
+    size_t GetSlabSize() const { return _slabSize; }
+
+    size_t GetBudget() const { return _budgetSlabs * _slabSize; }
+
+    size_t GetUsed() const
+    {
+        lock_guard<mutex> lock(_poolMutex);
+        return _usedSlabs * _slabSize;
+    }
+
+    size_t GetPeakUsed() const
+    {
+        lock_guard<mutex> lock(_poolMutex);
+        return _peakUsedSlabs * _slabSize;
+    }
+
+private:
+    bool _TryReserve(size_t slabCount)
+    {
+        if (_usedSlabs + slabCount > _budgetSlabs && _usedSlabs != 0)
+        {
+            return false;
+        }
+
+        _usedSlabs += slabCount;
+        _peakUsedSlabs = max(_peakUsedSlabs, _usedSlabs);
+
+        // An oversized body leaves fewer slabs to keep than are kept
+        while (!_freeSlabs.empty() && _usedSlabs + _freeSlabs.size() > _budgetSlabs)
+        {
+            delete[] _freeSlabs.back();
+            _freeSlabs.pop_back();
+        }
+
+        return true;
+    }
+
+    size_t _budgetSlabs;
+    size_t _slabSize;
+    size_t _usedSlabs;
+    size_t _peakUsedSlabs;
+    vector<char*> _freeSlabs;
+
+    mutable mutex _poolMutex;
+    condition_variable _released;
+};
+
+QUBE_WIRE_NS_STOP
+
+BodyBuffer::BodyBuffer() : _size(0)
+{
+}
+
+BodyBuffer::BodyBuffer(BodyBuffer&& buffer)
+    : _pool(move(buffer._pool)), _slabs(move(buffer._slabs)), _size(buffer._size)
+{
+    buffer._slabs.clear();
+    buffer._size = 0;
+}
+
+BodyBuffer& BodyBuffer::operator=(BodyBuffer&& buffer)
+{
+    if (this != &buffer)
+    {
+        _Release();
+        _pool = move(buffer._pool);
+        _slabs = move(buffer._slabs);
+        _size = buffer._size;
+        buffer._slabs.clear();
+        buffer._size = 0;
+    }
+
+    return *this;
+}
+
+BodyBuffer::~BodyBuffer()
+{
+    _Release();
+}
+
+void BodyBuffer::Append(const char* data, size_t size)
+{
+    if (size > GetCapacity() - _size)
+    {
+        throw runtime_error("Body exceeds the space reserved for it");
+    }
+
+    size_t slabSize = _pool ? _pool->GetSlabSize() : 0;
+    while (size > 0)
+    {
+        size_t offset = _size % slabSize;
+        size_t chunkSize = min(size, slabSize - offset);
+        memcpy(_slabs[_size / slabSize] + offset, data, chunkSize);
+        _size += chunkSize;
+        data += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+void BodyBuffer::Append(const string& data)
+{
+    Append(data.data(), data.size());
+}
+
+void BodyBuffer::Append(istream& stream, size_t size)
+{
+    if (size > GetCapacity() - _size)
+    {
+        throw runtime_error("Body exceeds the space reserved for it");
+    }
+
+    size_t slabSize = _pool ? _pool->GetSlabSize() : 0;
+    while (size > 0)
+    {
+        size_t offset = _size % slabSize;
+        size_t chunkSize = min(size, slabSize - offset);
+        if (!stream.read(_slabs[_size / slabSize] + offset, chunkSize))
+        {
+            throw runtime_error("Reading body failed");
+        }
+        _size += chunkSize;
+        size -= chunkSize;
+    }
+}
+
+size_t BodyBuffer::GetSize() const
+{
+    return _size;
+}
+
+size_t BodyBuffer::GetCapacity() const
+{
+    return _pool ? _slabs.size() * _pool->GetSlabSize() : 0;
+}
+
+size_t BodyBuffer::GetSlabCount() const
+{
+    return _pool ? _pool->GetSlabCount(_size) : 0;
+}
+
+const char* BodyBuffer::GetSlab(size_t index, size_t& size) const
+{
+    size_t slabSize = _pool->GetSlabSize();
+    size = min(slabSize, _size - index * slabSize);
+    return _slabs[index];
+}
+
+string BodyBuffer::ToString() const
+{
+    string data;
+    data.reserve(_size);
+    for (size_t i = 0; i < GetSlabCount(); ++i)
+    {
+        size_t size = 0;
+        const char* slab = GetSlab(i, size);
+        data.append(slab, size);
+    }
+
+    return data;
+}
+
+void BodyBuffer::_Release()
+{
+    if (_pool)
+    {
+        _pool->Release(_slabs);
+        _pool.reset();
+    }
+    _size = 0;
+}
+
+MemoryBudget::MemoryBudget(size_t budget, size_t slabSize)
+{
+    if (slabSize == 0)
+    {
+        throw runtime_error("Invalid memory budget slab size");
+    }
+
+    _pool = make_shared<SlabPool>(budget, slabSize);
+}
+
+MemoryBudget::~MemoryBudget()
+{
+}
+
+BodyBuffer MemoryBudget::Allocate(size_t size, const CallOptions& options)
+{
+    size_t slabCount = _pool->GetSlabCount(size);
+    _pool->Reserve(slabCount, options);
+
+    BodyBuffer buffer;
+    buffer._pool = _pool;
+    _pool->TakeSlabs(slabCount, buffer._slabs);
+
+    return buffer;
+}
+
+bool MemoryBudget::TryAllocate(size_t size, BodyBuffer& buffer)
+{
+    size_t slabCount = _pool->GetSlabCount(size);
+    if (!_pool->TryReserve(slabCount))
+    {
+        return false;
+    }
+
+    buffer = BodyBuffer();
+    buffer._pool = _pool;
+    _pool->TakeSlabs(slabCount, buffer._slabs);
+
+    return true;
+}
+
+size_t MemoryBudget::GetBudget() const
+{
+    return _pool->GetBudget();
+}
+
+size_t MemoryBudget::GetUsed() const
+{
+    return _pool->GetUsed();
+}
+
+size_t MemoryBudget::GetPeakUsed() const
+{
+    return _pool->GetPeakUsed();
+}
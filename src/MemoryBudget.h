@@ -0,0 +1,193 @@
+/**
+ * @file MemoryBudget.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains MemoryBudget, which bounds the memory held by request bodies in flight, and
+ * BodyBuffer, a body drawn from its pool of fixed size slabs.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+#include "Cancellation.h"
+
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+QUBE_WIRE_NS_START
+
+class SlabPool;
+
+/**
+ * A body held in slabs of a MemoryBudget. The space is reserved when the buffer is allocated
+ * and is filled by appending up to that size. The slabs go back to the pool, and the space to
+ * the budget, when the buffer is destroyed. Buffers can be moved but not copied.
+ */
+class BodyBuffer
+{
+public:
+    /**
+     * Construct an empty buffer with no space.
+     */
+    BodyBuffer();
+
+    BodyBuffer(BodyBuffer&& buffer);
+
+    BodyBuffer& operator=(BodyBuffer&& buffer);
+
+    /**
+     * Destruct BodyBuffer class object, returning its slabs to the pool.
+     */
+    ~BodyBuffer();
+
+    /**
+     * Append data, throwing if it doesn't fit in the space reserved.
+     *
+     * @param[in] data Data to append
+     * @param[in] size Size of the data
+     */
+    void Append(const char* data, size_t size);
+
+    void Append(const std::string& data);
+
+    /**
+     * Append data read from a stream, throwing if it can't be read or doesn't fit.
+     *
+     * @param[in] stream Stream to read from
+     * @param[in] size Bytes to read
+     */
+    void Append(std::istream& stream, size_t size);
+
+    /**
+     * Get the size of the data appended so far.
+     *
+     * @returns size in bytes
+     */
+    size_t GetSize() const;
+
+    /**
+     * Get the space reserved for the buffer.
+     *
+     * @returns capacity in bytes
+     */
+    size_t GetCapacity() const;
+
+    /**
+     * Get the number of slabs holding data; each is full except the last one.
+     *
+     * @returns slab count
+     */
+    size_t GetSlabCount() const;
+
+    /**
+     * Get a slab holding data.
+     *
+     * @param[in] index Index of the slab, less than BodyBuffer::GetSlabCount
+     * @param[out] size Size of the data in the slab
+     *
+     * @returns data of the slab
+     */
+    const char* GetSlab(size_t index, size_t& size) const;
+
+    /**
+     * Copy the data into a string.
+     *
+     * @returns data appended so far
+     */
+    std::string ToString() const;
+
+private:
+    friend class MemoryBudget;
+
+    BodyBuffer(const BodyBuffer&);
+    BodyBuffer& operator=(const BodyBuffer&);
+
+    void _Release();
+
+    std::shared_ptr<SlabPool> _pool;
+    std::vector<char*> _slabs;
+    size_t _size;
+};
+
+/**
+ * MemoryBudget is a byte budget shared by every body in flight, e.g. by all signing jobs of a
+ * client and a work queue. Bodies are drawn from a pool of fixed size slabs, so large documents
+ * don't need contiguous allocations and slabs are reused rather than freed; the pool never
+ * holds more than the budget. Once the budget is used up, MemoryBudget::Allocate blocks till
+ * enough is released and MemoryBudget::TryAllocate fails, so callers can defer work instead.
+ * A body larger than the whole budget is only allocated when nothing else is.
+ * All methods are thread safe, and buffers may outlive the budget they came from.
+ */
+class MemoryBudget
+{
+public:
+    static const size_t DEFAULT_SLAB_SIZE = 64 * 1024;
+
+    /**
+     * Construct MemoryBudget class object.
+     *
+     * @param[in] budget Bytes all buffers may hold together
+     * @param[in] slabSize Size of the slabs buffers are made of; space is reserved in slabs
+     */
+    MemoryBudget(size_t budget, size_t slabSize = DEFAULT_SLAB_SIZE);
+
+    /**
+     * Destruct MemoryBudget class object.
+     */
+    ~MemoryBudget();
+
+    /**
+     * Allocate a buffer, waiting till the budget has room for it.
+     * Throws DeadlineExceededError or OperationCancelledError if the call's bounds fire first.
+     *
+     * @param[in] size Space to reserve
+     * @param[in] options Deadline and cancellation token of the wait
+     *
+     * @returns empty buffer of the given capacity
+     */
+    BodyBuffer Allocate(size_t size, const CallOptions& options = CallOptions());
+
+    /**
+     * Allocate a buffer if the budget has room for it right away.
+     *
+     * @param[in] size Space to reserve
+     * @param[out] buffer Empty buffer of the given capacity
+     *
+     * @returns false if the budget is used up
+     */
+    bool TryAllocate(size_t size, BodyBuffer& buffer);
+
+    /**
+     * Get the budget.
+     *
+     * @returns bytes all buffers may hold together
+     */
+    size_t GetBudget() const;
+
+    /**
+     * Get the space reserved by buffers that exist.
+     *
+     * @returns bytes in use
+     */
+    size_t GetUsed() const;
+
+    /**
+     * Get the most space reserved at once since the budget was constructed.
+     *
+     * @returns peak bytes in use
+     */
+    size_t GetPeakUsed() const;
+
+private:
+    MemoryBudget(const MemoryBudget&);
+    MemoryBudget& operator=(const MemoryBudget&);
+
+    std::shared_ptr<SlabPool> _pool;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,331 @@
+/**
+ * @file PklBuilder.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of PklBuilder class
+ */
+
+#include "PklBuilder.h"
+#include "AssetHasher.h"
+#include "XmlHelpers.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace ptree = boost::property_tree;
+namespace filesystem = boost::filesystem;
+
+const string PKL_NAMESPACE = "http://www.smpte-ra.org/schemas/429-8/2007/PKL";
+
+namespace
+{
+    string GetIssueDate()
+    {
+        time_t now = time(nullptr);
+        tm utcTime;
+#ifdef WIN32
+        gmtime_s(&utcTime, &now);
+#else
+        gmtime_r(&now, &utcTime);
+#endif
+        char issueDate[32];
+        strftime(issueDate, sizeof(issueDate), "%Y-%m-%dT%H:%M:%S+00:00", &utcTime);
+
+        return issueDate;
+    }
+
+    ptree::ptree::iterator FindXmlChild(ptree::ptree& parent, const string& localName)
+    {
+        for (ptree::ptree::iterator child = parent.begin(); child != parent.end(); ++child)
+        {
+            const string& name = child->first;
+            size_t prefixEnd = name.find(':');
+            if (name.compare(prefixEnd == string::npos ? 0 : prefixEnd + 1, string::npos,
+                             localName) == 0)
+            {
+                return child;
+            }
+        }
+
+        return parent.end();
+    }
+
+    // Namespace prefix of an element name including the colon, so that elements added to a
+    // template are in the template's namespace
+    string GetXmlPrefix(const string& name)
+    {
+        size_t prefixEnd = name.find(':');
+        return prefixEnd == string::npos ? "" : name.substr(0, prefixEnd + 1);
+    }
+
+    ptree::ptree CreateAssetNode(const PklAsset& asset, const string& prefix)
+    {
+        ptree::ptree assetNode;
+        assetNode.add(prefix + "Id", UUID_URN_PREFIX + asset.id);
+        if (!asset.annotationText.empty())
+        {
+            assetNode.add(prefix + "AnnotationText", asset.annotationText);
+        }
+        assetNode.add(prefix + "Hash", asset.hash);
+        assetNode.add(prefix + "Size", asset.size);
+        assetNode.add(prefix + "Type", asset.type);
+        string originalFileName = asset.originalFileName.empty()
+                                      ? filesystem::path(asset.filePath).filename().string()
+                                      : asset.originalFileName;
+        if (!originalFileName.empty())
+        {
+            assetNode.add(prefix + "OriginalFileName", originalFileName);
+        }
+
+        return assetNode;
+    }
+
+    // Hash and Size missing from a template asset are added where ST 429-8 places them
+    void WriteAssetDigest(ptree::ptree& assetNode, const string& prefix, const PklAsset& asset)
+    {
+        ptree::ptree::iterator hash = FindXmlChild(assetNode, "Hash");
+        if (hash == assetNode.end())
+        {
+            ptree::ptree::iterator previous = FindXmlChild(assetNode, "AnnotationText");
+            if (previous == assetNode.end())
+            {
+                previous = FindXmlChild(assetNode, "Id");
+            }
+            hash = assetNode.insert(previous == assetNode.end() ? assetNode.end() : ++previous,
+                                    make_pair(prefix + "Hash", ptree::ptree()));
+        }
+        hash->second.put_value(asset.hash);
+
+        ptree::ptree::iterator size = FindXmlChild(assetNode, "Size");
+        if (size == assetNode.end())
+        {
+            size = assetNode.insert(++hash, make_pair(prefix + "Size", ptree::ptree()));
+        }
+        size->second.put_value(asset.size);
+    }
+}
+
+PklBuilder::PklBuilder(const string& annotationText, const string& issuer, const string& creator)
+{
+    _id = boost::uuids::to_string(boost::uuids::random_generator()());
+    _annotationText = annotationText;
+    _issuer = issuer;
+    _creator = creator;
+    _threadCount = 0;
+}
+
+PklBuilder PklBuilder::FromXml(const string& pklXml, const string& assetDirectory)
+{
+    istringstream pklStream(pklXml);
+    ptree::ptree document;
+    ptree::read_xml(pklStream, document);
+
+    const ptree::ptree* packingList = FindXmlElement(document, "PackingList");
+    if (!packingList)
+    {
+        throw runtime_error("PKL template doesn't have a PackingList");
+    }
+
+    PklBuilder builder(GetXmlElementText(*packingList, "AnnotationText"),
+                       GetXmlElementText(*packingList, "Issuer"),
+                       GetXmlElementText(*packingList, "Creator"));
+    string id = StripUuidUrn(GetXmlElementText(*packingList, "Id"));
+    if (!id.empty())
+    {
+        builder._id = id;
+    }
+    builder._templateXml = pklXml;
+
+    const ptree::ptree* assetList = FindXmlElement(*packingList, "AssetList");
+    if (!assetList)
+    {
+        return builder;
+    }
+
+    for (const ptree::ptree::value_type& assetNode : *assetList)
+    {
+        if (assetNode.first == "<xmlattr>" || assetNode.first == "<xmlcomment>")
+        {
+            continue;
+        }
+
+        PklAsset asset;
+        asset.id = StripUuidUrn(GetXmlElementText(assetNode.second, "Id"));
+        asset.annotationText = GetXmlElementText(assetNode.second, "AnnotationText");
+        asset.type = GetXmlElementText(assetNode.second, "Type");
+        asset.originalFileName = GetXmlElementText(assetNode.second, "OriginalFileName");
+        asset.hash = GetXmlElementText(assetNode.second, "Hash");
+        if (!asset.hash.empty())
+        {
+            asset.size = strtoull(GetXmlElementText(assetNode.second, "Size").c_str(), nullptr, 10);
+        }
+        if (!asset.originalFileName.empty())
+        {
+            asset.filePath = (filesystem::path(assetDirectory) / asset.originalFileName).string();
+        }
+
+        builder.AddAsset(asset);
+    }
+
+    return builder;
+}
+
+void PklBuilder::SetThreadCount(unsigned threadCount)
+{
+    _threadCount = threadCount;
+}
+
+void PklBuilder::AddAsset(const PklAsset& asset)
+{
+    if (asset.id.empty())
+    {
+        throw runtime_error("PKL asset must have an id");
+    }
+    if (asset.hash.empty() && asset.filePath.empty())
+    {
+        throw runtime_error("PKL asset " + asset.id + " has neither a hash nor a file path");
+    }
+
+    _assets.push_back(asset);
+}
+
+bool PklBuilder::SetAssetDigest(const string& id, const AssetDigest& digest)
+{
+    for (PklAsset& asset : _assets)
+    {
+        if (asset.id == id)
+        {
+            asset.hash = digest.hash;
+            asset.size = digest.size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const vector<PklAsset>& PklBuilder::GetAssets() const
+{
+    return _assets;
+}
+
+const string& PklBuilder::GetId() const
+{
+    return _id;
+}
+
+void PklBuilder::HashAssets(const vector<string>& skippedIds, const CancellationToken& cancellation)
+{
+    vector<string> filePaths;
+    vector<size_t> unhashedAssets;
+    for (size_t i = 0; i < _assets.size(); ++i)
+    {
+        if (_assets[i].hash.empty() &&
+            find(skippedIds.begin(), skippedIds.end(), _assets[i].id) == skippedIds.end())
+        {
+            filePaths.push_back(_assets[i].filePath);
+            unhashedAssets.push_back(i);
+        }
+    }
+
+    vector<AssetDigest> digests = AssetHasher(_threadCount).HashFiles(filePaths, cancellation);
+    for (size_t i = 0; i < unhashedAssets.size(); ++i)
+    {
+        PklAsset& asset = _assets[unhashedAssets[i]];
+        asset.hash = digests[i].hash;
+        asset.size = digests[i].size;
+    }
+}
+
+string PklBuilder::Build()
+{
+    HashAssets();
+    if (!_templateXml.empty())
+    {
+        return _BuildFromTemplate();
+    }
+
+    ptree::ptree packingList;
+    packingList.put("<xmlattr>.xmlns", PKL_NAMESPACE);
+    packingList.add("Id", UUID_URN_PREFIX + _id);
+    packingList.add("AnnotationText", _annotationText);
+    packingList.add("IssueDate", GetIssueDate());
+    packingList.add("Issuer", _issuer);
+    packingList.add("Creator", _creator);
+
+    ptree::ptree& assetList = packingList.add_child("AssetList", ptree::ptree());
+    for (const PklAsset& asset : _assets)
+    {
+        assetList.add_child("Asset", CreateAssetNode(asset, ""));
+    }
+
+    ptree::ptree document;
+    document.add_child("PackingList", packingList);
+
+    ostringstream pklXml;
+    ptree::write_xml(pklXml, document, ptree::xml_writer_make_settings<string>(' ', 2, "UTF-8"));
+
+    return pklXml.str();
+}
+
+string PklBuilder::_BuildFromTemplate() const
+{
+    istringstream pklStream(_templateXml);
+    ptree::ptree document;
+    ptree::read_xml(pklStream, document, ptree::xml_parser::trim_whitespace);
+
+    ptree::ptree::iterator packingList = FindXmlChild(document, "PackingList");
+    string prefix = GetXmlPrefix(packingList->first);
+    ptree::ptree::iterator assetList = FindXmlChild(packingList->second, "AssetList");
+    if (assetList == packingList->second.end())
+    {
+        assetList = packingList->second.push_back(make_pair(prefix + "AssetList", ptree::ptree()));
+    }
+
+    // Template assets are matched by id; assets added to the builder are appended
+    vector<bool> isWritten(_assets.size(), false);
+    for (ptree::ptree::value_type& assetNode : assetList->second)
+    {
+        if (assetNode.first == "<xmlattr>" || assetNode.first == "<xmlcomment>")
+        {
+            continue;
+        }
+
+        string id = StripUuidUrn(GetXmlElementText(assetNode.second, "Id"));
+        for (size_t i = 0; i < _assets.size(); ++i)
+        {
+            if (!isWritten[i] && _assets[i].id == id)
+            {
+                WriteAssetDigest(assetNode.second, GetXmlPrefix(assetNode.first), _assets[i]);
+                isWritten[i] = true;
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < _assets.size(); ++i)
+    {
+        if (!isWritten[i])
+        {
+            assetList->second.add_child(prefix + "Asset", CreateAssetNode(_assets[i], prefix));
+        }
+    }
+
+    ostringstream pklXml;
+    ptree::write_xml(pklXml, document, ptree::xml_writer_make_settings<string>(' ', 2, "UTF-8"));
+
+    return pklXml.str();
+}
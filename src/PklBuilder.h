@@ -0,0 +1,137 @@
+/**
+ * @file PklBuilder.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains PklBuilder, which builds an unsigned PKL(Packing List) from the assets of a DCP.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+#include "Cancellation.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+QUBE_WIRE_NS_START
+
+struct AssetDigest;
+
+/**
+ * An asset listed in a PKL.
+ */
+struct PklAsset
+{
+    PklAsset() : size(0) {}
+
+    std::string id;               ///< asset UUID, e.g. the MXF track file or CPL UUID
+    std::string type;             ///< MIME type, e.g. "application/mxf" or "text/xml"
+    std::string filePath;         ///< path of the asset file, hashed if hash is empty
+    std::string originalFileName; ///< file name in the package; file name of filePath if empty
+    std::string annotationText;   ///< optional annotation of the asset
+    std::string hash;             ///< base64 encoded SHA-1 digest; computed from filePath if empty
+    uint64_t size;                ///< size of the asset in bytes; computed with the hash
+};
+
+/**
+ * PklBuilder builds a SMPTE ST 429-8 packing list that can be signed through
+ * QubeWireClient::Sign, or fills in an existing packing list, Interop or SMPTE, used as
+ * template. Asset files without a known hash are hashed in parallel.
+ */
+class PklBuilder
+{
+public:
+    /**
+     * Construct PklBuilder class object.
+     *
+     * @param[in] annotationText Annotation of the packing list, e.g. the package title
+     * @param[in] issuer Issuer of the packing list
+     * @param[in] creator Application creating the packing list
+     */
+    PklBuilder(const std::string& annotationText, const std::string& issuer,
+               const std::string& creator);
+
+    /**
+     * Construct a PklBuilder from an existing unsigned PKL, keeping its id and assets.
+     * Assets without a hash are hashed from their OriginalFileName in assetDirectory.
+     * PklBuilder::Build keeps the template as it is, with its namespace, issue date and any
+     * other elements, and only writes the Hash and Size of its assets.
+     *
+     * @param[in] pklXml PKL to be used as template
+     * @param[in] assetDirectory Directory holding the asset files of the package
+     *
+     * @returns builder holding the header and assets of the template
+     */
+    static PklBuilder FromXml(const std::string& pklXml, const std::string& assetDirectory);
+
+    /**
+     * Set the number of asset files hashed in parallel.
+     *
+     * @param[in] threadCount Number of threads; 0 to use one per CPU core
+     */
+    void SetThreadCount(unsigned threadCount);
+
+    /**
+     * Add an asset to the packing list.
+     *
+     * @param[in] asset Asset to be listed
+     */
+    void AddAsset(const PklAsset& asset);
+
+    /**
+     * Set hash and size of a listed asset, e.g. once its signed CPL is available.
+     *
+     * @param[in] id UUID of the asset
+     * @param[in] digest Hash and size of the asset
+     *
+     * @returns true if the asset is listed, else false
+     */
+    bool SetAssetDigest(const std::string& id, const AssetDigest& digest);
+
+    /**
+     * Get the assets listed so far.
+     *
+     * @returns assets in the order they were added
+     */
+    const std::vector<PklAsset>& GetAssets() const;
+
+    /**
+     * Get the UUID of the packing list.
+     *
+     * @returns PKL UUID, generated when the builder is constructed
+     */
+    const std::string& GetId() const;
+
+    /**
+     * Hash all asset files that don't have a hash yet.
+     * Assets must not be added or updated while this runs.
+     *
+     * @param[in] skippedIds UUIDs of assets not to be hashed, e.g. CPLs still being signed
+     * @param[in] cancellation Token abandoning the hashing once cancelled
+     */
+    void HashAssets(const std::vector<std::string>& skippedIds = std::vector<std::string>(),
+                    const CancellationToken& cancellation = CancellationToken());
+
+    /**
+     * Hash all assets that don't have a hash yet and build the unsigned packing list.
+     *
+     * @returns unsigned PKL XML
+     */
+    std::string Build();
+
+private:
+    std::string _BuildFromTemplate() const;
+
+    std::string _id;
+    std::string _annotationText;
+    std::string _issuer;
+    std::string _creator;
+    unsigned _threadCount;
+    std::vector<PklAsset> _assets;
+    std::string _templateXml;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,116 @@
+/**
+ * @file PriorityScheduler.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of PriorityScheduler class
+ */
+
+#include "PriorityScheduler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+PriorityScheduler::PriorityScheduler() : _virtualTime(0)
+{
+    const unsigned defaultWeights[JOB_PRIORITY_COUNT] = {16, 4, 1};
+    for (unsigned i = 0; i < JOB_PRIORITY_COUNT; ++i)
+    {
+        _classes[i].weight = defaultWeights[i];
+        _classes[i].lastFinishTag = 0;
+        _classes[i].completedCount = 0;
+        _classes[i].totalWaitMilliseconds = 0;
+        _classes[i].maxWaitMilliseconds = 0;
+    }
+}
+
+void PriorityScheduler::SetWeight(JobPriority priority, unsigned weight)
+{
+    if (weight == 0)
+    {
+        throw invalid_argument("Priority class weight must be at least 1");
+    }
+
+    _classes[static_cast<unsigned>(priority)].weight = weight;
+}
+
+void PriorityScheduler::Enqueue(JobPriority priority, Task task)
+{
+    PriorityClass& priorityClass = _classes[static_cast<unsigned>(priority)];
+
+    // Each task costs one run; a class with weight w advances its tags by 1/w per task, so
+    // a class that was idle starts from the current virtual time instead of its old backlog
+    QueuedTask queuedTask;
+    queuedTask.task = move(task);
+    queuedTask.finishTag =
+        max(_virtualTime, priorityClass.lastFinishTag) + 1.0 / priorityClass.weight;
+    queuedTask.enqueuedAt = Clock::now();
+
+    priorityClass.lastFinishTag = queuedTask.finishTag;
+    priorityClass.tasks.push_back(move(queuedTask));
+}
+
+bool PriorityScheduler::IsEmpty() const
+{
+    for (const PriorityClass& priorityClass : _classes)
+    {
+        if (!priorityClass.tasks.empty())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool PriorityScheduler::RunNext()
+{
+    PriorityClass* next = nullptr;
+    for (PriorityClass& priorityClass : _classes)
+    {
+        if (!priorityClass.tasks.empty() &&
+            (!next || priorityClass.tasks.front().finishTag < next->tasks.front().finishTag))
+        {
+            next = &priorityClass;
+        }
+    }
+
+    if (!next)
+    {
+        return false;
+    }
+
+    QueuedTask queuedTask = move(next->tasks.front());
+    next->tasks.pop_front();
+    _virtualTime = queuedTask.finishTag;
+
+    double waitMilliseconds =
+        chrono::duration<double, milli>(Clock::now() - queuedTask.enqueuedAt).count();
+    ++next->completedCount;
+    next->totalWaitMilliseconds += waitMilliseconds;
+    next->maxWaitMilliseconds = max(next->maxWaitMilliseconds, waitMilliseconds);
+
+    queuedTask.task();
+
+    return true;
+}
+
+PriorityClassStatistics PriorityScheduler::GetStatistics(JobPriority priority) const
+{
+    const PriorityClass& priorityClass = _classes[static_cast<unsigned>(priority)];
+
+    PriorityClassStatistics statistics;
+    statistics.queueDepth = static_cast<uint32_t>(priorityClass.tasks.size());
+    statistics.completedCount = priorityClass.completedCount;
+    statistics.averageWaitMilliseconds =
+        priorityClass.completedCount == 0
+            ? 0
+            : priorityClass.totalWaitMilliseconds / priorityClass.completedCount;
+    statistics.maxWaitMilliseconds = priorityClass.maxWaitMilliseconds;
+
+    return statistics;
+}
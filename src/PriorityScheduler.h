@@ -0,0 +1,125 @@
+/**
+ * @file PriorityScheduler.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains PriorityScheduler, which orders queued work of interactive, normal and bulk jobs
+ * with weighted fair queuing.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Priority class of a job and of the requests made for it (submission and polls).
+ */
+enum class JobPriority : uint8_t
+{
+    Interactive = 0, ///< an operator is waiting for the job, e.g. a single CPL
+    Normal = 1,      ///< default priority
+    Bulk = 2         ///< large batches, e.g. DKDM ingest
+};
+
+const unsigned JOB_PRIORITY_COUNT = 3;
+
+/**
+ * Queue statistics of one priority class.
+ */
+struct PriorityClassStatistics
+{
+    uint32_t queueDepth;           ///< tasks currently waiting
+    uint64_t completedCount;       ///< tasks run so far
+    double averageWaitMilliseconds; ///< average time from enqueue to start of run
+    double maxWaitMilliseconds;    ///< longest time from enqueue to start of run
+};
+
+/**
+ * PriorityScheduler queues tasks per priority class and runs them in weighted fair order:
+ * under contention each class gets a share of runs proportional to its weight, so
+ * interactive tasks go ahead of a long bulk backlog while bulk work keeps progressing.
+ * It is not thread safe; tasks are enqueued and run on the owner's thread.
+ */
+class PriorityScheduler
+{
+public:
+    typedef std::function<void()> Task;
+
+    /**
+     * Construct PriorityScheduler class object with default weights
+     * (interactive 16, normal 4, bulk 1).
+     */
+    PriorityScheduler();
+
+    /**
+     * Set the share of a priority class.
+     *
+     * @param[in] priority Priority class
+     * @param[in] weight Relative share of runs, at least 1
+     */
+    void SetWeight(JobPriority priority, unsigned weight);
+
+    /**
+     * Queue a task.
+     *
+     * @param[in] priority Priority class of the task
+     * @param[in] task Task to be run
+     */
+    void Enqueue(JobPriority priority, Task task);
+
+    /**
+     * Get whether there is no queued task.
+     *
+     * @returns true if no task is queued
+     */
+    bool IsEmpty() const;
+
+    /**
+     * Run the next task in fair order.
+     *
+     * @returns false if there was no task to run
+     */
+    bool RunNext();
+
+    /**
+     * Get queue statistics of a priority class.
+     *
+     * @param[in] priority Priority class
+     *
+     * @returns statistics of the class
+     */
+    PriorityClassStatistics GetStatistics(JobPriority priority) const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct QueuedTask
+    {
+        Task task;
+        double finishTag;
+        Clock::time_point enqueuedAt;
+    };
+
+    struct PriorityClass
+    {
+        unsigned weight;
+        double lastFinishTag;
+        std::deque<QueuedTask> tasks;
+        uint64_t completedCount;
+        double totalWaitMilliseconds;
+        double maxWaitMilliseconds;
+    };
+
+    PriorityClass _classes[JOB_PRIORITY_COUNT];
+    double _virtualTime;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,352 @@
+/**
+ * @file QubeWireC.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of the C interface over QubeWireClient class
+ */
+
+#include "QubeWireC.h"
+#include "QubeWireClient.h"
+
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+struct qubewire_client
+{
+    qubewire_client(const string& clientId) : client(clientId), callTimeout(0) {}
+
+    QubeWireClient client;
+    string lastError;
+    unsigned callTimeout;
+
+    // Result that didn't fit the caller's buffer, returned again when asked for the same key
+    string retainedKey;
+    string retainedResult;
+
+    // Token of the call in progress, cancelled by qubewire_cancel from another thread
+    mutex cancellationMutex;
+    CancellationToken activeCancellation;
+};
+
+namespace
+{
+    // Runs a call with the client's bounds and turns exceptions into status codes
+    template <typename Call>
+    qubewire_status Run(qubewire_client* handle, Call call)
+    {
+        if (!handle)
+        {
+            return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+        }
+        handle->lastError.clear();
+
+        qubewire_status result = QUBEWIRE_ERROR_INTERNAL;
+        const char* message = "Unknown error";
+        try
+        {
+            CallOptions options;
+            options.cancellation = CancellationToken::Create();
+            if (handle->callTimeout != 0)
+            {
+                options.deadline = Deadline::After(chrono::milliseconds(handle->callTimeout));
+            }
+            {
+                lock_guard<mutex> lock(handle->cancellationMutex);
+                handle->activeCancellation = options.cancellation;
+            }
+
+            result = call(options);
+            message = nullptr;
+        }
+        catch (const OperationCancelledError& e)
+        {
+            result = QUBEWIRE_ERROR_CANCELLED;
+            message = e.what();
+        }
+        catch (const DeadlineExceededError& e)
+        {
+            result = QUBEWIRE_ERROR_DEADLINE_EXCEEDED;
+            message = e.what();
+        }
+        catch (const bad_alloc&)
+        {
+            result = QUBEWIRE_ERROR_OUT_OF_MEMORY;
+            message = "Out of memory";
+        }
+        catch (const invalid_argument& e)
+        {
+            result = QUBEWIRE_ERROR_INVALID_ARGUMENT;
+            message = e.what();
+        }
+        catch (const exception& e)
+        {
+            result = QUBEWIRE_ERROR_REQUEST_FAILED;
+            message = e.what();
+        }
+        catch (...)
+        {
+        }
+
+        {
+            lock_guard<mutex> lock(handle->cancellationMutex);
+            handle->activeCancellation = CancellationToken();
+        }
+
+        if (message)
+        {
+            try
+            {
+                handle->lastError = message;
+            }
+            catch (...)
+            {
+                handle->lastError.clear();
+            }
+        }
+
+        return result;
+    }
+
+    qubewire_status CopyOut(const string& value, char* buffer, size_t bufferSize, size_t* requiredSize)
+    {
+        if (requiredSize)
+        {
+            *requiredSize = value.size() + 1;
+        }
+        if (!buffer || bufferSize < value.size() + 1)
+        {
+            return QUBEWIRE_ERROR_BUFFER_TOO_SMALL;
+        }
+
+        memcpy(buffer, value.data(), value.size());
+        buffer[value.size()] = '\0';
+        return QUBEWIRE_OK;
+    }
+
+    // Copies out a result, keeping it when it doesn't fit so that it isn't fetched again
+    qubewire_status CopyOutRetained(qubewire_client* handle, const string& key, const string& value,
+                                    char* buffer, size_t bufferSize, size_t* requiredSize)
+    {
+        qubewire_status result = CopyOut(value, buffer, bufferSize, requiredSize);
+        if (result == QUBEWIRE_ERROR_BUFFER_TOO_SMALL)
+        {
+            handle->retainedKey = key;
+            handle->retainedResult = value;
+        }
+        else
+        {
+            handle->retainedKey.clear();
+            handle->retainedResult.clear();
+        }
+
+        return result;
+    }
+
+    bool TakeRetained(qubewire_client* handle, const string& key, string& value)
+    {
+        if (handle->retainedKey.empty() || handle->retainedKey != key)
+        {
+            return false;
+        }
+
+        value.swap(handle->retainedResult);
+        handle->retainedKey.clear();
+        return true;
+    }
+
+    vector<string> ToStrings(const char* const* values, size_t count)
+    {
+        vector<string> strings;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!values[i])
+            {
+                throw invalid_argument("Null URL");
+            }
+            strings.push_back(values[i]);
+        }
+
+        return strings;
+    }
+}
+
+int qubewire_abi_version(void)
+{
+    return QUBEWIRE_ABI_VERSION;
+}
+
+qubewire_status qubewire_client_create(const char* client_id, qubewire_client** client)
+{
+    if (!client_id || !client)
+    {
+        return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+    }
+
+    *client = nullptr;
+    try
+    {
+        *client = new qubewire_client(client_id);
+        return QUBEWIRE_OK;
+    }
+    catch (const bad_alloc&)
+    {
+        return QUBEWIRE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...)
+    {
+        return QUBEWIRE_ERROR_INTERNAL;
+    }
+}
+
+void qubewire_client_destroy(qubewire_client* client)
+{
+    delete client;
+}
+
+const char* qubewire_last_error(const qubewire_client* client)
+{
+    return client ? client->lastError.c_str() : "";
+}
+
+qubewire_status qubewire_set_call_timeout(qubewire_client* client, unsigned milliseconds)
+{
+    if (!client)
+    {
+        return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+    }
+
+    client->callTimeout = milliseconds;
+    return QUBEWIRE_OK;
+}
+
+qubewire_status qubewire_cancel(qubewire_client* client)
+{
+    if (!client)
+    {
+        return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+    }
+
+    lock_guard<mutex> lock(client->cancellationMutex);
+    if (client->activeCancellation.IsCancellable())
+    {
+        client->activeCancellation.Cancel();
+    }
+    return QUBEWIRE_OK;
+}
+
+qubewire_status qubewire_set_endpoints(qubewire_client* client, const char* const* qubewire_urls,
+                                       size_t qubewire_url_count, const char* const* qubeaccount_urls,
+                                       size_t qubeaccount_url_count)
+{
+    if ((!qubewire_urls && qubewire_url_count != 0) || (!qubeaccount_urls && qubeaccount_url_count != 0))
+    {
+        return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+    }
+
+    return Run(client, [&](const CallOptions&) -> qubewire_status {
+        client->client.SetEndpoints(ToStrings(qubewire_urls, qubewire_url_count),
+                                    ToStrings(qubeaccount_urls, qubeaccount_url_count));
+        return QUBEWIRE_OK;
+    });
+}
+
+qubewire_status qubewire_get_login_url(qubewire_client* client, char* url, size_t url_size,
+                                       size_t* required_size)
+{
+    return Run(client, [&](const CallOptions&) -> qubewire_status {
+        // A new login session is only started when the previous URL was handed out
+        string loginUrl;
+        if (!TakeRetained(client, "login", loginUrl))
+        {
+            loginUrl = client->client.GetLoginUrl();
+        }
+
+        return CopyOutRetained(client, "login", loginUrl, url, url_size, required_size);
+    });
+}
+
+qubewire_status qubewire_is_authenticated(qubewire_client* client)
+{
+    return Run(client, [&](const CallOptions& options) -> qubewire_status {
+        return client->client.IsAuthenticated(options) ? QUBEWIRE_OK : QUBEWIRE_PENDING;
+    });
+}
+
+qubewire_status qubewire_reset_token(qubewire_client* client)
+{
+    return Run(client, [&](const CallOptions&) -> qubewire_status {
+        client->client.ResetToken();
+        return QUBEWIRE_OK;
+    });
+}
+
+qubewire_status qubewire_get_certificate_chain(qubewire_client* client, char* chain,
+                                               size_t chain_size, size_t* required_size)
+{
+    return Run(client, [&](const CallOptions&) -> qubewire_status {
+        return CopyOut(client->client.GetCertificateChain(), chain, chain_size, required_size);
+    });
+}
+
+qubewire_status qubewire_sign(qubewire_client* client, const char* xml, size_t xml_size, char* job_id,
+                              size_t job_id_size)
+{
+    // The job is submitted before its id is known, so the buffer is checked up front
+    if (!xml || !job_id || job_id_size < QUBEWIRE_JOB_ID_SIZE)
+    {
+        return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+    }
+
+    return Run(client, [&](const CallOptions& options) -> qubewire_status {
+        return CopyOut(client->client.Sign(string(xml, xml_size), options), job_id, job_id_size,
+                       nullptr);
+    });
+}
+
+qubewire_status qubewire_upload_kdm(qubewire_client* client, const char* xml, size_t xml_size,
+                                    char* kdm_id, size_t kdm_id_size)
+{
+    if (!xml || !kdm_id || kdm_id_size < QUBEWIRE_JOB_ID_SIZE)
+    {
+        return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+    }
+
+    return Run(client, [&](const CallOptions& options) -> qubewire_status {
+        return CopyOut(client->client.UploadKdm(string(xml, xml_size), options), kdm_id, kdm_id_size,
+                       nullptr);
+    });
+}
+
+qubewire_status qubewire_get_signed_asset_xml(qubewire_client* client, const char* job_id, char* xml,
+                                              size_t xml_size, size_t* required_size)
+{
+    if (!job_id)
+    {
+        return QUBEWIRE_ERROR_INVALID_ARGUMENT;
+    }
+
+    return Run(client, [&](const CallOptions& options) -> qubewire_status {
+        string key = string("signed:") + job_id;
+        string signedXml;
+        if (!TakeRetained(client, key, signedXml))
+        {
+            SignedAssetResult result = client->client.GetSignedAssetXml(job_id, options);
+            if (!result.isSigned)
+            {
+                return QUBEWIRE_PENDING;
+            }
+            signedXml.swap(result.xml);
+        }
+
+        return CopyOutRetained(client, key, signedXml, xml, xml_size, required_size);
+    });
+}
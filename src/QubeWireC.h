@@ -0,0 +1,227 @@
+/**
+ * @file QubeWireC.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * C interface of the QubeWireClient library, for embedding the client in C and C++ tools
+ * without depending on its C++ ABI.
+ *
+ * All functions return a qubewire_status; no exception crosses this interface. Strings are
+ * returned in caller provided buffers. When a buffer is too small, QUBEWIRE_ERROR_BUFFER_TOO_SMALL
+ * is returned with the required size, and the result is kept so that calling again with a large
+ * enough buffer returns it without another request to Qube Wire.
+ * A client handle must not be used from more than one thread at a time, except for
+ * qubewire_cancel.
+ */
+
+#ifndef QUBEWIRE_C_H
+#define QUBEWIRE_C_H
+
+#include <stddef.h>
+
+#if defined(_WIN32) && !defined(QUBEWIRE_STATIC)
+#ifdef QUBEWIRE_EXPORTS
+#define QUBEWIRE_API __declspec(dllexport)
+#else
+#define QUBEWIRE_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define QUBEWIRE_API __attribute__((visibility("default")))
+#else
+#define QUBEWIRE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Version of this interface; incremented on incompatible changes */
+#define QUBEWIRE_ABI_VERSION 1
+
+/** Buffer size large enough for any job or KDM identifier, including the terminator */
+#define QUBEWIRE_JOB_ID_SIZE 64
+
+/**
+ * Result of a call.
+ */
+typedef enum qubewire_status
+{
+    QUBEWIRE_OK = 0,                         /**< call succeeded */
+    QUBEWIRE_PENDING = 1,                    /**< job isn't signed yet; poll again */
+    QUBEWIRE_ERROR_INVALID_ARGUMENT = -1,    /**< null handle, null or invalid argument */
+    QUBEWIRE_ERROR_BUFFER_TOO_SMALL = -2,    /**< see required size; call again with a larger buffer */
+    QUBEWIRE_ERROR_REQUEST_FAILED = -3,      /**< Qube Wire couldn't be reached or refused the request */
+    QUBEWIRE_ERROR_DEADLINE_EXCEEDED = -4,   /**< call didn't complete within its timeout */
+    QUBEWIRE_ERROR_CANCELLED = -5,           /**< call was cancelled through qubewire_cancel */
+    QUBEWIRE_ERROR_OUT_OF_MEMORY = -6,       /**< memory allocation failed */
+    QUBEWIRE_ERROR_INTERNAL = -7             /**< unexpected failure */
+} qubewire_status;
+
+/**
+ * Opaque handle of a Qube Wire client and its login session.
+ */
+typedef struct qubewire_client qubewire_client;
+
+/**
+ * Get the version of the interface implemented by the loaded library.
+ *
+ * @returns QUBEWIRE_ABI_VERSION of the library
+ */
+QUBEWIRE_API int qubewire_abi_version(void);
+
+/**
+ * Create a client.
+ *
+ * @param[in] client_id Unique client identifier to communicate with Qube Wire
+ * @param[out] client New client, to be destroyed with qubewire_client_destroy
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_client_create(const char* client_id, qubewire_client** client);
+
+/**
+ * Destroy a client. Passing null is allowed.
+ *
+ * @param[in] client Client to be destroyed
+ */
+QUBEWIRE_API void qubewire_client_destroy(qubewire_client* client);
+
+/**
+ * Get the message of the last failed call on a client.
+ *
+ * @param[in] client Client
+ *
+ * @returns message valid till the next call on the client; empty if the last call succeeded
+ */
+QUBEWIRE_API const char* qubewire_last_error(const qubewire_client* client);
+
+/**
+ * Set the timeout of each subsequent call, see QubeWireClient deadlines.
+ *
+ * @param[in] client Client
+ * @param[in] milliseconds Timeout of each call; 0 for none, which is the default
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_set_call_timeout(qubewire_client* client, unsigned milliseconds);
+
+/**
+ * Cancel the call in progress on a client, which then returns QUBEWIRE_ERROR_CANCELLED.
+ * This may be called from any thread.
+ *
+ * @param[in] client Client
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_cancel(qubewire_client* client);
+
+/**
+ * Set the Qube Wire and Qube Account endpoints, see QubeWireClient::SetEndpoints.
+ *
+ * @param[in] client Client
+ * @param[in] qubewire_urls Base URLs of Qube Wire in order of preference
+ * @param[in] qubewire_url_count Number of Qube Wire URLs; 0 for the default host
+ * @param[in] qubeaccount_urls Base URLs of Qube Account in order of preference
+ * @param[in] qubeaccount_url_count Number of Qube Account URLs; 0 for the default host
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_set_endpoints(qubewire_client* client,
+                                                    const char* const* qubewire_urls,
+                                                    size_t qubewire_url_count,
+                                                    const char* const* qubeaccount_urls,
+                                                    size_t qubeaccount_url_count);
+
+/**
+ * Start a login session and get its login URL, see QubeWireClient::GetLoginUrl.
+ *
+ * @param[in] client Client
+ * @param[out] url Buffer receiving the null terminated URL
+ * @param[in] url_size Size of the buffer
+ * @param[out] required_size Size needed for the URL including the terminator; may be null
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_get_login_url(qubewire_client* client, char* url, size_t url_size,
+                                                    size_t* required_size);
+
+/**
+ * Check whether the user has logged in, see QubeWireClient::IsAuthenticated.
+ *
+ * @param[in] client Client
+ *
+ * @returns QUBEWIRE_OK once logged in, QUBEWIRE_PENDING while waiting for the user
+ */
+QUBEWIRE_API qubewire_status qubewire_is_authenticated(qubewire_client* client);
+
+/**
+ * End the login session, see QubeWireClient::ResetToken.
+ *
+ * @param[in] client Client
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_reset_token(qubewire_client* client);
+
+/**
+ * Get the certificate chain of the user's active company in PEM form.
+ *
+ * @param[in] client Client
+ * @param[out] chain Buffer receiving the null terminated certificate chain
+ * @param[in] chain_size Size of the buffer
+ * @param[out] required_size Size needed including the terminator; may be null
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_get_certificate_chain(qubewire_client* client, char* chain,
+                                                            size_t chain_size, size_t* required_size);
+
+/**
+ * Post a CPL or PKL to be signed, see QubeWireClient::Sign.
+ *
+ * @param[in] client Client
+ * @param[in] xml Unsigned asset XML
+ * @param[in] xml_size Length of the XML in bytes
+ * @param[out] job_id Buffer of at least QUBEWIRE_JOB_ID_SIZE receiving the signing job id
+ * @param[in] job_id_size Size of the job id buffer
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_sign(qubewire_client* client, const char* xml, size_t xml_size,
+                                           char* job_id, size_t job_id_size);
+
+/**
+ * Upload an unsigned KDM, see QubeWireClient::UploadKdm.
+ *
+ * @param[in] client Client
+ * @param[in] xml KDM XML
+ * @param[in] xml_size Length of the XML in bytes
+ * @param[out] kdm_id Buffer of at least QUBEWIRE_JOB_ID_SIZE receiving the KDM id
+ * @param[in] kdm_id_size Size of the KDM id buffer
+ *
+ * @returns QUBEWIRE_OK on success
+ */
+QUBEWIRE_API qubewire_status qubewire_upload_kdm(qubewire_client* client, const char* xml,
+                                                 size_t xml_size, char* kdm_id, size_t kdm_id_size);
+
+/**
+ * Get the signed asset of a signing job, see QubeWireClient::GetSignedAssetXml.
+ *
+ * @param[in] client Client
+ * @param[in] job_id Signing job id from qubewire_sign
+ * @param[out] xml Buffer receiving the null terminated signed XML
+ * @param[in] xml_size Size of the buffer
+ * @param[out] required_size Size needed including the terminator; may be null
+ *
+ * @returns QUBEWIRE_OK once signed, QUBEWIRE_PENDING while the job is in progress
+ */
+QUBEWIRE_API qubewire_status qubewire_get_signed_asset_xml(qubewire_client* client, const char* job_id,
+                                                           char* xml, size_t xml_size,
+                                                           size_t* required_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,6 +9,13 @@
 
 #include "QubeWireClient.h"
 #include "Certificates.h"
+#include "Tracer.h"
+#include "Logger.h"
+#include "EndpointSelector.h"
+#include "HedgePolicy.h"
+#include "TransferMeter.h"
+#include "CertificateChain.h"
+#include "MemoryBudget.h"
 
 #include <boost/network/include/http/client.hpp>
 #include <boost/network/protocol/http/response.hpp>
@@ -19,8 +26,17 @@
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/algorithm/string.hpp>
-
+#include <boost/range/begin.hpp>
+#include <boost/range/empty.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 using namespace QUBE_WIRE_NS;
 namespace http = boost::network::http;
@@ -29,6 +45,7 @@ namespace ptree = boost::property_tree;
 namespace filesystem = boost::filesystem;
 using boost::network::header;
 using boost::network::body;
+using boost::network::headers;
 using namespace boost::algorithm;
 using namespace std;
 
@@ -37,23 +54,301 @@ typedef http::basic_response<http::tags::http_server> http_response;
 const string QUBEWIRE_PRODUCT_ID = "07c0e191-c79c-48c2-8d93-43e2a67ef1d0";
 const string QUBEWIRE_URL = "https://api.qubewire.com";
 const string QUBEACCOUNT_URL = "https://account.qubecinema.com";
+const string QUBEWIRE_API_PATH = "/v1";
 
-struct QubeWireClient::Impl
+// Endpoints are probed this often when more than one is configured
+const chrono::seconds ENDPOINT_PROBE_INTERVAL(10);
+
+// A probe not answered within this is a failed one
+const unsigned PROBE_TIMEOUT_SECONDS = 3;
+
+// A stalled connection is closed by the HTTP client after this long
+const unsigned DEFAULT_REQUEST_TIMEOUT_SECONDS = 60;
+
+// Longest time a bounded call takes to notice that its token was cancelled
+const chrono::milliseconds CANCELLATION_CHECK_INTERVAL(10);
+
+// Request bodies of reported transfers are handed to the connection in chunks of this size
+const size_t UPLOAD_CHUNK_SIZE = 64 * 1024;
+
+// The parsed certificate chain is fetched again once a certificate expires within this time
+const chrono::hours CERTIFICATE_REFRESH_MARGIN(30 * 24);
+
+// Fetches of a chain due for refresh are this far apart, as Qube Wire may not have renewed it yet
+const chrono::hours CERTIFICATE_REFRESH_INTERVAL(1);
+
+// Lifetime of an access token when Qube Account doesn't give one
+const int64_t DEFAULT_ACCESS_TOKEN_LIFETIME_SECONDS = 3600;
+
+// Access tokens are refreshed this long before they expire, so that requests in flight and
+// long running processes, e.g. the wire agent or a queue node, never send an expired one
+const chrono::minutes ACCESS_TOKEN_REFRESH_MARGIN(5);
+
+namespace
 {
-    Impl(const string& clientId)
+    // Waiters exit once they have had no response to wait for this long
+    const chrono::seconds RESPONSE_WAITER_IDLE_TIMEOUT(30);
+
+    // cpp-netlib's responses are futures that can only be blocked on without a timeout or
+    // checked, so ResponseWaiter blocks on them on threads of its own and hands back futures
+    // that can be waited on with one. Waiters are reused; one is added only when all of them
+    // are blocked, e.g. on abandoned requests, and they hold nothing of the client, so a waiter
+    // still blocked on an abandoned request may outlive it.
+    class ResponseWaiter
+    {
+    public:
+        ResponseWaiter() : _state(make_shared<State>()) {}
+
+        // The returned future gets the time the status of the response arrived, or the request
+        // failed
+        shared_future<Deadline::Clock::time_point> Watch(const http::client::response& response)
+        {
+            Watched watched;
+            watched.response = response;
+            shared_future<Deadline::Clock::time_point> arrival = watched.arrival.get_future().share();
+
+            lock_guard<mutex> lock(_state->pendingMutex);
+            _state->pending.push_back(move(watched));
+            if (_state->pending.size() > _state->idleCount)
+            {
+                shared_ptr<State> state = _state;
+                thread([state]() { _Run(*state); }).detach();
+            }
+            _state->hasPending.notify_one();
+
+            return arrival;
+        }
+
+    private:
+        struct Watched
+        {
+            http::client::response response;
+            promise<Deadline::Clock::time_point> arrival;
+        };
+
+        struct State
+        {
+            State() : idleCount(0) {}
+
+            mutex pendingMutex;
+            condition_variable hasPending;
+            deque<Watched> pending;
+            size_t idleCount;
+        };
+
+        static void _Run(State& state)
+        {
+            unique_lock<mutex> lock(state.pendingMutex);
+            while (true)
+            {
+                ++state.idleCount;
+                bool hasPending = state.hasPending.wait_for(
+                    lock, RESPONSE_WAITER_IDLE_TIMEOUT, [&state]() { return !state.pending.empty(); });
+                --state.idleCount;
+                if (!hasPending)
+                {
+                    return;
+                }
+
+                Watched watched = move(state.pending.front());
+                state.pending.pop_front();
+                lock.unlock();
+
+                try
+                {
+                    static_cast<uint16_t>(status(watched.response));
+                }
+                catch (...)
+                {
+                    // rethrown to the caller when it reads the response
+                }
+                watched.arrival.set_value(Deadline::Clock::now());
+
+                lock.lock();
+            }
+        }
+
+        shared_ptr<State> _state;
+    };
+
+    // A request body lent to the connection by a caller that keeps it, so that it isn't copied
+    // whole. The connection copies it out a chunk at a time until the loan ends.
+    class BodyLoan
     {
-        _baseUrl = QUBEWIRE_URL + "/v1";
-        if (!_baseUrl.is_valid())
+    public:
+        BodyLoan(const string& body) : _body(&body) {}
+
+        // Copies up to maxSize bytes from the offset; false once the body is sent or the loan ended
+        bool CopyChunk(size_t offset, size_t maxSize, string& chunk)
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (!_body || offset >= _body->size())
+            {
+                return false;
+            }
+
+            chunk.assign(*_body, offset, min(maxSize, _body->size() - offset));
+            return true;
+        }
+
+        // Waits for a chunk being copied, so the caller may release the body once this returns
+        void End()
+        {
+            lock_guard<mutex> lock(_mutex);
+            _body = nullptr;
+        }
+
+    private:
+        mutex _mutex;
+        const string* _body;
+    };
+
+    // cpp-netlib can neither cancel a request nor time out a single one. A caller therefore
+    // waits for the first of several responses from its own thread, and gives up on them when
+    // its call is cancelled or expires. Giving up only abandons the requests: their I/O isn't
+    // aborted, and they finish, or are closed by the client's request timeout, in the background.
+    class ResponseRace
+    {
+    public:
+        ResponseRace(ResponseWaiter& waiter) : _waiter(waiter), _failedCount(0), _firstCompleted(NONE) {}
+
+        void Add(const http::client::response& response)
+        {
+            _responses.push_back(response);
+            _isFailed.push_back(false);
+        }
+
+        // Waits till a response completes or the given time passes, and throws once the call
+        // is cancelled or its deadline passes, abandoning the responses
+        bool WaitUntil(Deadline::Clock::time_point time, const CallOptions* options)
+        {
+            // A single response is waited on till its status arrives, and woken up from only to
+            // check for cancellation. Several can't be waited on at once, so they are polled;
+            // as is the rest of a response after its status, which is usually already there.
+            // Polls start frequent, so that quick responses aren't held up, and back off to the
+            // interval at which cancellation is noticed anyway.
+            chrono::milliseconds pollInterval(1);
+            bool isStatusArrived = false;
+            while (!_Poll())
+            {
+                if (options)
+                {
+                    options->cancellation.ThrowIfCancelled();
+                    if (options->deadline.IsExpired())
+                    {
+                        throw DeadlineExceededError("Qube Wire request exceeded its deadline");
+                    }
+                }
+
+                Deadline::Clock::time_point now = Deadline::Clock::now();
+                if (now >= time)
+                {
+                    return false;
+                }
+
+                Deadline::Clock::time_point wakeUp = min(time, now + CANCELLATION_CHECK_INTERVAL);
+                wakeUp = options ? options->deadline.Min(wakeUp) : wakeUp;
+                if (_responses.size() == 1 && !isStatusArrived)
+                {
+                    if (!_statusArrival.valid())
+                    {
+                        _statusArrival = _waiter.Watch(_responses.front());
+                    }
+
+                    // Once woken by the status, the response is checked again right away
+                    isStatusArrived = _statusArrival.wait_until(wakeUp) == future_status::ready;
+                    continue;
+                }
+
+                this_thread::sleep_until(min(wakeUp, now + pollInterval));
+                pollInterval = min(pollInterval * 2, CANCELLATION_CHECK_INTERVAL);
+            }
+
+            return true;
+        }
+
+        http::client::response GetFirst() const { return _responses.at(_firstCompleted); }
+
+        // Time the status of the first response arrived: as seen by the waiter of a single
+        // response, or else when the response was found complete
+        Deadline::Clock::time_point GetStatusTime() const
+        {
+            if (_responses.size() == 1 && _statusArrival.valid() &&
+                _statusArrival.wait_for(chrono::seconds(0)) == future_status::ready)
+            {
+                return _statusArrival.get();
+            }
+
+            return _completionTime;
+        }
+
+    private:
+        static const size_t NONE = static_cast<size_t>(-1);
+
+        // A failed response only wins once no other one can succeed
+        bool _Poll()
         {
-            throw runtime_error("Invalid Qube Wire URL!");
+            for (size_t i = 0; i < _responses.size() && _firstCompleted == NONE; ++i)
+            {
+                if (_isFailed[i] || !http::ready(_responses[i]))
+                {
+                    continue;
+                }
+
+                try
+                {
+                    // The response has arrived, so this doesn't block
+                    static_cast<uint16_t>(status(_responses[i]));
+                    _firstCompleted = i;
+                    _completionTime = Deadline::Clock::now();
+                }
+                catch (...)
+                {
+                    // rethrown to the caller when it reads the response
+                    _isFailed[i] = true;
+                    ++_failedCount;
+                }
+            }
+
+            if (_firstCompleted == NONE && !_responses.empty() && _failedCount == _responses.size())
+            {
+                _firstCompleted = 0;
+                _completionTime = Deadline::Clock::now();
+            }
+
+            return _firstCompleted != NONE;
         }
 
+        ResponseWaiter& _waiter;
+        vector<http::client::response> _responses;
+        vector<bool> _isFailed;
+        size_t _failedCount;
+        size_t _firstCompleted;
+        Deadline::Clock::time_point _completionTime;
+        shared_future<Deadline::Clock::time_point> _statusArrival;
+    };
+}
+
+struct QubeWireClient::Impl
+{
+    Impl(const string& clientId)
+    {
+        _probeClient = make_shared<http::client>(_GetClientOptions(PROBE_TIMEOUT_SECONDS));
+        SetEndpoints(vector<string>(1, QUBEWIRE_URL), vector<string>(1, QUBEACCOUNT_URL));
+
         _clientId = clientId;
         _refreshToken = "";
         _accessToken = "";
         _sessionId = "";
         _tokenType = "";
+        _authorizationHeader = "";
+        _accessTokenExpiry = Deadline::Clock::time_point::min();
         _certificate = "";
+        _requestTimeout = DEFAULT_REQUEST_TIMEOUT_SECONDS;
+        _callOptions = nullptr;
+        _heldHttpSpans = nullptr;
+        _lastRequestId = 0;
+        _progressInterval = chrono::milliseconds(250);
 
         _InitializeHttpClient();
     }
@@ -62,10 +357,55 @@ struct QubeWireClient::Impl
     {
     }
 
+    void SetTracer(const shared_ptr<Tracer>& tracer) { _tracer = tracer; }
+
+    void SetLogger(const shared_ptr<Logger>& logger) { _logger = logger; }
+
+    void SetRequestTimeout(unsigned seconds)
+    {
+        _requestTimeout = seconds;
+        _InitializeHttpClient();
+    }
+
+    void SetEndpoints(const vector<string>& qubeWireUrls, const vector<string>& qubeAccountUrls)
+    {
+        // Both lists are validated before either replaces the current one; an empty list stands
+        // for the production host
+        unique_ptr<EndpointSelector> qubeWireEndpoints = _CreateEndpointSelector(
+            qubeWireUrls.empty() ? vector<string>(1, QUBEWIRE_URL) : qubeWireUrls);
+        unique_ptr<EndpointSelector> qubeAccountEndpoints = _CreateEndpointSelector(
+            qubeAccountUrls.empty() ? vector<string>(1, QUBEACCOUNT_URL) : qubeAccountUrls);
+
+        _qubeWireEndpoints = move(qubeWireEndpoints);
+        _qubeAccountEndpoints = move(qubeAccountEndpoints);
+    }
+
+    void SetHedgeBudget(double fraction) { _hedging.SetBudget(fraction); }
+
+    void SetProgressCallback(const ProgressCallback& callback, unsigned intervalMilliseconds)
+    {
+        _progressCallback = callback;
+        _progressInterval = chrono::milliseconds(intervalMilliseconds);
+    }
+
+    void SetMemoryBudget(const shared_ptr<MemoryBudget>& budget) { _memoryBudget = budget; }
+
+    shared_ptr<MemoryBudget> GetMemoryBudget() const { return _memoryBudget; }
+
+    vector<EndpointStatus> GetEndpointStatus()
+    {
+        vector<EndpointStatus> endpoints = _qubeWireEndpoints->GetStatus();
+        vector<EndpointStatus> accountEndpoints = _qubeAccountEndpoints->GetStatus();
+        endpoints.insert(endpoints.end(), accountEndpoints.begin(), accountEndpoints.end());
+
+        return endpoints;
+    }
+
     string GetLoginUrl()
     {
-        uri::uri requestUri = QUBEACCOUNT_URL;
-        requestUri << uri::path("/dialog/polling/initialize");
+        TraceSpan span(_tracer.get(), "auth", "GetLoginUrl");
+
+        uri::uri requestUri = _QubeAccountUri("/dialog/polling/initialize");
 
         ptree::ptree jsonBody;
         ptree::ptree services;
@@ -85,23 +425,25 @@ struct QubeWireClient::Impl
             throw runtime_error(_GetErrorMessage(response));
         }
 
-        _sessionId = _ParseJsonProperty(body(response), "code");
-        _pollingEndpoint = _ParseJsonProperty(body(response), "polling_url");
+        ptree::ptree responseJson = _ParseJson(body(response));
+        _sessionId = _GetJsonProperty(responseJson, "code");
+        _pollingEndpoint = _GetJsonProperty(responseJson, "polling_url");
 
-        stringstream authenticationUrl;
-        authenticationUrl << _ParseJsonProperty(body(response), "authorization_url");
-
-        return authenticationUrl.str();
+        return _GetJsonProperty(responseJson, "authorization_url");
     }
 
-    bool IsAuthenticated()
+    bool IsAuthenticated(const CallOptions& options)
     {
-        stringstream requestBody;
-        requestBody << "code=" << _sessionId << "&client_id=" << _clientId
-                    << "&client_secret=null&grant_type=authorization_code&access_type=offline";
+        CallScope scope(*this, options);
+        TraceSpan span(_tracer.get(), "poll", "IsAuthenticated");
+
+        string requestBody;
+        requestBody.reserve(128 + _sessionId.size() + _clientId.size());
+        requestBody.append("code=").append(_sessionId).append("&client_id=").append(_clientId)
+            .append("&client_secret=null&grant_type=authorization_code&access_type=offline");
 
         http::client::response response =
-            _PostRequest(_pollingEndpoint, requestBody.str(), "application/x-www-form-urlencoded");
+            _PostRequest(_pollingEndpoint, requestBody, "application/x-www-form-urlencoded");
 
         if (status(response) != http_response::accepted && status(response) != http_response::ok)
         {
@@ -118,7 +460,7 @@ struct QubeWireClient::Impl
         {
             throw runtime_error("Unable to get refresh token");
         }
-        _accessToken = _GetAccessToken(_refreshToken);
+        _RefreshAccessToken();
 
         return true;
     }
@@ -128,10 +470,9 @@ struct QubeWireClient::Impl
     void ResetToken()
     {
         // We are getting a new token here to make sure token is not expired
-        _accessToken = _GetAccessToken(_refreshToken);
+        _RefreshAccessToken();
 
-        uri::uri requestUri = QUBEACCOUNT_URL;
-        requestUri << uri::path("/oauth/token?token=") << uri::path(_accessToken);
+        uri::uri requestUri = _QubeAccountUri("/oauth/token?token=" + _accessToken);
 
         http::client::response response = _DeleteRequest(requestUri);
 
@@ -141,7 +482,10 @@ struct QubeWireClient::Impl
         _refreshToken.clear();
         _accessToken.clear();
         _tokenType.clear();
+        _authorizationHeader.clear();
         _certificate.clear();
+        _certificateChain.reset();
+        _userInfo = UserInfo();
 
         if (status(response) != http_response::ok)
         {
@@ -149,39 +493,74 @@ struct QubeWireClient::Impl
         }
     }
 
-    void GetUserInfo(string& emailId, string& companyName)
+    void Prewarm()
     {
-        uri::uri requestUri = _baseUrl;
-        requestUri << uri::path("/users/me");
+        TraceSpan span(_tracer.get(), "api", "Prewarm");
+
+        // Requests are only started here; the HTTP client resolves (and caches) the host
+        // names and connects on its I/O thread while the caller continues.
+        _prewarmResponses.clear();
+        _prewarmResponses.push_back(
+            _client->head(http::client::request(uri::uri(_qubeWireEndpoints->GetEndpoint()))));
+        _prewarmResponses.push_back(
+            _client->head(http::client::request(uri::uri(_qubeAccountEndpoints->GetEndpoint()))));
+    }
 
-        http::client::response response = _GetResponse(requestUri);
+    void Bootstrap()
+    {
+        TraceSpan span(_tracer.get(), "api", "Bootstrap");
 
-        if (status(response) != http_response::ok)
+        _prewarmResponses.clear();
+
+        _RefreshAccessTokenIfDue();
+        uri::uri userUri = _QubeWireUri("/users/me");
+        uri::uri companyUri = _QubeWireUri("/users/me/companies/");
+
+        // Both requests are in flight before waiting for either of them
+        Deadline::Clock::time_point start = Deadline::Clock::now();
+        http::client::response userResponse = _SendGetRequest(userUri);
+        http::client::response companyResponse = _SendGetRequest(companyUri);
+
+        _userInfo = _ParseUserInfo(_WaitForResponse(userResponse, userUri.string(), "GET", start));
+        try
         {
-            throw runtime_error(_GetErrorMessage(response));
+            _certificate =
+                _ParseCertificateChain(_WaitForResponse(companyResponse, companyUri.string(), "GET",
+                                                        start));
+        }
+        catch (const exception&)
+        {
+            // Certificate may not be generated yet, GetCertificateChain reports it when asked
+        }
+    }
+
+    UserInfo GetUserInfo()
+    {
+        TraceSpan span(_tracer.get(), "api", "GetUserInfo");
+
+        if (_userInfo.emailId.empty())
+        {
+            uri::uri requestUri = _QubeWireUri("/users/me");
+
+            _RefreshAccessTokenIfDue();
+            _userInfo = _ParseUserInfo(_GetHedgedResponse(requestUri));
         }
 
-        emailId = _ParseJsonProperty(body(response), "email");
-        companyName = _ParseJsonProperty(body(response), "companyName");
+        return _userInfo;
     }
 
     string GetCertificateChain()
     {
-        // Here it returns a new access token which is valid for an hour
-        // Also we assume that the following tasks will happen within
-        // an hour
-        // 1) company certificate
-        // 2) CPL signing
-        // 3) KDM uploading
-        // 4) PKL signing
-        _accessToken = _GetAccessToken(_refreshToken);
+        if (_certificate != "")
+        {
+            return _certificate;
+        }
 
+        // Only a fetch needs the access token; a cached chain is served without it
+        _RefreshAccessTokenIfDue();
         try
         {
-            if (_certificate == "")
-            {
-                _certificate = _GetCertificateChain();
-            }
+            _certificate = _GetCertificateChain();
 
             return _certificate;
         }
@@ -192,60 +571,267 @@ struct QubeWireClient::Impl
         }
     }
 
-    string UploadKdm(const string& kdmXml)
+    shared_ptr<const CertificateChain> GetParsedCertificateChain()
     {
-        uri::uri requestUri = _baseUrl;
-        requestUri << uri::path("/dkdms");
+        if (_certificateChain && !_IsCertificateRefreshDue())
+        {
+            return _certificateChain;
+        }
 
-        http::client::response response = _PostRequest(requestUri, kdmXml, "application/xml");
-        if (status(response) != http_response::accepted)
+        // A chain due for refresh is fetched again instead of being taken from _certificate
+        string currentCertificate = _certificate;
+        if (_certificateChain)
         {
-            throw runtime_error(_GetErrorMessage(response));
+            _certificate.clear();
         }
+        _lastCertificateRefresh = Deadline::Clock::now();
 
-        return _ParseJsonProperty(body(response), "id");
+        try
+        {
+            string pem = GetCertificateChain();
+            if (!_certificateChain || _certificateChain->GetPem() != pem)
+            {
+                _certificateChain = make_shared<CertificateChain>(CertificateChain::FromPem(pem));
+            }
+        }
+        catch (const exception&)
+        {
+            if (!_certificateChain || chrono::system_clock::now() >= _certificateChain->GetNotAfter())
+            {
+                throw;
+            }
+            _certificate = currentCertificate;
+        }
+
+        return _certificateChain;
     }
 
-    string Sign(const string& assetXml)
+    string UploadKdm(const string& kdmXml, const CallOptions& options)
     {
-        uri::uri requestUri = _baseUrl;
-        requestUri << uri::path("/signer/jobs");
+        CallScope scope(*this, options);
+        return _SubmitBody("UploadKdm", "/dkdms", kdmXml);
+    }
 
-        http::client::response response = _PostRequest(requestUri, assetXml, "application/xml");
-        if (status(response) != http_response::accepted)
-        {
-            throw runtime_error(_GetErrorMessage(response));
-        }
+    string UploadKdm(BodyBuffer&& kdmXml, const CallOptions& options)
+    {
+        CallScope scope(*this, options);
+        return _SubmitBody("UploadKdm", "/dkdms", _ShareBody(move(kdmXml)));
+    }
 
-        return _ParseJsonProperty(body(response), "id");
+    string Sign(const string& assetXml, const CallOptions& options)
+    {
+        CallScope scope(*this, options);
+        return _SubmitBody("Sign", "/signer/jobs", assetXml);
+    }
+
+    string Sign(BodyBuffer&& assetXml, const CallOptions& options)
+    {
+        CallScope scope(*this, options);
+        return _SubmitBody("Sign", "/signer/jobs", _ShareBody(move(assetXml)));
     }
 
-    bool GetSignedAssetXml(const string& assetId, string& signedXmlAsset)
+    SignedAssetResult GetSignedAssetXml(const string& assetId, const CallOptions& options)
     {
-        stringstream requestUriString;
-        requestUriString << "/signer/jobs/";
-        requestUriString << assetId;
+        CallScope scope(*this, options);
+        TraceSpan span(_tracer.get(), "poll", "GetSignedAssetXml");
+        span.Tag("job", assetId);
+        JobTraceScope jobTrace(*this, assetId);
 
-        uri::uri requestUri = _baseUrl;
-        requestUri << uri::path(requestUriString.str());
+        uri::uri requestUri = _QubeWireUri("/signer/jobs/" + assetId);
+
+        shared_ptr<TransferMeter> meter = _CreateTransferMeter("GetSignedAssetXml", assetId, 0);
+        _RefreshAccessTokenIfDue();
+        http::client::response response =
+            _GetHedgedResponse(requestUri, "application/xml", meter.get());
+        if (_ExpireRejectedAccessToken(response))
+        {
+            // A poll can be repeated, so it is retried once with a new token
+            _RefreshAccessToken();
+            response = _GetHedgedResponse(requestUri, "application/xml", meter.get());
+        }
 
-        http::client::response response = _GetResponse(requestUri, "application/xml");
+        SignedAssetResult result;
+        result.isSigned = false;
         if (status(response) == http_response::ok)
         {
-            signedXmlAsset = body(response);
-            return true;
+            result.isSigned = true;
+            result.xml = body(response);
+            if (meter)
+            {
+                meter->Complete(result.xml.size());
+            }
+            _LogJob("signed", assetId);
+            return result;
         }
         else if (status(response) == http_response::accepted)
         {
-            signedXmlAsset = "";
-            return false;
+            if (meter)
+            {
+                meter->Complete(_GetContentLength(response));
+            }
+            return result;
         }
 
         throw runtime_error(_GetErrorMessage(response));
     }
 
+    string WaitForSignedAssetXml(const string& assetId, const CallOptions& options,
+                                 unsigned pollInterval)
+    {
+        while (true)
+        {
+            SignedAssetResult result = GetSignedAssetXml(assetId, options);
+            if (result.isSigned)
+            {
+                return move(result.xml);
+            }
+
+            Deadline::Clock::time_point nextPoll =
+                Deadline::Clock::now() + chrono::milliseconds(pollInterval);
+            if (options.cancellation.WaitUntil(options.deadline.Min(nextPoll)))
+            {
+                throw OperationCancelledError();
+            }
+            if (options.deadline.IsExpired())
+            {
+                throw DeadlineExceededError("Signing job " + assetId + " exceeded its deadline");
+            }
+        }
+    }
+
 private:
-    void _InitializeHttpClient()
+    struct HeldSpan
+    {
+        const char* name;
+        int64_t startTime;
+        int64_t duration;
+        Tracer::Tags tags;
+    };
+
+    // Makes the bounds of a public call visible to the requests it makes
+    struct CallScope
+    {
+        CallScope(Impl& impl, const CallOptions& options) : _impl(impl), _previous(impl._callOptions)
+        {
+            options.cancellation.ThrowIfCancelled();
+            if (options.deadline.IsExpired())
+            {
+                throw DeadlineExceededError("Qube Wire call exceeded its deadline");
+            }
+            _impl._callOptions = &options;
+        }
+
+        ~CallScope() { _impl._callOptions = _previous; }
+
+        Impl& _impl;
+        const CallOptions* _previous;
+    };
+
+    // Tags the HTTP spans of a call with its job. A submission's job only gets its id with the
+    // response, so with an empty job id the spans are held till SetJobId, or the end of the call.
+    struct JobTraceScope
+    {
+        JobTraceScope(Impl& impl, const string& jobId)
+            : _impl(impl), _previousJobId(impl._traceJobId), _previousHeldSpans(impl._heldHttpSpans)
+        {
+            _impl._traceJobId = jobId;
+            _impl._heldHttpSpans = jobId.empty() && _impl._tracer ? &_heldSpans : nullptr;
+        }
+
+        ~JobTraceScope()
+        {
+            _RecordHeldSpans();
+            _impl._traceJobId = _previousJobId;
+            _impl._heldHttpSpans = _previousHeldSpans;
+        }
+
+        void SetJobId(const string& jobId)
+        {
+            _impl._traceJobId = jobId;
+            _RecordHeldSpans();
+        }
+
+        void _RecordHeldSpans()
+        {
+            _impl._heldHttpSpans = nullptr;
+            for (HeldSpan& span : _heldSpans)
+            {
+                _impl._AddHttpSpan(span.name, span.startTime, span.duration, move(span.tags));
+            }
+            _heldSpans.clear();
+        }
+
+        Impl& _impl;
+        string _previousJobId;
+        vector<HeldSpan>* _previousHeldSpans;
+        vector<HeldSpan> _heldSpans;
+    };
+
+    // Span of an HTTP request, tagged with its URL and the job of the call
+    struct HttpSpan
+    {
+        HttpSpan(Impl& impl, const char* name, const uri::uri& requestUri)
+            : _impl(impl), _name(name), _startTime(0), _isEnded(false)
+        {
+            if (_impl._tracer)
+            {
+                _startTime = _impl._tracer->Now();
+                _tags.push_back(make_pair(string("url"), requestUri.string()));
+            }
+        }
+
+        ~HttpSpan() { End(); }
+
+        void Tag(const char* key, const string& value)
+        {
+            if (_impl._tracer)
+            {
+                _tags.push_back(make_pair(string(key), value));
+            }
+        }
+
+        void End()
+        {
+            if (_impl._tracer && !_isEnded)
+            {
+                _impl._AddHttpSpan(_name, _startTime, _impl._tracer->Now() - _startTime, move(_tags));
+            }
+            _isEnded = true;
+        }
+
+        Impl& _impl;
+        const char* _name;
+        int64_t _startTime;
+        bool _isEnded;
+        Tracer::Tags _tags;
+    };
+
+    void _AddHttpSpan(const char* name, int64_t startTime, int64_t duration, Tracer::Tags tags)
+    {
+        if (_heldHttpSpans)
+        {
+            HeldSpan span = {name, startTime, duration, move(tags)};
+            _heldHttpSpans->push_back(move(span));
+            return;
+        }
+
+        if (!_traceJobId.empty())
+        {
+            tags.push_back(make_pair(string("job"), _traceJobId));
+        }
+        _tracer->AddSpan("http", name, startTime, duration, tags);
+    }
+
+    // Converts a time of the request clock to one of the trace clock
+    int64_t _GetTraceTime(Deadline::Clock::time_point time) const
+    {
+        return _tracer->Now() -
+               chrono::duration_cast<chrono::microseconds>(Deadline::Clock::now() - time).count();
+    }
+
+    void _InitializeHttpClient() { _client.reset(new http::client(_GetClientOptions(_requestTimeout))); }
+
+    static http::client::options _GetClientOptions(unsigned timeout)
     {
         http::client::options options;
 
@@ -254,24 +840,212 @@ private:
         caCerts << QUBEACCOUNT_ROOT_CA_PEM;
         options.openssl_certificates_buffer(caCerts.str());
         options.always_verify_peer(true);
-        _client.reset(new http::client(options));
+        options.cache_resolved(true);
+        options.timeout(static_cast<int>(timeout));
+
+        return options;
     }
 
-    string _GetAuthorizationHeader()
+    // Probes run on the selector's thread, so they use a client of their own with a short
+    // timeout. Any response short of a server error means the host is up.
+    unique_ptr<EndpointSelector> _CreateEndpointSelector(const vector<string>& urls)
     {
-        stringstream authHeader;
-        authHeader << _tokenType << " " << _accessToken;
+        for (const string& url : urls)
+        {
+            if (!uri::uri(url).is_valid())
+            {
+                throw runtime_error("Invalid endpoint URL " + url);
+            }
+        }
 
-        return authHeader.str();
+        shared_ptr<http::client> probeClient = _probeClient;
+        unique_ptr<EndpointSelector> endpoints(new EndpointSelector(urls, [probeClient](const string& url) {
+            http::client::response response = probeClient->head(http::client::request(uri::uri(url)));
+            if (static_cast<uint16_t>(status(response)) >= 500)
+            {
+                throw runtime_error("Endpoint " + url + " is unhealthy");
+            }
+        }));
+        if (urls.size() > 1)
+        {
+            endpoints->Start(ENDPOINT_PROBE_INTERVAL);
+        }
+
+        return endpoints;
+    }
+
+    uri::uri _QubeWireUri(const string& path) const
+    {
+        uri::uri requestUri = _qubeWireEndpoints->GetEndpoint() + QUBEWIRE_API_PATH;
+        requestUri << uri::path(path);
+
+        return requestUri;
+    }
+
+    uri::uri _QubeAccountUri(const string& path) const
+    {
+        uri::uri requestUri = _qubeAccountEndpoints->GetEndpoint();
+        requestUri << uri::path(path);
+
+        return requestUri;
+    }
+
+    bool _IsCertificateRefreshDue() const
+    {
+        return chrono::system_clock::now() + CERTIFICATE_REFRESH_MARGIN >= _certificateChain->GetNotAfter() &&
+               Deadline::Clock::now() - _lastCertificateRefresh >= CERTIFICATE_REFRESH_INTERVAL;
+    }
+
+    // Posts a document for Qube Wire to sign or keep, and returns the id of its job. A shared body
+    // is handed over to the connection, so that it is released once sent.
+    template <typename Body>
+    string _SubmitBody(const char* operation, const string& path, Body&& requestBody)
+    {
+        TraceSpan span(_tracer.get(), "submit", operation);
+        JobTraceScope jobTrace(*this, "");
+
+        uri::uri requestUri = _QubeWireUri(path);
+
+        shared_ptr<TransferMeter> meter = _CreateTransferMeter(operation, "", _GetSize(requestBody));
+        _RefreshAccessTokenIfDue();
+        http::client::response response =
+            _PostRequest(requestUri, forward<Body>(requestBody), "application/xml", meter);
+
+        // The body may already be released, so the caller submits again with a new token
+        _ExpireRejectedAccessToken(response);
+        if (status(response) != http_response::accepted)
+        {
+            throw runtime_error(_GetErrorMessage(response));
+        }
+
+        string responseBody = body(response);
+        string jobId = _GetJsonProperty(_ParseJson(responseBody), "id");
+        span.Tag("job", jobId);
+        jobTrace.SetJobId(jobId);
+        if (meter)
+        {
+            meter->Complete(responseBody.size(), jobId);
+        }
+        _LogJob("submitted", jobId);
+
+        return jobId;
+    }
+
+    static size_t _GetSize(const string& requestBody) { return requestBody.size(); }
+
+    static size_t _GetSize(const shared_ptr<const BodyBuffer>& requestBody)
+    {
+        return requestBody->GetSize();
+    }
+
+    // The connection reads the body from its I/O thread, possibly after an abandoned call
+    // returned, so it shares ownership of it
+    static shared_ptr<const BodyBuffer> _ShareBody(BodyBuffer&& requestBody)
+    {
+        return make_shared<BodyBuffer>(move(requestBody));
+    }
+
+    // Reports a job's transfer when a progress callback is set; returns null otherwise
+    shared_ptr<TransferMeter> _CreateTransferMeter(const string& operation, const string& jobId,
+                                                   uint64_t bytesToSend) const
+    {
+        if (!_progressCallback)
+        {
+            return nullptr;
+        }
+
+        return make_shared<TransferMeter>(_progressCallback, _progressInterval, operation, jobId,
+                                          bytesToSend);
+    }
+
+    http::client::response _GetResponse(const uri::uri& requestUri, const string& contentType = "",
+                                        TransferMeter* meter = nullptr)
+    {
+        HttpSpan span(*this, "GET", requestUri);
+
+        Deadline::Clock::time_point start = Deadline::Clock::now();
+        return _WaitForResponse(_SendGetRequest(requestUri, contentType), requestUri.string(), "GET",
+                                start, meter);
+    }
+
+    // Sends an idempotent GET a second time, on a connection of its own, when the first attempt
+    // is slower than most recent requests, and takes whichever response arrives first
+    http::client::response _GetHedgedResponse(const uri::uri& requestUri,
+                                               const string& contentType = "",
+                                               TransferMeter* meter = nullptr)
+    {
+        if (!_hedging.IsEnabled())
+        {
+            return _GetResponse(requestUri, contentType, meter);
+        }
+
+        HttpSpan span(*this, "GET", requestUri);
+
+        Deadline::Clock::time_point start = Deadline::Clock::now();
+        chrono::microseconds hedgeDelay = _hedging.GetDelay();
+        ResponseRace race(_responseWaiter);
+        try
+        {
+            race.Add(_SendGetRequest(requestUri, contentType));
+            _hedging.RecordRequest();
+
+            bool isAnswered = hedgeDelay != chrono::microseconds::max() &&
+                              race.WaitUntil(start + hedgeDelay, _callOptions);
+            if (!isAnswered && hedgeDelay != chrono::microseconds::max() && _hedging.TryHedge())
+            {
+                span.Tag("hedged", "true");
+                if (_logger && _logger->IsEnabled(LogLevel::Debug))
+                {
+                    // The fields only point at their values, so the URL is held till logged
+                    string requestUrl = requestUri.string();
+                    LogFields fields;
+                    fields.requestId = _lastRequestId + 1;
+                    fields.method = "GET";
+                    fields.endpoint = requestUrl.c_str();
+                    fields.duration =
+                        chrono::duration_cast<chrono::microseconds>(Deadline::Clock::now() - start);
+                    _logger->Log(LogLevel::Debug, "hedge", fields);
+                }
+                race.Add(_SendGetRequest(requestUri, contentType));
+            }
+
+            // A race completes with the whole response, so only its phase is reported meanwhile
+            chrono::milliseconds wait = meter ? _progressInterval : chrono::hours(1);
+            while (!race.WaitUntil(Deadline::Clock::now() + wait, _callOptions))
+            {
+                if (meter)
+                {
+                    meter->Update();
+                }
+            }
+        }
+        catch (const DeadlineExceededError& error)
+        {
+            _LogRequest(LogLevel::Warning, "GET", requestUri.string(), start, 0, error.what());
+            throw;
+        }
+        catch (const OperationCancelledError& error)
+        {
+            _LogRequest(LogLevel::Warning, "GET", requestUri.string(), start, 0, error.what());
+            throw;
+        }
+
+        // The delay is learnt from first attempts only: the time the first attempt took, or when
+        // its hedge answered first, the time it had been running by then, the least it takes
+        _hedging.RecordLatency(
+            chrono::duration_cast<chrono::microseconds>(Deadline::Clock::now() - start));
+
+        return _WaitForResponse(race.GetFirst(), requestUri.string(), "GET", start, meter);
     }
 
-    http::client::response _GetResponse(const uri::uri& requestUri, const string& contentType = "")
+    // Starts a GET request without waiting for its response
+    http::client::response _SendGetRequest(const uri::uri& requestUri, const string& contentType = "")
     {
         http::client::request request(requestUri);
 
-        if (!_accessToken.empty())
+        if (!_authorizationHeader.empty())
         {
-            request << header("Authorization", _GetAuthorizationHeader());
+            request << header("Authorization", _authorizationHeader);
         }
 
         if (!contentType.empty())
@@ -283,51 +1057,340 @@ private:
     }
 
     http::client::response _PostRequest(const uri::uri& requestUri, const string& requestBody,
-                                        const string& contentType)
+                                        const string& contentType,
+                                        const shared_ptr<TransferMeter>& meter = nullptr)
+    {
+        http::client::request request = _CreatePostRequest(requestUri, contentType);
+
+        HttpSpan span(*this, "POST", requestUri);
+
+        Deadline::Clock::time_point start = Deadline::Clock::now();
+        if (!meter)
+        {
+            return _WaitForResponse(_client->post(request, requestBody), requestUri.string(), "POST",
+                                    start);
+        }
+
+        // The body is handed to the connection chunk by chunk from its I/O thread, counting
+        // what was sent. It is lent by the caller rather than copied, so the loan ends when
+        // this returns; a connection still sending then, e.g. of an abandoned call, gets no more.
+        request << header("Content-Length", to_string(requestBody.size()));
+        shared_ptr<BodyLoan> loan = make_shared<BodyLoan>(requestBody);
+        shared_ptr<size_t> sentSize = make_shared<size_t>(0);
+        http::client::response response = _client->post(
+            request, string(), contentType, http::client::body_callback_function_type(),
+            [loan, sentSize, meter](string& chunk) -> bool {
+                if (!loan->CopyChunk(*sentSize, UPLOAD_CHUNK_SIZE, chunk))
+                {
+                    return false;
+                }
+
+                *sentSize += chunk.size();
+                meter->AddBytesSent(chunk.size());
+                return true;
+            });
+
+        try
+        {
+            response = _WaitForResponse(response, requestUri.string(), "POST", start, meter.get());
+        }
+        catch (...)
+        {
+            loan->End();
+            throw;
+        }
+        loan->End();
+
+        return response;
+    }
+
+    // Sends a body held in slabs one slab per chunk, without copying it whole. Only the
+    // connection keeps the body, so it goes back to its budget once the last slab is sent, even
+    // if the response is still awaited.
+    http::client::response _PostRequest(const uri::uri& requestUri,
+                                        shared_ptr<const BodyBuffer> requestBody,
+                                        const string& contentType,
+                                        const shared_ptr<TransferMeter>& meter = nullptr)
+    {
+        http::client::request request = _CreatePostRequest(requestUri, contentType);
+        request << header("Content-Length", to_string(requestBody->GetSize()));
+
+        HttpSpan span(*this, "POST", requestUri);
+
+        Deadline::Clock::time_point start = Deadline::Clock::now();
+        shared_ptr<const BodyBuffer> pendingBody = move(requestBody);
+        shared_ptr<size_t> sentSlabs = make_shared<size_t>(0);
+        http::client::response response = _client->post(
+            request, string(), contentType, http::client::body_callback_function_type(),
+            [pendingBody, sentSlabs, meter](string& chunk) mutable -> bool {
+                if (!pendingBody || *sentSlabs >= pendingBody->GetSlabCount())
+                {
+                    pendingBody.reset();
+                    return false;
+                }
+
+                size_t slabSize = 0;
+                const char* slab = pendingBody->GetSlab((*sentSlabs)++, slabSize);
+                chunk.assign(slab, slabSize);
+                if (meter)
+                {
+                    meter->AddBytesSent(slabSize);
+                }
+                return true;
+            });
+        pendingBody.reset();
+
+        return _WaitForResponse(response, requestUri.string(), "POST", start, meter.get());
+    }
+
+    http::client::request _CreatePostRequest(const uri::uri& requestUri, const string& contentType)
     {
         http::client::request request(requestUri);
 
-        if (!_accessToken.empty())
+        if (!_authorizationHeader.empty())
         {
-            request << header("Authorization", _GetAuthorizationHeader());
+            request << header("Authorization", _authorizationHeader);
         }
         if (!contentType.empty())
         {
             request << header("Content-Type", contentType);
         }
 
-        return _client->post(request, requestBody);
+        return request;
     }
 
     http::client::response _DeleteRequest(const uri::uri& requestUri)
     {
         http::client::request request(requestUri);
 
-        return _client->delete_(request);
+        HttpSpan span(*this, "DELETE", requestUri);
+
+        Deadline::Clock::time_point start = Deadline::Clock::now();
+        return _WaitForResponse(_client->delete_(request), requestUri.string(), "DELETE", start);
     }
 
-    string _GetAccessToken(const string& refreshToken)
+    // cpp-netlib resolves, connects and performs the TLS handshake on its own I/O thread and
+    // only hands back futures, so those phases are traced together as time to first byte: from
+    // sending the request at start to the arrival of the response's status.
+    // Failed connections, the client's own request timeout and server errors count against the
+    // health of the request's endpoint; a caller's deadline passing or its call being cancelled
+    // says nothing about the endpoint, so doesn't.
+    http::client::response _WaitForResponse(http::client::response response, const string& requestUrl,
+                                            const char* method, Deadline::Clock::time_point start,
+                                            TransferMeter* meter = nullptr)
     {
-        uri::uri requestUri = QUBEACCOUNT_URL;
-        requestUri << uri::path("/oauth/token");
+        uint16_t responseStatus = 0;
+        try
+        {
+            // A response waited for here tells when its status arrived, for the trace
+            Deadline::Clock::time_point statusTime = Deadline::Clock::time_point::min();
+            if (meter)
+            {
+                statusTime = _WaitForTransfer(response, *meter);
+            }
+            else if (_callOptions &&
+                     (!_callOptions->deadline.IsNever() || _callOptions->cancellation.IsCancellable()))
+            {
+                ResponseRace race(_responseWaiter);
+                race.Add(response);
+                while (!race.WaitUntil(Deadline::Clock::now() + chrono::hours(1), _callOptions))
+                {
+                }
+                statusTime = race.GetStatusTime();
+            }
 
-        stringstream requestBody;
-        requestBody << "client_id=" <<  _clientId << "&client_secret=null&grant_type=refresh_token"
-                    << "&refresh_token=" << refreshToken << "&product_id=" << QUBEWIRE_PRODUCT_ID;
+            if (_tracer)
+            {
+                if (statusTime == Deadline::Clock::time_point::min())
+                {
+                    static_cast<uint16_t>(status(response));
+                    statusTime = Deadline::Clock::now();
+                }
+                static_cast<string>(body(response));
+                Deadline::Clock::time_point bodyTime = Deadline::Clock::now();
+
+                _AddHttpSpan("connect + time to first byte", _GetTraceTime(start),
+                             chrono::duration_cast<chrono::microseconds>(statusTime - start).count(),
+                             Tracer::Tags());
+                _AddHttpSpan("body", _GetTraceTime(statusTime),
+                             chrono::duration_cast<chrono::microseconds>(bodyTime - statusTime).count(),
+                             Tracer::Tags());
+            }
+
+            responseStatus = status(response);
+            if (responseStatus >= 500)
+            {
+                _ReportFailure(requestUrl);
+            }
+            else
+            {
+                _qubeWireEndpoints->ReportSuccess(requestUrl);
+                _qubeAccountEndpoints->ReportSuccess(requestUrl);
+            }
+        }
+        catch (const OperationCancelledError& error)
+        {
+            _LogRequest(LogLevel::Warning, method, requestUrl, start, 0, error.what());
+            throw;
+        }
+        catch (const DeadlineExceededError& error)
+        {
+            _LogRequest(LogLevel::Warning, method, requestUrl, start, 0, error.what());
+            throw;
+        }
+        catch (const exception& error)
+        {
+            _ReportFailure(requestUrl);
+            _LogRequest(LogLevel::Error, method, requestUrl, start, 0, error.what());
+            throw;
+        }
+        catch (...)
+        {
+            _ReportFailure(requestUrl);
+            _LogRequest(LogLevel::Error, method, requestUrl, start, 0, "unknown error");
+            throw;
+        }
+
+        _LogRequest(responseStatus >= 500 ? LogLevel::Warning : LogLevel::Info, method, requestUrl,
+                    start, responseStatus, nullptr);
+
+        return response;
+    }
+
+    // Every request gets an id, logged or not, so that records of a job can refer to the
+    // request that submitted it
+    void _LogRequest(LogLevel level, const char* method, const string& requestUrl,
+                     Deadline::Clock::time_point start, uint16_t responseStatus, const char* message)
+    {
+        ++_lastRequestId;
+        if (!_logger || !_logger->IsEnabled(level))
+        {
+            return;
+        }
+
+        LogFields fields;
+        fields.requestId = _lastRequestId;
+        fields.method = method;
+        fields.endpoint = requestUrl.c_str();
+        fields.status = responseStatus;
+        fields.duration = chrono::duration_cast<chrono::microseconds>(Deadline::Clock::now() - start);
+        fields.message = message;
+        _logger->Log(level, "request", fields);
+    }
+
+    void _LogJob(const char* event, const string& jobId)
+    {
+        if (!_logger || !_logger->IsEnabled(LogLevel::Info))
+        {
+            return;
+        }
+
+        LogFields fields;
+        fields.requestId = _lastRequestId;
+        fields.jobId = jobId.c_str();
+        _logger->Log(LogLevel::Info, event, fields);
+    }
+
+    // cpp-netlib only tells whether a response has arrived, so the caller's thread waits for it,
+    // reporting progress meanwhile, and reports its download on arrival. Returns the time the
+    // status of the response arrived.
+    Deadline::Clock::time_point _WaitForTransfer(const http::client::response& response,
+                                                 TransferMeter& meter)
+    {
+        ResponseRace race(_responseWaiter);
+        race.Add(response);
+        while (!race.WaitUntil(Deadline::Clock::now() + _progressInterval, _callOptions))
+        {
+            meter.Update();
+        }
+
+        try
+        {
+            meter.StartDownload(_GetContentLength(response));
+        }
+        catch (...)
+        {
+            // rethrown to the caller when it reads the response
+        }
+
+        return race.GetStatusTime();
+    }
+
+    static uint64_t _GetContentLength(const http::client::response& response)
+    {
+        auto contentLength = headers(response)["Content-Length"];
+        if (boost::empty(contentLength))
+        {
+            return 0;
+        }
+
+        return strtoull(boost::begin(contentLength)->second.c_str(), nullptr, 10);
+    }
+
+    void _ReportFailure(const string& requestUrl)
+    {
+        _qubeWireEndpoints->ReportFailure(requestUrl);
+        _qubeAccountEndpoints->ReportFailure(requestUrl);
+    }
+
+    // Gets a new access token for the refresh token and rebuilds the Authorization header
+    // once, so that requests made with this token don't format it again.
+    void _RefreshAccessToken()
+    {
+        TraceSpan span(_tracer.get(), "auth", "token refresh");
+
+        Deadline::Clock::time_point start = Deadline::Clock::now();
+        uri::uri requestUri = _QubeAccountUri("/oauth/token");
+
+        string requestBody;
+        requestBody.reserve(160 + _clientId.size() + _refreshToken.size());
+        requestBody.append("client_id=").append(_clientId)
+            .append("&client_secret=null&grant_type=refresh_token&refresh_token=")
+            .append(_refreshToken).append("&product_id=").append(QUBEWIRE_PRODUCT_ID);
 
         // Access token should be set to empty before calling following _PostRequest,
         // since we are getting new access token
-        _accessToken = "";
+        _accessToken.clear();
+        _authorizationHeader.clear();
+        _accessTokenExpiry = Deadline::Clock::time_point::min();
         http::client::response response =
-            _PostRequest(requestUri, requestBody.str(), "application/x-www-form-urlencoded");
+            _PostRequest(requestUri, requestBody, "application/x-www-form-urlencoded");
 
         if (status(response) != http_response::ok)
         {
             throw runtime_error(_GetErrorMessage(response));
         }
-        _tokenType = _ParseJsonProperty(body(response), "token_type");
 
-        return _ParseJsonProperty(body(response), "access_token");
+        ptree::ptree responseJson = _ParseJson(body(response));
+        _tokenType = _GetJsonProperty(responseJson, "token_type");
+        _accessToken = _GetJsonProperty(responseJson, "access_token");
+        _accessTokenExpiry =
+            start + chrono::seconds(responseJson.get<int64_t>("expires_in",
+                                                               DEFAULT_ACCESS_TOKEN_LIFETIME_SECONDS));
+
+        _authorizationHeader.reserve(_tokenType.size() + 1 + _accessToken.size());
+        _authorizationHeader.append(_tokenType).append(" ").append(_accessToken);
+    }
+
+    void _RefreshAccessTokenIfDue()
+    {
+        if (!_refreshToken.empty() &&
+            Deadline::Clock::now() + ACCESS_TOKEN_REFRESH_MARGIN >= _accessTokenExpiry)
+        {
+            _RefreshAccessToken();
+        }
+    }
+
+    // A token revoked or expired early is refreshed before the next request
+    bool _ExpireRejectedAccessToken(const http::client::response& response)
+    {
+        if (status(response) != http_response::unauthorized || _refreshToken.empty())
+        {
+            return false;
+        }
+
+        _accessTokenExpiry = Deadline::Clock::time_point::min();
+        return true;
     }
 
     string _ParseAuthorizeInfo(const string& json, const string& propertyName)
@@ -373,7 +1436,7 @@ private:
     {
         try
         {
-            return _ParseJsonProperty(static_cast<string>(body(response)), propertyName);
+            return _GetJsonProperty(_ParseJson(body(response)), propertyName);
         }
         catch (const exception&)
         {
@@ -381,7 +1444,7 @@ private:
         }
     }
 
-    static string _ParseJsonProperty(const string& json, const string& propertyName)
+    static ptree::ptree _ParseJson(const string& json)
     {
         stringstream jsonStream(json);
         ptree::ptree pt;
@@ -393,6 +1456,11 @@ private:
             throw runtime_error("Response body is empty");
         }
 
+        return pt;
+    }
+
+    static string _GetJsonProperty(const ptree::ptree& pt, const string& propertyName)
+    {
         try
         {
             return pt.get<string>(propertyName);
@@ -410,37 +1478,81 @@ private:
 
     string _GetCertificateChain()
     {
-        uri::uri requestUri = _baseUrl;
-        requestUri << uri::path("/users/me/companies/");
+        TraceSpan span(_tracer.get(), "api", "GetCertificateChain");
 
-        http::client::response response = _GetResponse(requestUri);
+        uri::uri requestUri = _QubeWireUri("/users/me/companies/");
 
+        return _ParseCertificateChain(_GetHedgedResponse(requestUri));
+    }
+
+    static UserInfo _ParseUserInfo(http::client::response response)
+    {
         if (status(response) != http_response::ok)
         {
             throw runtime_error(_GetErrorMessage(response));
         }
 
+        ptree::ptree responseJson = _ParseJson(body(response));
+
+        UserInfo userInfo;
+        userInfo.emailId = _GetJsonProperty(responseJson, "email");
+        userInfo.companyName = _GetJsonProperty(responseJson, "companyName");
 
-        string isCertGenerated = to_lower_copy(_ParseJsonProperty(body(response), "certificateGenerated"));
+        return userInfo;
+    }
+
+    static string _ParseCertificateChain(http::client::response response)
+    {
+        if (status(response) != http_response::ok)
+        {
+            throw runtime_error(_GetErrorMessage(response));
+        }
+
+        ptree::ptree responseJson = _ParseJson(body(response));
+        string isCertGenerated = to_lower_copy(_GetJsonProperty(responseJson, "certificateGenerated"));
         if (isCertGenerated != "true")
         {
             throw runtime_error("User doesn't have any certificates. Certificates need to be added");
         }
 
-        return _ParseJsonProperty(body(response), "certificate");
+        return _GetJsonProperty(responseJson, "certificate");
     }
 
 private:
     unique_ptr<http::client> _client;
+    shared_ptr<Tracer> _tracer;
+    string _traceJobId;
+    vector<HeldSpan>* _heldHttpSpans;
+    shared_ptr<Logger> _logger;
+    uint64_t _lastRequestId;
+    vector<http::client::response> _prewarmResponses;
     uri::uri _pollingEndpoint;
-    uri::uri _baseUrl;
+
+    shared_ptr<http::client> _probeClient;
+    unique_ptr<EndpointSelector> _qubeWireEndpoints;
+    unique_ptr<EndpointSelector> _qubeAccountEndpoints;
+    HedgePolicy _hedging;
+    ResponseWaiter _responseWaiter;
 
     string _clientId;
     string _sessionId;
     string _accessToken;
     string _refreshToken;
     string _tokenType;
+    string _authorizationHeader;
+    Deadline::Clock::time_point _accessTokenExpiry;
     string _certificate;
+    shared_ptr<const CertificateChain> _certificateChain;
+    Deadline::Clock::time_point _lastCertificateRefresh;
+    UserInfo _userInfo;
+
+    unsigned _requestTimeout;
+    const CallOptions* _callOptions;
+
+    ProgressCallback _progressCallback;
+    chrono::milliseconds _progressInterval;
+
+    shared_ptr<MemoryBudget> _memoryBudget;
 };
 
 QubeWireClient::QubeWireClient(const string& clientId)
@@ -452,14 +1564,61 @@ QubeWireClient::~QubeWireClient()
 {
 }
 
+void QubeWireClient::SetTracer(const shared_ptr<Tracer>& tracer)
+{
+    _impl->SetTracer(tracer);
+}
+
+void QubeWireClient::SetLogger(const shared_ptr<Logger>& logger)
+{
+    _impl->SetLogger(logger);
+}
+
 string QubeWireClient::GetLoginUrl()
 {
     return _impl->GetLoginUrl();
 }
 
-bool QubeWireClient::IsAuthenticated()
+void QubeWireClient::SetRequestTimeout(unsigned seconds)
+{
+    _impl->SetRequestTimeout(seconds);
+}
+
+void QubeWireClient::SetEndpoints(const vector<string>& qubeWireUrls,
+                                  const vector<string>& qubeAccountUrls)
+{
+    _impl->SetEndpoints(qubeWireUrls, qubeAccountUrls);
+}
+
+void QubeWireClient::SetHedgeBudget(double fraction)
 {
-    return _impl->IsAuthenticated();
+    _impl->SetHedgeBudget(fraction);
+}
+
+void QubeWireClient::SetProgressCallback(const ProgressCallback& callback,
+                                         unsigned intervalMilliseconds)
+{
+    _impl->SetProgressCallback(callback, intervalMilliseconds);
+}
+
+void QubeWireClient::SetMemoryBudget(const shared_ptr<MemoryBudget>& budget)
+{
+    _impl->SetMemoryBudget(budget);
+}
+
+shared_ptr<MemoryBudget> QubeWireClient::GetMemoryBudget() const
+{
+    return _impl->GetMemoryBudget();
+}
+
+vector<EndpointStatus> QubeWireClient::GetEndpointStatus()
+{
+    return _impl->GetEndpointStatus();
+}
+
+bool QubeWireClient::IsAuthenticated(const CallOptions& options)
+{
+    return _impl->IsAuthenticated(options);
 }
 
 std::string QubeWireClient::GetToken()
@@ -472,9 +1631,19 @@ void QubeWireClient::ResetToken()
     _impl->ResetToken();
 }
 
-void QubeWireClient::GetUserInfo(string& emailId, string& companyName)
+void QubeWireClient::Prewarm()
+{
+    _impl->Prewarm();
+}
+
+void QubeWireClient::Bootstrap()
+{
+    _impl->Bootstrap();
+}
+
+UserInfo QubeWireClient::GetUserInfo()
 {
-    _impl->GetUserInfo(emailId, companyName);
+    return _impl->GetUserInfo();
 }
 
 string QubeWireClient::GetCertificateChain()
@@ -482,17 +1651,39 @@ string QubeWireClient::GetCertificateChain()
     return _impl->GetCertificateChain();
 }
 
-string QubeWireClient::UploadKdm(const string& kdmXml)
+shared_ptr<const CertificateChain> QubeWireClient::GetParsedCertificateChain()
+{
+    return _impl->GetParsedCertificateChain();
+}
+
+string QubeWireClient::UploadKdm(const string& kdmXml, const CallOptions& options)
+{
+    return _impl->UploadKdm(kdmXml, options);
+}
+
+string QubeWireClient::UploadKdm(BodyBuffer kdmXml, const CallOptions& options)
+{
+    return _impl->UploadKdm(move(kdmXml), options);
+}
+
+string QubeWireClient::Sign(const string& assetXml, const CallOptions& options)
+{
+    return _impl->Sign(assetXml, options);
+}
+
+string QubeWireClient::Sign(BodyBuffer assetXml, const CallOptions& options)
 {
-    return _impl->UploadKdm(kdmXml);
+    return _impl->Sign(move(assetXml), options);
 }
 
-string QubeWireClient::Sign(const string& assetXml)
+SignedAssetResult QubeWireClient::GetSignedAssetXml(const string& assetId,
+                                                    const CallOptions& options)
 {
-    return _impl->Sign(assetXml);
+    return _impl->GetSignedAssetXml(assetId, options);
 }
 
-bool QubeWireClient::GetSignedAssetXml(const string& assetId, string& signedXmlAsset)
+string QubeWireClient::WaitForSignedAssetXml(const string& assetId, const CallOptions& options,
+                                             unsigned pollInterval)
 {
-    return _impl->GetSignedAssetXml(assetId, signedXmlAsset);
+    return _impl->WaitForSignedAssetXml(assetId, options, pollInterval);
 }
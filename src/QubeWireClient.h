@@ -10,6 +10,8 @@
 #pragma once
 
 #include "NamespaceMacros.h"
+#include "Cancellation.h"
+#include "TransferMeter.h"
 
 #include <vector>
 #include <string>
@@ -18,6 +20,31 @@
 
 QUBE_WIRE_NS_START
 
+class Tracer;
+class Logger;
+class MemoryBudget;
+class BodyBuffer;
+class CertificateChain;
+struct EndpointStatus;
+
+/**
+ * Information of the logged in user.
+ */
+struct UserInfo
+{
+    std::string emailId;     ///< user's email id
+    std::string companyName; ///< Company name of the user certificate
+};
+
+/**
+ * Signing status of an asset, along with the signed asset if available.
+ */
+struct SignedAssetResult
+{
+    bool isSigned;   ///< true if the asset XML is signed and can be retrieved
+    std::string xml; ///< Signed CPL or PKL in string format, empty till signed
+};
+
 /**
  * QubeWireClient exposes API(Application Programming Interfaces) to communicate with Qube Wire.
  */
@@ -36,6 +63,85 @@ public:
      */
     ~QubeWireClient();
 
+    /**
+     * Record spans of all subsequent operations, including each HTTP call, into a tracer.
+     *
+     * @param[in] tracer Tracer to record into, or null to stop tracing
+     */
+    void SetTracer(const std::shared_ptr<Tracer>& tracer);
+
+    /**
+     * Log every subsequent HTTP request, with its endpoint, status and duration, along with
+     * submitted and signed jobs, hedged requests and failures.
+     *
+     * @param[in] logger Logger to log into, or null to stop logging
+     */
+    void SetLogger(const std::shared_ptr<Logger>& logger);
+
+    /**
+     * Set how long a single HTTP request may stall before the connection is closed.
+     * This bounds requests abandoned by a cancelled or expired call as well.
+     *
+     * @param[in] seconds Request timeout in seconds, 60 by default
+     */
+    void SetRequestTimeout(unsigned seconds);
+
+    /**
+     * Set the Qube Wire and Qube Account endpoints, e.g. regional hosts or a staging stack.
+     * Each list holds equivalent hosts in order of preference. When a list has more than one
+     * host, all of them are probed in the background and requests go to the fastest healthy
+     * one, moving to another within seconds when it fails. Call this before
+     * QubeWireClient::GetLoginUrl.
+     *
+     * @param[in] qubeWireUrls Base URLs of Qube Wire, e.g. https://eu.api.qubewire.com; empty for
+     *                         https://api.qubewire.com
+     * @param[in] qubeAccountUrls Base URLs of Qube Account; empty for https://account.qubecinema.com
+     */
+    void SetEndpoints(const std::vector<std::string>& qubeWireUrls,
+                      const std::vector<std::string>& qubeAccountUrls);
+
+    /**
+     * Enable hedging of idempotent GETs: user information, certificate chain and signing
+     * status. When a GET hasn't been answered within the 95th percentile latency of recent
+     * GETs, it is sent again on another connection and whichever response comes first is used.
+     * Hedging is disabled by default.
+     *
+     * @param[in] fraction Share of GETs that may be hedged, e.g. 0.05; 0 disables hedging
+     */
+    void SetHedgeBudget(double fraction);
+
+    /**
+     * Report the progress of Sign, UploadKdm and GetSignedAssetXml calls: bytes sent and
+     * received, throughput, and whether the request is being uploaded, processed by Qube Wire
+     * or downloaded. Reports are made on the calling thread at every change of phase and
+     * otherwise at most once per interval; counting sent bytes on the connection's thread is
+     * the only cost while a report isn't due. A response is only available once complete, so
+     * downloads are reported as they start and end.
+     *
+     * @param[in] callback Callback receiving the reports, or empty to stop reporting
+     * @param[in] intervalMilliseconds Least time between reports of a phase
+     */
+    void SetProgressCallback(const ProgressCallback& callback, unsigned intervalMilliseconds = 250);
+
+    /**
+     * Set the memory budget shared with other clients and work queues, which callers draw the
+     * BodyBuffer bodies of Sign and UploadKdm from. Only those bodies are bounded: they are
+     * uploaded slab by slab and released once sent. Bodies passed as strings are sent from the
+     * caller's string and not counted, nor are response bodies, which the HTTP client holds.
+     *
+     * @param[in] budget Budget for callers to draw from, or null for none
+     */
+    void SetMemoryBudget(const std::shared_ptr<MemoryBudget>& budget);
+
+    std::shared_ptr<MemoryBudget> GetMemoryBudget() const;
+
+    /**
+     * Get health and probed round trip time of all configured endpoints.
+     *
+     * @returns status of the Qube Wire endpoints followed by the Qube Account ones
+     */
+    std::vector<EndpointStatus> GetEndpointStatus();
+
     /**
      * Get Qube Wire login URL for this specific client application
      * This method also starts the Qube Wire OAuth authentication process by starting a login session
@@ -51,9 +157,11 @@ public:
      * User should first call QubeWireClient::GetLoginUrl to initiate Qube Wire authentication and
      * poll this method till true to complete authentication
      *
+     * @param[in] options Deadline and cancellation token of the call
+     *
      * @returns true if user has logged in and token is available
      */
-    bool IsAuthenticated();
+    bool IsAuthenticated(const CallOptions& options = CallOptions());
 
     /**
      * @brief Get refresh token for current OAuth session
@@ -69,12 +177,26 @@ public:
     void ResetToken();
 
     /**
-     * Get user's email id.
+     * Start connecting to the Qube Wire and Qube Account hosts in the background, so that
+     * host names are resolved and cached before the first real request.
+     * Call this right after QubeWireClient::GetLoginUrl, while the user is logging in.
+     */
+    void Prewarm();
+
+    /**
+     * Fetch user information and the certificate chain of the active company concurrently
+     * and cache them, so that QubeWireClient::GetUserInfo and
+     * QubeWireClient::GetCertificateChain don't make requests of their own.
+     * Call this once QubeWireClient::IsAuthenticated returns true.
+     */
+    void Bootstrap();
+
+    /**
+     * Get user's email id and company name.
      *
-     * @param[out] emailId user's email id
-     * @param[out] companyName Company name of the user certificate
+     * @returns user information
      */
-    void GetUserInfo(std::string& emailId, std::string& companyName);
+    UserInfo GetUserInfo();
 
     /**
      * Get certificate chain of active company set by user.
@@ -85,14 +207,36 @@ public:
      */
     std::string GetCertificateChain();
 
+    /**
+     * Get the certificate chain of the active company, parsed, see CertificateChain.
+     * The chain is parsed once and kept; it is fetched again from Qube Wire once any of its
+     * certificates is within 30 days of expiry, at most once an hour, and the kept chain is
+     * used while that fails and it hasn't expired.
+     *
+     * @returns parsed certificate chain
+     */
+    std::shared_ptr<const CertificateChain> GetParsedCertificateChain();
+
     /**
      * Uploads unsigned KDM for providing Key information to Qube Wire
      *
      * @param[in] kdmXml KDM to be uploaded and signed
+     * @param[in] options Deadline and cancellation token of the call
      *
      * @returns unique identifier of the KDM
      */
-    std::string UploadKdm(const std::string& kdmXml);
+    std::string UploadKdm(const std::string& kdmXml, const CallOptions& options = CallOptions());
+
+    /**
+     * Uploads unsigned KDM held in a buffer of a memory budget, sending it without copying.
+     * The buffer is released once the KDM is sent.
+     *
+     * @param[in] kdmXml KDM to be uploaded and signed
+     * @param[in] options Deadline and cancellation token of the call
+     *
+     * @returns unique identifier of the KDM
+     */
+    std::string UploadKdm(BodyBuffer kdmXml, const CallOptions& options = CallOptions());
 
     /**
      * Posts an asset XML to be signed by Qube Wire
@@ -100,20 +244,48 @@ public:
      * Use QubeWireClient::IsAssetXmlSigned to know status of the signing process
      *
      * @param[in] assetXml to be signed
+     * @param[in] options Deadline and cancellation token of the call
+     *
+     * @returns unique identifier of the asset
+     */
+    std::string Sign(const std::string& assetXml, const CallOptions& options = CallOptions());
+
+    /**
+     * Posts an asset XML held in a buffer of a memory budget to be signed, sending it without
+     * copying. The buffer is released once the asset is sent.
+     *
+     * @param[in] assetXml to be signed
+     * @param[in] options Deadline and cancellation token of the call
      *
      * @returns unique identifier of the asset
      */
-    std::string Sign(const std::string& assetXml);
+    std::string Sign(BodyBuffer assetXml, const CallOptions& options = CallOptions());
 
     /**
      * Get status of signing of asset, and obtain the signed asset if available
      *
      * @param[in] assetId CPL or PKL UUID
-     * @param[out] signedXmlAsset Signed CPL or PKL in string format
+     * @param[in] options Deadline and cancellation token of the call
+     *
+     * @returns signing status, holding the signed CPL or PKL once signed
+     */
+    SignedAssetResult GetSignedAssetXml(const std::string& assetId,
+                                        const CallOptions& options = CallOptions());
+
+    /**
+     * Poll the signing status of an asset till it is signed.
+     * Throws DeadlineExceededError if the job is not signed by the deadline and
+     * OperationCancelledError as soon as the token is cancelled, even mid request.
+     *
+     * @param[in] assetId CPL or PKL UUID
+     * @param[in] options Deadline and cancellation token of the whole job
+     * @param[in] pollInterval Milliseconds between polls
      *
-     * @returns true if the asset XML is signed and can be retrieved, else false
+     * @returns signed CPL or PKL
      */
-    bool GetSignedAssetXml(const std::string& assetId, std::string& signedXmlAsset);
+    std::string WaitForSignedAssetXml(const std::string& assetId,
+                                      const CallOptions& options = CallOptions(),
+                                      unsigned pollInterval = 2000);
 
 private:
     struct Impl;
@@ -0,0 +1,814 @@
+/**
+ * @file SharedWorkQueue.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of SharedWorkQueue class
+ */
+
+#include "SharedWorkQueue.h"
+#include "QubeWireClient.h"
+#include "MemoryBudget.h"
+#include "SignatureVerifier.h"
+#include "CertificateChain.h"
+#include "SignedAssetArchive.h"
+#include "FileHelpers.h"
+
+#include <boost/asio/ip/host_name.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace fs = boost::filesystem;
+typedef chrono::steady_clock Clock;
+
+// Requests to Qube Wire are made on the queue's only thread, so a stalled one is given up on after this
+const chrono::seconds REQUEST_DEADLINE(30);
+
+// Polls of a job failing in a row before the document is moved to failed
+const uint16_t MAX_POLL_RETRIES = 3;
+
+// Submissions of a document failing in a row before it is moved to failed
+const uint16_t MAX_SUBMIT_RETRIES = 3;
+
+// Longest sleep between checks of a stop request
+const chrono::milliseconds STOP_CHECK_INTERVAL(100);
+
+// Separates the document name from the node id in claim names
+const char CLAIM_SEPARATOR = '~';
+
+namespace
+{
+    // Reads into the slabs of a buffer already holding room for the file
+    void ReadFile(const fs::path& path, BodyBuffer& content)
+    {
+        ifstream fileStream(path.string().c_str(), ios::binary | ios::ate);
+        if (!fileStream.is_open())
+        {
+            throw runtime_error("Opening file " + path.string() + " for reading failed");
+        }
+
+        // Claimed documents are regular files, whose size can be told
+        streamoff size = fileStream.tellg();
+        if (size < 0)
+        {
+            throw runtime_error("Reading file " + path.string() + " failed");
+        }
+        fileStream.seekg(0);
+        content.Append(fileStream, static_cast<size_t>(size));
+    }
+
+    // Closing the file flushes it to the server, so it is complete once renamed into view
+    void WriteFile(const fs::path& path, const string& content)
+    {
+        ofstream fileStream(path.string().c_str(), ios::binary | ios::trunc);
+        if (!fileStream.is_open() || !fileStream.write(content.data(), content.size()))
+        {
+            throw runtime_error("Writing file " + path.string() + " failed");
+        }
+
+        fileStream.close();
+        if (!fileStream)
+        {
+            throw runtime_error("Writing file " + path.string() + " failed");
+        }
+    }
+
+    // Moves a file like a rename, but never replaces an existing target. Of several nodes moving
+    // the same file, only the one removing it wins, and the others take back their links. Returns
+    // false when the target exists or the file is gone, and throws on any other error, so that
+    // a filesystem failing moves isn't taken for a lost race.
+    bool MoveWithoutReplacing(const fs::path& from, const fs::path& to)
+    {
+        boost::system::error_code error;
+        fs::create_hard_link(from, to, error);
+        if (error == boost::system::errc::file_exists ||
+            error == boost::system::errc::no_such_file_or_directory)
+        {
+            return false;
+        }
+        if (error)
+        {
+            throw runtime_error("Moving " + from.string() + " to " + to.string() + " failed: " +
+                                error.message());
+        }
+
+        bool isRemoved = fs::remove(from, error);
+        if (!isRemoved || error)
+        {
+            boost::system::error_code ignored;
+            fs::remove(to, ignored);
+            if (error)
+            {
+                throw runtime_error("Moving " + from.string() + " to " + to.string() + " failed: " +
+                                    error.message());
+            }
+            return false;
+        }
+
+        return true;
+    }
+
+    // Moves out of claimed are made by hard link, which some shares (e.g. SMB mounts) don't support
+    void CheckHardLinks(const fs::path& from, const fs::path& to)
+    {
+        WriteFile(from, string());
+        boost::system::error_code error;
+        fs::create_hard_link(from, to, error);
+
+        boost::system::error_code ignored;
+        fs::remove(to, ignored);
+        fs::remove(from, ignored);
+        if (error)
+        {
+            throw runtime_error("Work queue directory doesn't support hard links: " + error.message());
+        }
+    }
+
+    vector<string> ListFiles(const fs::path& directory)
+    {
+        vector<string> names;
+        boost::system::error_code error;
+        for (fs::directory_iterator entry(directory, error), end; !error && entry != end;
+             entry.increment(error))
+        {
+            string name = entry->path().filename().string();
+            if (!name.empty() && name[0] != '.' && fs::is_regular_file(entry->status()))
+            {
+                names.push_back(name);
+            }
+        }
+
+        sort(names.begin(), names.end());
+        return names;
+    }
+
+    string GetSignedName(const string& name)
+    {
+        return fs::path(name).stem().string() + ".signed.xml";
+    }
+}
+
+struct SharedWorkQueue::Impl
+{
+    Impl(QubeWireClient& client, const string& queueDirectory, const string& nodeId)
+        : _client(client), _nodeId(nodeId), _maxInFlight(8), _pollInterval(2000), _leaseDuration(60),
+          _jobTimeout(3600), _isSignatureVerified(false), _isStopping(false)
+    {
+        if (nodeId.empty() || nodeId.find_first_of(string("/\\") + CLAIM_SEPARATOR) != string::npos)
+        {
+            throw runtime_error("Invalid work queue node id " + nodeId);
+        }
+
+        fs::path root(queueDirectory);
+        _incoming = root / "incoming";
+        _claimed = root / "claimed";
+        _signed = root / "signed";
+        _done = root / "done";
+        _failed = root / "failed";
+        for (const fs::path& directory : {_incoming, _claimed, _signed, _done, _failed})
+        {
+            boost::system::error_code error;
+            fs::create_directories(directory, error);
+            if (!fs::is_directory(directory))
+            {
+                throw runtime_error("Creating work queue directory " + directory.string() + " failed");
+            }
+        }
+
+        // Hidden names, which are never picked up as documents
+        CheckHardLinks(_claimed / ("." + _nodeId + ".link"), _incoming / ("." + _nodeId + ".link"));
+    }
+
+    void SetMaxInFlight(unsigned count) { _maxInFlight = max(count, 1u); }
+
+    void SetPollInterval(unsigned milliseconds) { _pollInterval = chrono::milliseconds(milliseconds); }
+
+    void SetLeaseDuration(unsigned seconds) { _leaseDuration = chrono::seconds(seconds); }
+
+    void SetJobTimeout(unsigned seconds) { _jobTimeout = chrono::seconds(seconds); }
+
+    void SetSignatureVerification(bool isEnabled) { _isSignatureVerified = isEnabled; }
+
+    void SetSignedAssetArchive(const shared_ptr<SignedAssetArchive>& archive) { _archive = archive; }
+
+    void Run()
+    {
+        _isStopping = false;
+        _Recover();
+
+        thread heartbeat([this]() { _Heartbeat(); });
+        try
+        {
+            Clock::time_point nextScan = Clock::now();
+            while (!_isStopping)
+            {
+                if (Clock::now() >= nextScan)
+                {
+                    _ReclaimExpiredLeases();
+                    _ClaimDocuments();
+                    nextScan = Clock::now() + _pollInterval;
+                }
+
+                _PollDocuments();
+
+                Clock::time_point wakeUp = nextScan;
+                for (const Document& document : _documents)
+                {
+                    wakeUp = min(wakeUp, document.nextPoll);
+                }
+                _SleepUntil(wakeUp);
+            }
+        }
+        catch (...)
+        {
+            _isStopping = true;
+            heartbeat.join();
+            _ReleaseAll();
+            throw;
+        }
+
+        heartbeat.join();
+        _ReleaseAll();
+    }
+
+    void Stop()
+    {
+        // Only an atomic store here, so this can be called from a signal handler
+        _isStopping = true;
+    }
+
+private:
+    struct Document
+    {
+        string name;
+        fs::path claim;
+        string jobId;
+        Deadline deadline;
+        Clock::time_point nextPoll;
+        uint16_t failedPolls;
+    };
+
+    // Last seen modification time of another node's claim, and when it was first seen so
+    struct LeaseObservation
+    {
+        time_t modificationTime;
+        Clock::time_point observedAt;
+    };
+
+    string _GetClaimName(const string& name) const { return name + CLAIM_SEPARATOR + _nodeId; }
+
+    bool _IsOwnClaim(const string& claimName) const
+    {
+        string suffix = CLAIM_SEPARATOR + _nodeId;
+        return claimName.size() > suffix.size() &&
+               claimName.compare(claimName.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    fs::path _GetPublishingPath(const string& name) const
+    {
+        return _signed / ("." + _GetClaimName(name) + ".tmp");
+    }
+
+    // Claims left by a previous run of this node are released, and signed documents it had
+    // committed to but not published yet are published
+    void _Recover()
+    {
+        for (const string& claimName : ListFiles(_claimed))
+        {
+            if (_IsOwnClaim(claimName))
+            {
+                string name = claimName.substr(0, claimName.size() - _nodeId.size() - 1);
+                MoveWithoutReplacing(_claimed / claimName, _incoming / name);
+            }
+        }
+
+        boost::system::error_code error;
+        string suffix = CLAIM_SEPARATOR + _nodeId + ".tmp";
+        for (fs::directory_iterator entry(_signed, error), end; !error && entry != end;
+             entry.increment(error))
+        {
+            string fileName = entry->path().filename().string();
+            if (fileName.size() <= suffix.size() + 1 || fileName[0] != '.' ||
+                fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) != 0)
+            {
+                continue;
+            }
+
+            string name = fileName.substr(1, fileName.size() - suffix.size() - 1);
+            boost::system::error_code ignored;
+            if (fs::exists(_done / name, ignored))
+            {
+                MoveWithoutReplacing(entry->path(), _signed / GetSignedName(name));
+            }
+            else
+            {
+                fs::remove(entry->path(), ignored);
+            }
+        }
+    }
+
+    void _Heartbeat()
+    {
+        chrono::milliseconds interval = chrono::duration_cast<chrono::milliseconds>(_leaseDuration) / 4;
+        while (!_isStopping)
+        {
+            _SleepUntil(Clock::now() + interval);
+
+            set<fs::path> leases;
+            {
+                lock_guard<mutex> lock(_leaseMutex);
+                leases = _heldLeases;
+            }
+
+            for (const fs::path& lease : leases)
+            {
+                boost::system::error_code error;
+                fs::last_write_time(lease, time(nullptr), error);
+                if (error && !fs::exists(lease, error))
+                {
+                    // Another node reclaimed the document after missed heartbeats
+                    lock_guard<mutex> lock(_leaseMutex);
+                    _lostLeases.insert(lease);
+                }
+            }
+        }
+    }
+
+    void _ReclaimExpiredLeases()
+    {
+        map<string, LeaseObservation> observations;
+        Clock::time_point now = Clock::now();
+        for (const string& claimName : ListFiles(_claimed))
+        {
+            boost::system::error_code error;
+            if (_IsOwnClaim(claimName))
+            {
+                // A document reclaimed by this node that couldn't be returned to incoming yet
+                if (!_IsHeld(_claimed / claimName))
+                {
+                    string name = claimName.substr(0, claimName.size() - _nodeId.size() - 1);
+                    MoveWithoutReplacing(_claimed / claimName, _incoming / name);
+                }
+                continue;
+            }
+
+            time_t modificationTime = fs::last_write_time(_claimed / claimName, error);
+            if (error)
+            {
+                continue;
+            }
+
+            map<string, LeaseObservation>::const_iterator observed = _observedLeases.find(claimName);
+            if (observed == _observedLeases.end() ||
+                observed->second.modificationTime != modificationTime)
+            {
+                observations[claimName] = LeaseObservation{modificationTime, now};
+            }
+            else if (now - observed->second.observedAt < _leaseDuration)
+            {
+                observations[claimName] = observed->second;
+            }
+            else
+            {
+                // Racing the owner's publish, which also moves the claim, so the claim is first
+                // renamed to this node's own claim name: the owner either moved it before, or
+                // finds it gone and doesn't publish. Only this node moves it on from there.
+                string name = claimName.substr(0, claimName.rfind(CLAIM_SEPARATOR));
+                fs::path reclaim = _claimed / _GetClaimName(name);
+                if (fs::exists(reclaim, error))
+                {
+                    continue;
+                }
+
+                fs::rename(_claimed / claimName, reclaim, error);
+                if (error && error != boost::system::errc::no_such_file_or_directory)
+                {
+                    throw runtime_error("Reclaiming " + claimName + " failed: " + error.message());
+                }
+                if (!error)
+                {
+                    MoveWithoutReplacing(reclaim, _incoming / name);
+                }
+            }
+        }
+
+        _observedLeases.swap(observations);
+    }
+
+    void _ClaimDocuments()
+    {
+        if (_documents.size() >= _maxInFlight)
+        {
+            return;
+        }
+
+        shared_ptr<MemoryBudget> budget = _client.GetMemoryBudget();
+        for (const string& name : ListFiles(_incoming))
+        {
+            if (_isStopping || _documents.size() >= _maxInFlight)
+            {
+                break;
+            }
+
+            // A document is left in incoming while its name is still held by this node or by a
+            // result of an earlier document of that name, which is never overwritten
+            if (_IsNameTaken(name))
+            {
+                continue;
+            }
+
+            // A document the memory budget has no room for is left for a later scan, once the
+            // documents being uploaded are sent, or for another node
+            BodyBuffer body;
+            if (budget)
+            {
+                boost::system::error_code error;
+                uintmax_t size = fs::file_size(_incoming / name, error);
+                if (error)
+                {
+                    continue;
+                }
+                if (!budget->TryAllocate(static_cast<size_t>(size), body))
+                {
+                    break;
+                }
+            }
+
+            Document document;
+            document.name = name;
+            document.claim = _claimed / _GetClaimName(name);
+            document.failedPolls = 0;
+
+            // Fails if another node claimed it first; the claim's name is this node's own, so
+            // the rename replaces nothing
+            boost::system::error_code error;
+            fs::rename(_incoming / name, document.claim, error);
+            if (error)
+            {
+                continue;
+            }
+
+            {
+                lock_guard<mutex> lock(_leaseMutex);
+                _heldLeases.insert(document.claim);
+            }
+
+            try
+            {
+                CallOptions options;
+                options.deadline = Deadline::After(REQUEST_DEADLINE);
+                if (budget)
+                {
+                    ReadFile(document.claim, body);
+                    document.jobId = _client.Sign(move(body), options);
+                }
+                else
+                {
+                    document.jobId = _client.Sign(GetFileContents(document.claim.string()), options);
+                }
+                document.deadline = Deadline::After(_jobTimeout);
+                document.nextPoll = Clock::now() + _pollInterval;
+                _documents.push_back(document);
+                _failedSubmissions.erase(name);
+            }
+            catch (const exception& e)
+            {
+                // Released for a later scan of this node or another one, as the error may be
+                // passing, like a failed poll
+                if (++_failedSubmissions[name] > MAX_SUBMIT_RETRIES)
+                {
+                    _failedSubmissions.erase(name);
+                    _Fail(document, e.what());
+                }
+                else
+                {
+                    _Release(document);
+                }
+            }
+        }
+    }
+
+    void _PollDocuments()
+    {
+        for (size_t i = 0; i < _documents.size() && !_isStopping;)
+        {
+            Document& document = _documents[i];
+            if (_IsLeaseLost(document))
+            {
+                _Forget(document);
+                _documents.erase(_documents.begin() + i);
+                continue;
+            }
+
+            if (Clock::now() < document.nextPoll)
+            {
+                ++i;
+                continue;
+            }
+
+            if (document.deadline.IsExpired())
+            {
+                _Fail(document, "Signing job " + document.jobId + " exceeded its deadline");
+                _documents.erase(_documents.begin() + i);
+                continue;
+            }
+
+            try
+            {
+                CallOptions options;
+                options.deadline = Deadline::After(REQUEST_DEADLINE);
+                SignedAssetResult result = _client.GetSignedAssetXml(document.jobId, options);
+                if (result.isSigned)
+                {
+                    SignatureVerification verification = {true, string()};
+                    if (_isSignatureVerified)
+                    {
+                        verification = _GetVerifier().Verify(result.xml);
+                    }
+
+                    if (verification.isValid)
+                    {
+                        _Publish(document, result.xml);
+                    }
+                    else
+                    {
+                        _Fail(document, "Signature is invalid: " + verification.error);
+                    }
+                    _documents.erase(_documents.begin() + i);
+                    continue;
+                }
+                document.failedPolls = 0;
+            }
+            catch (const exception& e)
+            {
+                if (++document.failedPolls > MAX_POLL_RETRIES)
+                {
+                    _Fail(document, e.what());
+                    _documents.erase(_documents.begin() + i);
+                    continue;
+                }
+            }
+
+            document.nextPoll = Clock::now() + _pollInterval;
+            ++i;
+        }
+    }
+
+    // Moving the claim to done commits the document to this node; the signed document is
+    // written beforehand and renamed into view afterwards, so it is never seen partially
+    void _Publish(Document& document, const string& signedXml)
+    {
+        fs::path publishingPath = _GetPublishingPath(document.name);
+        boost::system::error_code error;
+        try
+        {
+            WriteFile(publishingPath, signedXml);
+        }
+        catch (const exception& e)
+        {
+            fs::remove(publishingPath, error);
+            _Fail(document, e.what());
+            return;
+        }
+
+        if (!MoveWithoutReplacing(document.claim, _done / document.name))
+        {
+            fs::remove(publishingPath, error);
+            if (fs::exists(document.claim, error))
+            {
+                // A document of the same name was published meanwhile
+                _Fail(document, "Signed document " + document.name + " is already in done");
+                return;
+            }
+
+            // Reclaimed by another node, which will publish it instead
+        }
+        else
+        {
+            // Kept hidden if a signed document of the same name is still published, till it's
+            // removed and this node recovers
+            MoveWithoutReplacing(publishingPath, _signed / GetSignedName(document.name));
+            _Archive(document, signedXml);
+        }
+
+        _Forget(document);
+    }
+
+    // The published document stays the record of the job, so archiving is best effort
+    void _Archive(const Document& document, const string& signedXml)
+    {
+        if (!_archive)
+        {
+            return;
+        }
+
+        try
+        {
+            _archive->Add(SignedAssetArchive::GetAssetId(signedXml), document.jobId, signedXml);
+        }
+        catch (const exception&)
+        {
+            // intentionally ignored
+        }
+    }
+
+    // The chain's key is read again only when the client renews the chain
+    const SignatureVerifier& _GetVerifier()
+    {
+        shared_ptr<const CertificateChain> chain = _client.GetParsedCertificateChain();
+        if (chain != _verifiedChain)
+        {
+            _verifier.reset(new SignatureVerifier(*chain));
+            _verifiedChain = chain;
+        }
+
+        return *_verifier;
+    }
+
+    // A document failed before under the same name is left claimed, and once reclaimed it
+    // waits in incoming till the earlier one is removed from failed
+    void _Fail(Document& document, const string& message)
+    {
+        if (MoveWithoutReplacing(document.claim, _failed / document.name))
+        {
+            try
+            {
+                WriteFile(_failed / (document.name + ".error"), message);
+            }
+            catch (const exception&)
+            {
+                // The failed document is kept even if its error can't be recorded
+            }
+        }
+
+        _Forget(document);
+    }
+
+    // Returning claims lets other nodes take over documents still being signed right away. Claims
+    // that can't be returned are left to expire, so that the others are still returned.
+    void _ReleaseAll()
+    {
+        for (Document& document : _documents)
+        {
+            if (!_IsLeaseLost(document))
+            {
+                try
+                {
+                    _Release(document);
+                }
+                catch (const exception&)
+                {
+                    _Forget(document);
+                }
+            }
+            else
+            {
+                _Forget(document);
+            }
+        }
+        _documents.clear();
+    }
+
+    void _Release(Document& document)
+    {
+        MoveWithoutReplacing(document.claim, _incoming / document.name);
+        _Forget(document);
+    }
+
+    bool _IsNameTaken(const string& name) const
+    {
+        boost::system::error_code error;
+        return fs::exists(_claimed / _GetClaimName(name), error) || fs::exists(_done / name, error) ||
+               fs::exists(_failed / name, error) || fs::exists(_signed / GetSignedName(name), error);
+    }
+
+    bool _IsHeld(const fs::path& claim)
+    {
+        lock_guard<mutex> lock(_leaseMutex);
+        return _heldLeases.count(claim) != 0;
+    }
+
+    bool _IsLeaseLost(const Document& document)
+    {
+        lock_guard<mutex> lock(_leaseMutex);
+        return _lostLeases.count(document.claim) != 0;
+    }
+
+    void _Forget(const Document& document)
+    {
+        lock_guard<mutex> lock(_leaseMutex);
+        _heldLeases.erase(document.claim);
+        _lostLeases.erase(document.claim);
+    }
+
+    void _SleepUntil(Clock::time_point time)
+    {
+        Clock::time_point now = Clock::now();
+        while (!_isStopping && now < time)
+        {
+            this_thread::sleep_for(min<Clock::duration>(time - now, STOP_CHECK_INTERVAL));
+            now = Clock::now();
+        }
+    }
+
+    QubeWireClient& _client;
+    string _nodeId;
+    fs::path _incoming;
+    fs::path _claimed;
+    fs::path _signed;
+    fs::path _done;
+    fs::path _failed;
+
+    size_t _maxInFlight;
+    chrono::milliseconds _pollInterval;
+    chrono::seconds _leaseDuration;
+    chrono::seconds _jobTimeout;
+    bool _isSignatureVerified;
+    atomic<bool> _isStopping;
+
+    unique_ptr<SignatureVerifier> _verifier;
+    shared_ptr<const CertificateChain> _verifiedChain;
+    shared_ptr<SignedAssetArchive> _archive;
+
+    vector<Document> _documents;
+    map<string, LeaseObservation> _observedLeases;
+
+    // Failed submissions in a row of documents released back to incoming, by name
+    map<string, uint16_t> _failedSubmissions;
+
+    // Claims touched by the heartbeat thread, and those found taken over by other nodes
+    mutex _leaseMutex;
+    set<fs::path> _heldLeases;
+    set<fs::path> _lostLeases;
+};
+
+SharedWorkQueue::SharedWorkQueue(QubeWireClient& client, const string& queueDirectory, const string& nodeId)
+    : _impl(new Impl(client, queueDirectory, nodeId))
+{
+}
+
+SharedWorkQueue::~SharedWorkQueue()
+{
+}
+
+void SharedWorkQueue::SetMaxInFlight(unsigned count)
+{
+    _impl->SetMaxInFlight(count);
+}
+
+void SharedWorkQueue::SetPollInterval(unsigned milliseconds)
+{
+    _impl->SetPollInterval(milliseconds);
+}
+
+void SharedWorkQueue::SetLeaseDuration(unsigned seconds)
+{
+    _impl->SetLeaseDuration(seconds);
+}
+
+void SharedWorkQueue::SetJobTimeout(unsigned seconds)
+{
+    _impl->SetJobTimeout(seconds);
+}
+
+void SharedWorkQueue::SetSignatureVerification(bool isEnabled)
+{
+    _impl->SetSignatureVerification(isEnabled);
+}
+
+void SharedWorkQueue::SetSignedAssetArchive(const shared_ptr<SignedAssetArchive>& archive)
+{
+    _impl->SetSignedAssetArchive(archive);
+}
+
+void SharedWorkQueue::Run()
+{
+    _impl->Run();
+}
+
+void SharedWorkQueue::Stop()
+{
+    _impl->Stop();
+}
+
+string SharedWorkQueue::GetDefaultNodeId()
+{
+    string nodeId = boost::asio::ip::host_name();
+    replace_if(nodeId.begin(), nodeId.end(),
+               [](char c) { return c == '/' || c == '\\' || c == CLAIM_SEPARATOR; }, '-');
+    return nodeId.empty() ? "node" : nodeId;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file SharedWorkQueue.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains SharedWorkQueue, which lets several nodes sign the CPLs and PKLs dropped into a queue
+ * directory on a shared filesystem, each document by exactly one node.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <string>
+#include <memory>
+
+QUBE_WIRE_NS_START
+
+class QubeWireClient;
+class SignedAssetArchive;
+
+/**
+ * SharedWorkQueue processes a queue directory shared by any number of nodes, each running its
+ * own SharedWorkQueue with a distinct node id. The queue directory holds:
+ *  - incoming: unsigned CPLs and PKLs to be signed. Files are picked up as soon as they appear,
+ *    so they should be written elsewhere (or under a name starting with '.') and renamed in.
+ *  - claimed: documents being signed, named <name>~<node id>. A node claims a document by
+ *    renaming it here from incoming, which only one node can succeed at. The claimed file is
+ *    also the node's lease on it: the node touches it every heartbeat, and a claim that other
+ *    nodes see unchanged for the lease duration is renamed to a claim of the node seeing it
+ *    and moved back to incoming by that node.
+ *  - signed: signed documents, named <name without .xml>.signed.xml, published by rename once
+ *    complete.
+ *  - done: unsigned documents whose signed document was published.
+ *  - failed: documents that couldn't be signed, with the error in <name>.error.
+ * A node publishes a signed document only if it still holds the claim when moving the claim to
+ * done, so a document reclaimed from a stalled node is never published twice. Documents are
+ * moved out of claimed by hard link and unlink, so that files already in incoming, signed, done
+ * or failed are never replaced; a document whose name is still taken there stays in incoming.
+ * Leases are judged by each node's own clock, so the nodes' clocks need not agree.
+ */
+class SharedWorkQueue
+{
+public:
+    /**
+     * Construct SharedWorkQueue class object. The queue's directories are created if needed,
+     * and the queue is refused if its filesystem doesn't support hard links.
+     *
+     * @param[in] client Authenticated client used for signing
+     * @param[in] queueDirectory Root of the queue on the shared filesystem
+     * @param[in] nodeId Id of this node, unique among the nodes of the queue and the same
+     *                   across restarts, so that a restarted node releases its stale claims
+     */
+    SharedWorkQueue(QubeWireClient& client, const std::string& queueDirectory, const std::string& nodeId);
+
+    /**
+     * Destruct SharedWorkQueue class object.
+     */
+    ~SharedWorkQueue();
+
+    /**
+     * Set the number of documents this node signs at a time. When the client has a memory
+     * budget, documents are also only claimed while the budget has room for them.
+     *
+     * @param[in] count Documents in flight; default is 8
+     */
+    void SetMaxInFlight(unsigned count);
+
+    /**
+     * Set the interval at which the queue is scanned and signing jobs are polled.
+     *
+     * @param[in] milliseconds Poll interval; default is 2 seconds
+     */
+    void SetPollInterval(unsigned milliseconds);
+
+    /**
+     * Set how long a claim may go without a heartbeat before other nodes reclaim it.
+     * Claims are touched four times per lease duration. All nodes should use the same value.
+     *
+     * @param[in] seconds Lease duration; default is 60 seconds
+     */
+    void SetLeaseDuration(unsigned seconds);
+
+    /**
+     * Set how long a document may stay unsigned before it is moved to failed.
+     *
+     * @param[in] seconds Job timeout; default is 1 hour
+     */
+    void SetJobTimeout(unsigned seconds);
+
+    /**
+     * Verify the signature of each signed document against the company's certificate chain
+     * before publishing it; documents with a bad signature are moved to failed.
+     *
+     * @param[in] isEnabled true to verify signatures; default is false
+     */
+    void SetSignatureVerification(bool isEnabled);
+
+    /**
+     * Keep each document this node publishes in a signed asset archive, so that it can be
+     * served again by its UUID or job id.
+     *
+     * @param[in] archive Archive to append to; null to not archive, which is the default
+     */
+    void SetSignedAssetArchive(const std::shared_ptr<SignedAssetArchive>& archive);
+
+    /**
+     * Process the queue until SharedWorkQueue::Stop is called. Documents still being signed
+     * are then released to incoming for other nodes.
+     */
+    void Run();
+
+    /**
+     * Make SharedWorkQueue::Run return. Safe to call from another thread or a signal handler.
+     */
+    void Stop();
+
+    /**
+     * Get the default node id, the host name.
+     *
+     * @returns default node id
+     */
+    static std::string GetDefaultNodeId();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,511 @@
+/**
+ * @file SignatureVerifier.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of SignatureVerifier class
+ */
+
+#include "SignatureVerifier.h"
+#include "CertificateChain.h"
+
+#include <libxml/c14n.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+const char* const XMLDSIG_NAMESPACE = "http://www.w3.org/2000/09/xmldsig#";
+const char* const ENVELOPED_SIGNATURE_TRANSFORM = "http://www.w3.org/2000/09/xmldsig#enveloped-signature";
+const char* const C14N_WITH_COMMENTS_SUFFIX = "#WithComments";
+
+// Digests of references and SignedInfo must not be computed with anything weaker
+const int MIN_DIGEST_SIZE = 20;
+
+namespace
+{
+    typedef unique_ptr<xmlDoc, void (*)(xmlDocPtr)> XmlDocument;
+
+    bool IsDsigElement(xmlNodePtr node, const char* localName)
+    {
+        return node->type == XML_ELEMENT_NODE && node->ns &&
+               xmlStrEqual(node->ns->href, BAD_CAST XMLDSIG_NAMESPACE) &&
+               xmlStrEqual(node->name, BAD_CAST localName);
+    }
+
+    xmlNodePtr FindDsigElement(xmlNodePtr parent, const char* localName)
+    {
+        for (xmlNodePtr child = parent->children; child; child = child->next)
+        {
+            if (IsDsigElement(child, localName))
+            {
+                return child;
+            }
+        }
+
+        return nullptr;
+    }
+
+    xmlNodePtr GetDsigElement(xmlNodePtr parent, const char* localName)
+    {
+        xmlNodePtr element = FindDsigElement(parent, localName);
+        if (!element)
+        {
+            throw runtime_error(string("Signature doesn't have ") + localName);
+        }
+
+        return element;
+    }
+
+    string GetAttribute(xmlNodePtr element, const char* name, bool isRequired = true)
+    {
+        unique_ptr<xmlChar, void (*)(void*)> value(xmlGetProp(element, BAD_CAST name), xmlFree);
+        if (!value)
+        {
+            if (isRequired)
+            {
+                throw runtime_error(string("Signature element ") +
+                                    reinterpret_cast<const char*>(element->name) + " doesn't have " +
+                                    name);
+            }
+            return string();
+        }
+
+        return reinterpret_cast<const char*>(value.get());
+    }
+
+    string GetText(xmlNodePtr element)
+    {
+        unique_ptr<xmlChar, void (*)(void*)> text(xmlNodeGetContent(element), xmlFree);
+        return text ? reinterpret_cast<const char*>(text.get()) : "";
+    }
+
+    string DecodeBase64(string encoded)
+    {
+        encoded.erase(remove_if(encoded.begin(), encoded.end(),
+                                [](char c) { return isspace(static_cast<unsigned char>(c)) != 0; }),
+                      encoded.end());
+        if (encoded.empty() || encoded.size() % 4 != 0)
+        {
+            throw runtime_error("Invalid base64 in signature");
+        }
+
+        string decoded(3 * (encoded.size() / 4), '\0');
+        int decodedSize = EVP_DecodeBlock(reinterpret_cast<unsigned char*>(&decoded[0]),
+                                          reinterpret_cast<const unsigned char*>(encoded.data()),
+                                          static_cast<int>(encoded.size()));
+        if (decodedSize < 0)
+        {
+            throw runtime_error("Invalid base64 in signature");
+        }
+
+        // EVP_DecodeBlock counts the padding as decoded zero bytes
+        size_t padding = encoded.size() - encoded.find_last_not_of('=') - 1;
+        decoded.resize(decodedSize - min(padding, static_cast<size_t>(2)));
+
+        return decoded;
+    }
+
+    const EVP_MD* GetDigestAlgorithm(const string& uri)
+    {
+        const EVP_MD* digest = nullptr;
+        if (uri == "http://www.w3.org/2000/09/xmldsig#sha1")
+        {
+            digest = EVP_sha1();
+        }
+        else if (uri == "http://www.w3.org/2001/04/xmlenc#sha256")
+        {
+            digest = EVP_sha256();
+        }
+        else if (uri == "http://www.w3.org/2001/04/xmldsig-more#sha384")
+        {
+            digest = EVP_sha384();
+        }
+        else if (uri == "http://www.w3.org/2001/04/xmlenc#sha512")
+        {
+            digest = EVP_sha512();
+        }
+
+        if (!digest || EVP_MD_size(digest) < MIN_DIGEST_SIZE)
+        {
+            throw runtime_error("Unsupported digest method " + uri);
+        }
+
+        return digest;
+    }
+
+    const EVP_MD* GetSignatureAlgorithm(const string& uri)
+    {
+        if (uri == "http://www.w3.org/2000/09/xmldsig#rsa-sha1")
+        {
+            return EVP_sha1();
+        }
+        if (uri == "http://www.w3.org/2001/04/xmldsig-more#rsa-sha256")
+        {
+            return EVP_sha256();
+        }
+        if (uri == "http://www.w3.org/2001/04/xmldsig-more#rsa-sha384")
+        {
+            return EVP_sha384();
+        }
+        if (uri == "http://www.w3.org/2001/04/xmldsig-more#rsa-sha512")
+        {
+            return EVP_sha512();
+        }
+
+        throw runtime_error("Unsupported signature method " + uri);
+    }
+
+    // Canonicalization named by an algorithm URI, as a libxml2 mode
+    struct Canonicalization
+    {
+        Canonicalization() : mode(XML_C14N_1_0), withComments(false) {}
+
+        int mode;
+        bool withComments;
+        vector<string> inclusivePrefixes; ///< kept prefixes of exclusive canonicalization
+    };
+
+    bool ParseCanonicalization(xmlNodePtr method, Canonicalization& canonicalization)
+    {
+        string uri = GetAttribute(method, "Algorithm");
+        canonicalization.withComments = uri.size() > strlen(C14N_WITH_COMMENTS_SUFFIX) &&
+                                        uri.compare(uri.size() - strlen(C14N_WITH_COMMENTS_SUFFIX),
+                                                    string::npos, C14N_WITH_COMMENTS_SUFFIX) == 0;
+        if (canonicalization.withComments)
+        {
+            uri.resize(uri.size() - strlen(C14N_WITH_COMMENTS_SUFFIX));
+        }
+
+        if (uri == "http://www.w3.org/TR/2001/REC-xml-c14n-20010315")
+        {
+            canonicalization.mode = XML_C14N_1_0;
+        }
+        else if (uri == "http://www.w3.org/2006/12/xml-c14n11")
+        {
+            canonicalization.mode = XML_C14N_1_1;
+        }
+        else if (uri == "http://www.w3.org/2001/10/xml-exc-c14n")
+        {
+            canonicalization.mode = XML_C14N_EXCLUSIVE_1_0;
+            for (xmlNodePtr child = method->children; child; child = child->next)
+            {
+                if (child->type == XML_ELEMENT_NODE &&
+                    xmlStrEqual(child->name, BAD_CAST "InclusiveNamespaces"))
+                {
+                    istringstream prefixes(GetAttribute(child, "PrefixList", false));
+                    string prefix;
+                    while (prefixes >> prefix)
+                    {
+                        canonicalization.inclusivePrefixes.push_back(prefix);
+                    }
+                }
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    // The canonicalized node set is a subtree, or the whole document but a subtree
+    struct NodeSet
+    {
+        xmlNodePtr subtree;
+        bool isExcluded;
+    };
+
+    int IsVisible(void* userData, xmlNodePtr node, xmlNodePtr parent)
+    {
+        const NodeSet* nodeSet = static_cast<const NodeSet*>(userData);
+
+        // Namespace nodes aren't linked into the tree; they belong to the element given as parent
+        xmlNodePtr ancestor = node->type == XML_NAMESPACE_DECL ? parent : node;
+        while (ancestor && ancestor != nodeSet->subtree)
+        {
+            ancestor = ancestor->parent;
+        }
+
+        return (ancestor != nullptr) != nodeSet->isExcluded;
+    }
+
+    int AppendOutput(void* context, const char* data, int size)
+    {
+        static_cast<string*>(context)->append(data, size);
+        return size;
+    }
+
+    string Canonicalize(xmlDocPtr document, const NodeSet& nodeSet,
+                        const Canonicalization& canonicalization)
+    {
+        vector<xmlChar*> prefixes;
+        for (const string& prefix : canonicalization.inclusivePrefixes)
+        {
+            prefixes.push_back(BAD_CAST prefix.c_str());
+        }
+        prefixes.push_back(nullptr);
+
+        string canonical;
+        xmlOutputBufferPtr output =
+            xmlOutputBufferCreateIO(AppendOutput, nullptr, &canonical, nullptr);
+        if (!output)
+        {
+            throw runtime_error("Canonicalizing signed document failed");
+        }
+
+        xmlChar** inclusivePrefixes =
+            canonicalization.inclusivePrefixes.empty() ? nullptr : &prefixes[0];
+        int result = xmlC14NExecute(document, IsVisible, const_cast<NodeSet*>(&nodeSet),
+                                    canonicalization.mode, inclusivePrefixes,
+                                    canonicalization.withComments ? 1 : 0, output);
+        if (xmlOutputBufferClose(output) < 0 || result < 0)
+        {
+            throw runtime_error("Canonicalizing signed document failed");
+        }
+
+        return canonical;
+    }
+
+    string Digest(const string& data, const EVP_MD* algorithm)
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestSize = 0;
+        if (EVP_Digest(data.data(), data.size(), digest, &digestSize, algorithm, nullptr) != 1)
+        {
+            throw runtime_error("Computing digest of signed document failed");
+        }
+
+        return string(reinterpret_cast<const char*>(digest), digestSize);
+    }
+
+    // The enveloped signature is the Signature element that is a child of the document element
+    xmlNodePtr FindSignature(xmlDocPtr document)
+    {
+        xmlNodePtr root = xmlDocGetRootElement(document);
+        xmlNodePtr signature = root ? FindDsigElement(root, "Signature") : nullptr;
+        if (!signature)
+        {
+            throw runtime_error("Document isn't signed");
+        }
+
+        return signature;
+    }
+
+    // A reference to the whole document, which holds the signature, excluding the signature
+    void CheckReference(xmlDocPtr document, xmlNodePtr signature, xmlNodePtr reference)
+    {
+        if (!GetAttribute(reference, "URI", false).empty())
+        {
+            throw runtime_error("Unsupported reference " + GetAttribute(reference, "URI"));
+        }
+
+        bool isEnveloped = false;
+        Canonicalization canonicalization;
+        xmlNodePtr transforms = FindDsigElement(reference, "Transforms");
+        for (xmlNodePtr transform = transforms ? transforms->children : nullptr; transform;
+             transform = transform->next)
+        {
+            if (!IsDsigElement(transform, "Transform"))
+            {
+                continue;
+            }
+
+            if (GetAttribute(transform, "Algorithm") == ENVELOPED_SIGNATURE_TRANSFORM)
+            {
+                isEnveloped = true;
+            }
+            else if (!ParseCanonicalization(transform, canonicalization))
+            {
+                throw runtime_error("Unsupported transform " + GetAttribute(transform, "Algorithm"));
+            }
+        }
+        if (!isEnveloped)
+        {
+            throw runtime_error("Reference doesn't exclude the signature");
+        }
+
+        // A same-document reference leaves comments out, whatever the canonicalization
+        canonicalization.withComments = false;
+
+        const EVP_MD* algorithm = GetDigestAlgorithm(
+            GetAttribute(GetDsigElement(reference, "DigestMethod"), "Algorithm"));
+        NodeSet nodeSet = {signature, true};
+        string digest = Digest(Canonicalize(document, nodeSet, canonicalization), algorithm);
+        if (digest != DecodeBase64(GetText(GetDsigElement(reference, "DigestValue"))))
+        {
+            throw runtime_error("Digest of the document doesn't match its signature");
+        }
+    }
+}
+
+SignatureVerifier::SignatureVerifier(const CertificateChain& chain, unsigned threadCount)
+{
+    // Sets up libxml2's global state, which must happen before parsing on several threads
+    xmlInitParser();
+
+    // OpenSSL 1.0.2 shares a key between threads safely once its locking callbacks are
+    // installed, which the HTTP client's SSL support does
+    EVP_PKEY* publicKey = X509_get_pubkey(chain.GetLeaf().handle.get());
+    if (!publicKey)
+    {
+        throw runtime_error("Reading public key of certificate " + chain.GetLeaf().subjectName +
+                            " failed");
+    }
+    _publicKey.reset(publicKey, EVP_PKEY_free);
+
+    _threadCount = threadCount != 0 ? threadCount : thread::hardware_concurrency();
+    if (_threadCount == 0)
+    {
+        _threadCount = 1;
+    }
+}
+
+vector<SignatureVerification> SignatureVerifier::VerifyAll(const vector<string>& signedXmls,
+                                                           const CancellationToken& cancellation) const
+{
+    vector<SignatureVerification> verifications(signedXmls.size());
+
+    atomic<size_t> next(0);
+    mutex errorMutex;
+    exception_ptr error;
+
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < signedXmls.size(); i = next++)
+        {
+            try
+            {
+                cancellation.ThrowIfCancelled();
+                verifications[i] = Verify(signedXmls[i]);
+            }
+            catch (...)
+            {
+                lock_guard<mutex> lock(errorMutex);
+                if (!error)
+                {
+                    error = current_exception();
+                }
+                next = signedXmls.size();
+            }
+        }
+    };
+
+    size_t threadCount = min<size_t>(_threadCount, signedXmls.size());
+    vector<thread> threads;
+    for (size_t i = 1; i < threadCount; ++i)
+    {
+        threads.push_back(thread(worker));
+    }
+    worker();
+    for (thread& t : threads)
+    {
+        t.join();
+    }
+
+    if (error)
+    {
+        rethrow_exception(error);
+    }
+
+    return verifications;
+}
+
+SignatureVerification SignatureVerifier::Verify(const string& signedXml) const
+{
+    SignatureVerification verification;
+    try
+    {
+        _Verify(signedXml);
+        verification.isValid = true;
+    }
+    catch (const exception& e)
+    {
+        verification.isValid = false;
+        verification.error = e.what();
+    }
+
+    return verification;
+}
+
+void SignatureVerifier::_Verify(const string& signedXml) const
+{
+    // Entities are left unexpanded and nothing is fetched, so the document is verified as sent
+    int options = XML_PARSE_NONET | XML_PARSE_NOERROR | XML_PARSE_NOWARNING;
+    XmlDocument document(
+        xmlReadMemory(signedXml.data(), static_cast<int>(signedXml.size()), nullptr, nullptr, options),
+        xmlFreeDoc);
+    if (!document)
+    {
+        throw runtime_error("Signed document isn't well-formed XML");
+    }
+
+    xmlNodePtr signature = FindSignature(document.get());
+    xmlNodePtr signedInfo = GetDsigElement(signature, "SignedInfo");
+
+    size_t referenceCount = 0;
+    for (xmlNodePtr reference = signedInfo->children; reference; reference = reference->next)
+    {
+        if (IsDsigElement(reference, "Reference"))
+        {
+            CheckReference(document.get(), signature, reference);
+            ++referenceCount;
+        }
+    }
+    if (referenceCount == 0)
+    {
+        throw runtime_error("Signature doesn't have Reference");
+    }
+
+    Canonicalization canonicalization;
+    xmlNodePtr canonicalizationMethod = GetDsigElement(signedInfo, "CanonicalizationMethod");
+    if (!ParseCanonicalization(canonicalizationMethod, canonicalization))
+    {
+        throw runtime_error("Unsupported canonicalization method " +
+                            GetAttribute(canonicalizationMethod, "Algorithm"));
+    }
+    NodeSet nodeSet = {signedInfo, false};
+    string canonicalSignedInfo = Canonicalize(document.get(), nodeSet, canonicalization);
+
+    const EVP_MD* algorithm = GetSignatureAlgorithm(
+        GetAttribute(GetDsigElement(signedInfo, "SignatureMethod"), "Algorithm"));
+    string signatureValue = DecodeBase64(GetText(GetDsigElement(signature, "SignatureValue")));
+
+    unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX*)> context(
+        EVP_MD_CTX_create(), [](EVP_MD_CTX* context) { EVP_MD_CTX_destroy(context); });
+    if (!context ||
+        EVP_DigestVerifyInit(context.get(), nullptr, algorithm, nullptr, _publicKey.get()) != 1 ||
+        EVP_DigestVerifyUpdate(context.get(), canonicalSignedInfo.data(),
+                               canonicalSignedInfo.size()) != 1)
+    {
+        ERR_clear_error();
+        throw runtime_error("Verifying signature failed");
+    }
+
+    // EVP_DigestVerifyFinal of OpenSSL 1.0.2 takes the signature as non-const
+    int result = EVP_DigestVerifyFinal(context.get(),
+                                       reinterpret_cast<unsigned char*>(&signatureValue[0]),
+                                       signatureValue.size());
+    if (result != 1)
+    {
+        // A mismatch leaves an error behind on this thread
+        ERR_clear_error();
+        throw runtime_error("Signature wasn't made with the key of the certificate chain");
+    }
+}
@@ -0,0 +1,82 @@
+/**
+ * @file SignatureVerifier.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains SignatureVerifier, which checks the XML signatures of signed CPLs and PKLs against
+ * the company's certificate chain.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+#include "Cancellation.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef struct evp_pkey_st EVP_PKEY;
+
+QUBE_WIRE_NS_START
+
+class CertificateChain;
+
+/**
+ * Outcome of verifying the signature of a document.
+ */
+struct SignatureVerification
+{
+    bool isValid;      ///< true if the document is signed by the chain's leaf certificate
+    std::string error; ///< why the signature doesn't verify; empty if valid
+};
+
+/**
+ * SignatureVerifier checks enveloped XML signatures (XMLDSig), as Qube Wire puts on CPLs and
+ * PKLs: every reference digest over the canonicalized document, and the RSA signature over the
+ * canonicalized SignedInfo with the public key of the chain's leaf certificate. The key is
+ * taken from the chain once, and documents are verified in parallel.
+ * Only same-document references to the whole document (URI="") are supported.
+ */
+class SignatureVerifier
+{
+public:
+    /**
+     * Construct SignatureVerifier class object.
+     *
+     * @param[in] chain Certificate chain the documents are signed with, e.g. from
+     *                  QubeWireClient::GetParsedCertificateChain
+     * @param[in] threadCount Number of documents verified in parallel; 0 to use one per CPU core
+     */
+    SignatureVerifier(const CertificateChain& chain, unsigned threadCount = 0);
+
+    /**
+     * Verify the signatures of documents in parallel.
+     *
+     * @param[in] signedXmls Signed CPLs or PKLs
+     * @param[in] cancellation Token stopping all threads between documents once cancelled
+     *
+     * @returns outcomes in the same order as signedXmls
+     */
+    std::vector<SignatureVerification> VerifyAll(
+        const std::vector<std::string>& signedXmls,
+        const CancellationToken& cancellation = CancellationToken()) const;
+
+    /**
+     * Verify the signature of a document on the calling thread.
+     *
+     * @param[in] signedXml Signed CPL or PKL
+     *
+     * @returns outcome of the verification
+     */
+    SignatureVerification Verify(const std::string& signedXml) const;
+
+private:
+    void _Verify(const std::string& signedXml) const;
+
+    std::shared_ptr<EVP_PKEY> _publicKey;
+    unsigned _threadCount;
+};
+
+QUBE_WIRE_NS_STOP
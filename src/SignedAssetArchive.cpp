@@ -0,0 +1,611 @@
+/**
+ * @file SignedAssetArchive.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of SignedAssetArchive class
+ */
+
+#include "SignedAssetArchive.h"
+#include "JobTable.h"
+#include "XmlHelpers.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace fs = boost::filesystem;
+namespace ipc = boost::interprocess;
+namespace ptree = boost::property_tree;
+
+const char ARCHIVE_MAGIC[8] = {'Q', 'W', 'S', 'I', 'G', 'N', 'E', 'D'};
+const uint32_t ARCHIVE_VERSION = 1;
+
+// The file is grown in steps of this size, so that appends rarely remap it
+const uint64_t ARCHIVE_GROWTH_SIZE = 1024 * 1024;
+
+const uint32_t NO_RECORD = UINT32_MAX;
+
+namespace
+{
+    // Fields are stored in host byte order; archives are local to the machine that wrote them
+    struct ArchiveHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t end;        // end of the last record, committed after the record is written
+        uint64_t flushedEnd; // records before this were written through to the disk
+        uint64_t padding[4];
+    };
+
+    struct RecordHeader
+    {
+        uint64_t idHigh;
+        uint64_t idLow;
+        uint64_t jobIdHigh;
+        uint64_t jobIdLow;
+        int64_t signedAt; // microseconds since the epoch, never less than the previous record's
+        uint32_t xmlSize;
+        uint32_t checksum; // FNV-1a of the fields above and the XML
+    };
+
+    // Records start at multiples of 8 bytes
+    uint64_t GetRecordSize(uint32_t xmlSize)
+    {
+        return (sizeof(RecordHeader) + xmlSize + 7) & ~static_cast<uint64_t>(7);
+    }
+
+    uint32_t UpdateChecksum(uint32_t checksum, const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            checksum = (checksum ^ bytes[i]) * 16777619u;
+        }
+
+        return checksum;
+    }
+
+    uint32_t GetChecksum(const RecordHeader& header, const char* xml)
+    {
+        uint32_t checksum = UpdateChecksum(2166136261u, &header, offsetof(RecordHeader, checksum));
+        return UpdateChecksum(checksum, xml, header.xmlSize);
+    }
+
+    size_t GetIndexSlot(uint64_t high, uint64_t low, size_t slotCount)
+    {
+        // UUIDs are mostly random already, mixing guards against sequential ids
+        uint64_t hash = (low ^ (high * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+        return static_cast<size_t>(hash >> 32) & (slotCount - 1);
+    }
+
+    int64_t ToMicroseconds(chrono::system_clock::time_point time)
+    {
+        return chrono::duration_cast<chrono::microseconds>(time.time_since_epoch()).count();
+    }
+
+    // Lock files of the archives open in this process
+    mutex openArchivesMutex;
+    set<string> openArchives;
+
+    JobId ParseId(const string& text, const char* kind)
+    {
+        JobId id;
+        if (!JobId::TryParse(text, id))
+        {
+            throw runtime_error(string("Invalid ") + kind + " " + text);
+        }
+
+        return id;
+    }
+}
+
+struct SignedAssetArchive::Impl
+{
+    Impl(const string& filePath) : _filePath(filePath), _data(nullptr), _mappedSize(0), _end(0)
+    {
+        // Record appends aren't coordinated across processes, so only one may have it open
+        string lockFilePath = filePath + ".lock";
+        {
+            ofstream lockFile(lockFilePath.c_str(), ios::app);
+        }
+        boost::system::error_code error;
+        _lockFilePath = fs::canonical(lockFilePath, error).string();
+        if (error)
+        {
+            throw runtime_error("Opening lock file " + lockFilePath + " failed");
+        }
+
+        // File locks are held per process, and closing any handle of the lock file releases
+        // them, so archives open in this process are tracked apart
+        {
+            lock_guard<mutex> lock(openArchivesMutex);
+            if (!openArchives.insert(_lockFilePath).second)
+            {
+                throw runtime_error("Signed asset archive " + filePath + " is already open");
+            }
+        }
+        try
+        {
+            _lock = ipc::file_lock(_lockFilePath.c_str());
+            if (!_lock.try_lock())
+            {
+                throw runtime_error("Signed asset archive " + filePath +
+                                    " is in use by another process");
+            }
+
+            if (!fs::exists(filePath, error) || fs::file_size(filePath, error) == 0)
+            {
+                _Create();
+            }
+            else
+            {
+                _Map();
+                _Load();
+            }
+        }
+        catch (const ipc::interprocess_exception&)
+        {
+            _Close();
+            throw runtime_error("Opening lock file " + lockFilePath + " failed");
+        }
+        catch (...)
+        {
+            _Close();
+            throw;
+        }
+    }
+
+    ~Impl()
+    {
+        try
+        {
+            _Flush();
+        }
+        catch (...)
+        {
+            // Unflushed records are checked when the archive is opened again
+        }
+        _Close();
+    }
+
+    void Add(const string& id, const string& jobId, const string& signedXml)
+    {
+        JobId assetId = ParseId(id, "asset id");
+        JobId signingJobId = ParseId(jobId, "job id");
+        if (signedXml.size() > numeric_limits<uint32_t>::max())
+        {
+            throw runtime_error("Signed document of asset " + id + " is too large to archive");
+        }
+
+        lock_guard<mutex> lock(_archiveMutex);
+        if (_offsets.size() >= NO_RECORD)
+        {
+            throw runtime_error("Signed asset archive " + _filePath + " is full");
+        }
+
+        RecordHeader header;
+        header.idHigh = assetId.high;
+        header.idLow = assetId.low;
+        header.jobIdHigh = signingJobId.high;
+        header.jobIdLow = signingJobId.low;
+        header.signedAt = ToMicroseconds(chrono::system_clock::now());
+        header.xmlSize = static_cast<uint32_t>(signedXml.size());
+        if (!_offsets.empty())
+        {
+            // A clock stepped back must not break the time order range lookups rely on
+            header.signedAt = max(header.signedAt, _GetRecordHeader(_offsets.size() - 1).signedAt);
+        }
+        header.checksum = GetChecksum(header, signedXml.data());
+
+        uint64_t recordSize = GetRecordSize(header.xmlSize);
+        if (_end + recordSize > _mappedSize)
+        {
+            _Grow(_end + recordSize);
+        }
+
+        char* record = _data + _end;
+        memcpy(record, &header, sizeof(header));
+        memcpy(record + sizeof(header), signedXml.data(), signedXml.size());
+        memset(record + sizeof(header) + signedXml.size(), 0,
+               recordSize - sizeof(header) - signedXml.size());
+
+        // The record is part of the archive once the end moves past it
+        _offsets.push_back(_end);
+        _end += recordSize;
+        _GetArchiveHeader().end = _end;
+        _Index(static_cast<uint32_t>(_offsets.size() - 1));
+    }
+
+    bool FindById(const string& id, SignedAssetRecord& record) const
+    {
+        JobId assetId;
+        if (!JobId::TryParse(id, assetId))
+        {
+            return false;
+        }
+
+        lock_guard<mutex> lock(_archiveMutex);
+        return _Read(_Find(_idIndex, assetId, false), record);
+    }
+
+    bool FindByJobId(const string& jobId, SignedAssetRecord& record) const
+    {
+        JobId signingJobId;
+        if (!JobId::TryParse(jobId, signingJobId))
+        {
+            return false;
+        }
+
+        lock_guard<mutex> lock(_archiveMutex);
+        return _Read(_Find(_jobIdIndex, signingJobId, true), record);
+    }
+
+    vector<SignedAssetRecord> FindSignedBetween(chrono::system_clock::time_point from,
+                                                chrono::system_clock::time_point to) const
+    {
+        int64_t fromTime = ToMicroseconds(from);
+        int64_t toTime = ToMicroseconds(to);
+        auto isBefore = [this](uint64_t offset, int64_t time) {
+            RecordHeader header;
+            memcpy(&header, _data + offset, sizeof(header));
+            return header.signedAt < time;
+        };
+
+        lock_guard<mutex> lock(_archiveMutex);
+        vector<SignedAssetRecord> records;
+        for (auto offset = lower_bound(_offsets.begin(), _offsets.end(), fromTime, isBefore);
+             offset != _offsets.end() && isBefore(*offset, toTime); ++offset)
+        {
+            records.push_back(SignedAssetRecord());
+            _Read(static_cast<uint32_t>(offset - _offsets.begin()), records.back());
+        }
+
+        return records;
+    }
+
+    size_t GetCount() const
+    {
+        lock_guard<mutex> lock(_archiveMutex);
+        return _offsets.size();
+    }
+
+    void Flush()
+    {
+        lock_guard<mutex> lock(_archiveMutex);
+        _Flush();
+    }
+
+private:
+    ArchiveHeader& _GetArchiveHeader() { return *reinterpret_cast<ArchiveHeader*>(_data); }
+
+    RecordHeader _GetRecordHeader(uint32_t recordNumber) const
+    {
+        RecordHeader header;
+        memcpy(&header, _data + _offsets[recordNumber], sizeof(header));
+        return header;
+    }
+
+    void _Create()
+    {
+        {
+            ofstream fileStream(_filePath.c_str(), ios::binary | ios::trunc);
+            if (!fileStream.is_open())
+            {
+                throw runtime_error("Creating signed asset archive " + _filePath + " failed");
+            }
+        }
+        _Resize(ARCHIVE_GROWTH_SIZE);
+        _Map();
+
+        ArchiveHeader& header = _GetArchiveHeader();
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+        header.version = ARCHIVE_VERSION;
+        header.end = sizeof(ArchiveHeader);
+        _end = header.end;
+        _Flush();
+    }
+
+    void _Load()
+    {
+        ArchiveHeader& header = _GetArchiveHeader();
+        if (_mappedSize < sizeof(ArchiveHeader) ||
+            memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0)
+        {
+            throw runtime_error(_filePath + " isn't a signed asset archive");
+        }
+        if (header.version != ARCHIVE_VERSION)
+        {
+            throw runtime_error("Signed asset archive " + _filePath + " has an unsupported version");
+        }
+
+        // Records after the flushed end may not have reached the disk before a crash, so only
+        // they are checked against their checksum. The first bad record ends the archive.
+        uint64_t end = min<uint64_t>(header.end, _mappedSize);
+        uint64_t offset = sizeof(ArchiveHeader);
+        int64_t previousSignedAt = numeric_limits<int64_t>::min();
+        while (offset + sizeof(RecordHeader) <= end && _offsets.size() < NO_RECORD)
+        {
+            RecordHeader record;
+            memcpy(&record, _data + offset, sizeof(record));
+            uint64_t recordSize = GetRecordSize(record.xmlSize);
+            if (recordSize > end - offset || record.signedAt < previousSignedAt ||
+                (offset >= header.flushedEnd &&
+                 record.checksum != GetChecksum(record, _data + offset + sizeof(record))))
+            {
+                break;
+            }
+
+            _offsets.push_back(offset);
+            _Index(static_cast<uint32_t>(_offsets.size() - 1));
+            previousSignedAt = record.signedAt;
+            offset += recordSize;
+        }
+
+        _end = offset;
+        if (header.end != _end)
+        {
+            header.end = _end;
+            header.flushedEnd = min(header.flushedEnd, _end);
+        }
+    }
+
+    void _Map()
+    {
+        try
+        {
+            _mapping = ipc::file_mapping(_filePath.c_str(), ipc::read_write);
+            _region = ipc::mapped_region(_mapping, ipc::read_write);
+        }
+        catch (const ipc::interprocess_exception& e)
+        {
+            throw runtime_error("Mapping signed asset archive " + _filePath + " failed: " + e.what());
+        }
+
+        _data = static_cast<char*>(_region.get_address());
+        _mappedSize = _region.get_size();
+    }
+
+    void _Unmap()
+    {
+        _region = ipc::mapped_region();
+        _mapping = ipc::file_mapping();
+        _data = nullptr;
+        _mappedSize = 0;
+    }
+
+    void _Close()
+    {
+        _Unmap();
+        _lock = ipc::file_lock();
+
+        lock_guard<mutex> lock(openArchivesMutex);
+        openArchives.erase(_lockFilePath);
+    }
+
+    void _Resize(uint64_t size)
+    {
+        boost::system::error_code error;
+        fs::resize_file(_filePath, size, error);
+        if (error)
+        {
+            throw runtime_error("Growing signed asset archive " + _filePath + " failed: " +
+                                error.message());
+        }
+    }
+
+    // Some platforms can't resize a mapped file, so it is unmapped while growing
+    void _Grow(uint64_t requiredSize)
+    {
+        uint64_t size = max(_mappedSize * 2, requiredSize);
+        size = (size + ARCHIVE_GROWTH_SIZE - 1) / ARCHIVE_GROWTH_SIZE * ARCHIVE_GROWTH_SIZE;
+
+        _Unmap();
+        try
+        {
+            _Resize(size);
+        }
+        catch (...)
+        {
+            _Map();
+            throw;
+        }
+        _Map();
+    }
+
+    void _Flush()
+    {
+        if (!_data)
+        {
+            return;
+        }
+
+        if (!_region.flush(0, static_cast<size_t>(_end), false))
+        {
+            throw runtime_error("Flushing signed asset archive " + _filePath + " failed");
+        }
+        ArchiveHeader& header = _GetArchiveHeader();
+        if (header.flushedEnd != _end)
+        {
+            header.flushedEnd = _end;
+            _region.flush(0, sizeof(ArchiveHeader), false);
+        }
+    }
+
+    void _Index(uint32_t recordNumber)
+    {
+        // Indexes are kept at most half full
+        if (_offsets.size() * 2 > _idIndex.size())
+        {
+            size_t slotCount = max<size_t>(_idIndex.size() * 2, 1024);
+            _idIndex.assign(slotCount, NO_RECORD);
+            _jobIdIndex.assign(slotCount, NO_RECORD);
+            for (uint32_t i = 0; i < recordNumber; ++i)
+            {
+                _Insert(i);
+            }
+        }
+        _Insert(recordNumber);
+    }
+
+    // A later record of the same id replaces the earlier one in the index
+    void _Insert(uint32_t recordNumber)
+    {
+        RecordHeader header = _GetRecordHeader(recordNumber);
+        _Insert(_idIndex, header.idHigh, header.idLow, recordNumber, false);
+        _Insert(_jobIdIndex, header.jobIdHigh, header.jobIdLow, recordNumber, true);
+    }
+
+    void _Insert(vector<uint32_t>& index, uint64_t high, uint64_t low, uint32_t recordNumber,
+                 bool isJobId)
+    {
+        size_t mask = index.size() - 1;
+        for (size_t slot = GetIndexSlot(high, low, index.size());; slot = (slot + 1) & mask)
+        {
+            if (index[slot] == NO_RECORD || _IsKey(index[slot], high, low, isJobId))
+            {
+                index[slot] = recordNumber;
+                return;
+            }
+        }
+    }
+
+    uint32_t _Find(const vector<uint32_t>& index, const JobId& id, bool isJobId) const
+    {
+        if (index.empty())
+        {
+            return NO_RECORD;
+        }
+
+        size_t mask = index.size() - 1;
+        for (size_t slot = GetIndexSlot(id.high, id.low, index.size());; slot = (slot + 1) & mask)
+        {
+            if (index[slot] == NO_RECORD || _IsKey(index[slot], id.high, id.low, isJobId))
+            {
+                return index[slot];
+            }
+        }
+    }
+
+    bool _IsKey(uint32_t recordNumber, uint64_t high, uint64_t low, bool isJobId) const
+    {
+        RecordHeader header = _GetRecordHeader(recordNumber);
+        return isJobId ? header.jobIdHigh == high && header.jobIdLow == low
+                       : header.idHigh == high && header.idLow == low;
+    }
+
+    bool _Read(uint32_t recordNumber, SignedAssetRecord& record) const
+    {
+        if (recordNumber == NO_RECORD)
+        {
+            return false;
+        }
+
+        RecordHeader header = _GetRecordHeader(recordNumber);
+        JobId id = {header.idHigh, header.idLow};
+        JobId jobId = {header.jobIdHigh, header.jobIdLow};
+        record.id = id.ToString();
+        record.jobId = jobId.ToString();
+        record.signedAt = chrono::system_clock::time_point(
+            chrono::duration_cast<chrono::system_clock::duration>(
+                chrono::microseconds(header.signedAt)));
+        record.xml.assign(_data + _offsets[recordNumber] + sizeof(header), header.xmlSize);
+        return true;
+    }
+
+    string _filePath;
+    string _lockFilePath;
+    ipc::file_lock _lock;
+    ipc::file_mapping _mapping;
+    ipc::mapped_region _region;
+    char* _data;
+    uint64_t _mappedSize;
+    uint64_t _end;
+
+    // Offsets of the records in the order they were appended, indexed by record number
+    vector<uint64_t> _offsets;
+
+    // Open addressing indexes from asset id and job id to record number
+    vector<uint32_t> _idIndex;
+    vector<uint32_t> _jobIdIndex;
+
+    mutable mutex _archiveMutex;
+};
+
+SignedAssetArchive::SignedAssetArchive(const string& filePath)
+{
+    _impl.reset(new Impl(filePath));
+}
+
+SignedAssetArchive::~SignedAssetArchive()
+{
+}
+
+void SignedAssetArchive::Add(const string& id, const string& jobId, const string& signedXml)
+{
+    _impl->Add(id, jobId, signedXml);
+}
+
+bool SignedAssetArchive::FindById(const string& id, SignedAssetRecord& record) const
+{
+    return _impl->FindById(id, record);
+}
+
+bool SignedAssetArchive::FindByJobId(const string& jobId, SignedAssetRecord& record) const
+{
+    return _impl->FindByJobId(jobId, record);
+}
+
+vector<SignedAssetRecord> SignedAssetArchive::FindSignedBetween(chrono::system_clock::time_point from,
+                                                                chrono::system_clock::time_point to) const
+{
+    return _impl->FindSignedBetween(from, to);
+}
+
+size_t SignedAssetArchive::GetCount() const
+{
+    return _impl->GetCount();
+}
+
+void SignedAssetArchive::Flush()
+{
+    _impl->Flush();
+}
+
+string SignedAssetArchive::GetAssetId(const string& xml)
+{
+    istringstream xmlStream(xml);
+    ptree::ptree document;
+    ptree::read_xml(xmlStream, document);
+
+    const ptree::ptree* root = FindXmlElement(document, "CompositionPlaylist");
+    if (!root)
+    {
+        root = FindXmlElement(document, "PackingList");
+    }
+    string id = root ? StripUuidUrn(GetXmlElementText(*root, "Id")) : "";
+    if (id.empty())
+    {
+        throw runtime_error("Document isn't a CPL or PKL with an Id");
+    }
+
+    return id;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file SignedAssetArchive.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains SignedAssetArchive, a local record of signed CPLs and PKLs kept in a memory mapped file.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+QUBE_WIRE_NS_START
+
+/**
+ * A signed document kept in a SignedAssetArchive.
+ */
+struct SignedAssetRecord
+{
+    std::string id;                                 ///< CPL or PKL UUID
+    std::string jobId;                              ///< Qube Wire signing job identifier
+    std::chrono::system_clock::time_point signedAt; ///< when the document was archived
+    std::string xml;                                ///< signed XML
+};
+
+/**
+ * SignedAssetArchive keeps signed documents in an append-only file that is memory mapped, so
+ * that a document signed before can be served again or audited without Qube Wire. Records are
+ * looked up in O(1) by asset UUID or job id through hashed indexes, and in O(log n) by signing
+ * time, as records are appended in time order. The indexes are held in memory and rebuilt from
+ * the record headers when the archive is opened; a record torn by a crash is dropped then.
+ * An asset archived again, e.g. after being re-signed, is found by its latest record.
+ * All methods are thread safe. Only one process may open an archive at a time.
+ */
+class SignedAssetArchive
+{
+public:
+    /**
+     * Open an archive, creating it if it doesn't exist.
+     *
+     * @param[in] filePath Path of the archive file; a lock file is kept next to it
+     */
+    SignedAssetArchive(const std::string& filePath);
+
+    /**
+     * Destruct SignedAssetArchive class object, flushing and closing the archive.
+     */
+    ~SignedAssetArchive();
+
+    /**
+     * Append a signed document, archived at the current time.
+     *
+     * @param[in] id CPL or PKL UUID, with or without the urn:uuid: prefix
+     * @param[in] jobId Qube Wire signing job identifier
+     * @param[in] signedXml Signed XML
+     */
+    void Add(const std::string& id, const std::string& jobId, const std::string& signedXml);
+
+    /**
+     * Find the latest record of an asset.
+     *
+     * @param[in] id CPL or PKL UUID, with or without the urn:uuid: prefix
+     * @param[out] record Record of the asset
+     *
+     * @returns false if the asset isn't archived
+     */
+    bool FindById(const std::string& id, SignedAssetRecord& record) const;
+
+    /**
+     * Find the record of a signing job.
+     *
+     * @param[in] jobId Qube Wire signing job identifier
+     * @param[out] record Record of the job
+     *
+     * @returns false if the job isn't archived
+     */
+    bool FindByJobId(const std::string& jobId, SignedAssetRecord& record) const;
+
+    /**
+     * Find the records archived in a time range.
+     *
+     * @param[in] from Start of the range, inclusive
+     * @param[in] to End of the range, exclusive
+     *
+     * @returns records in the order they were archived
+     */
+    std::vector<SignedAssetRecord> FindSignedBetween(std::chrono::system_clock::time_point from,
+                                                     std::chrono::system_clock::time_point to) const;
+
+    /**
+     * Get the number of records.
+     *
+     * @returns record count
+     */
+    size_t GetCount() const;
+
+    /**
+     * Write appended records through to the disk.
+     */
+    void Flush();
+
+    /**
+     * Get the UUID of a CPL or PKL.
+     *
+     * @param[in] xml CPL or PKL, signed or not
+     *
+     * @returns Id of the document without the urn:uuid: prefix
+     */
+    static std::string GetAssetId(const std::string& xml);
+
+private:
+    SignedAssetArchive(const SignedAssetArchive&);
+    SignedAssetArchive& operator=(const SignedAssetArchive&);
+
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,266 @@
+/**
+ * @file SigningPipeline.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of SigningPipeline class
+ */
+
+#include "SigningPipeline.h"
+#include "QubeWireClient.h"
+#include "PklBuilder.h"
+#include "AssetHasher.h"
+#include "SignatureVerifier.h"
+#include "CertificateChain.h"
+#include "XmlHelpers.h"
+#include "FileHelpers.h"
+#include "MemoryBudget.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace ptree = boost::property_tree;
+
+const string CPL_ASSET_TYPE = "text/xml";
+
+// How often the package's deadline and cancellation are checked while waiting for hashing
+const chrono::milliseconds HASHING_CHECK_INTERVAL(100);
+
+namespace
+{
+    string GetCplId(istream& cplStream)
+    {
+        ptree::ptree document;
+        ptree::read_xml(cplStream, document);
+
+        const ptree::ptree* compositionPlaylist = FindXmlElement(document, "CompositionPlaylist");
+        string id = compositionPlaylist ? StripUuidUrn(GetXmlElementText(*compositionPlaylist, "Id"))
+                                        : "";
+        if (id.empty())
+        {
+            throw runtime_error("CPL doesn't have an Id");
+        }
+
+        return id;
+    }
+
+    string GetCplId(const string& cplXml)
+    {
+        istringstream cplStream(cplXml);
+        return GetCplId(cplStream);
+    }
+
+    // The CPL is parsed from the file, without holding a copy of its text
+    string GetCplIdFromFile(const string& cplFilePath)
+    {
+        ifstream cplStream(cplFilePath.c_str(), ios::binary);
+        if (!cplStream.is_open())
+        {
+            throw runtime_error("Opening file " + cplFilePath + " for reading failed");
+        }
+
+        return GetCplId(cplStream);
+    }
+}
+
+SigningPipeline::SigningPipeline(QubeWireClient& client)
+    : _client(client), _pollInterval(2000), _isSignatureVerified(false)
+{
+}
+
+void SigningPipeline::SetPollInterval(unsigned milliseconds)
+{
+    _pollInterval = milliseconds;
+}
+
+void SigningPipeline::SetSignatureVerification(bool isEnabled)
+{
+    _isSignatureVerified = isEnabled;
+}
+
+SignedPackage SigningPipeline::Sign(const vector<string>& unsignedCplXmls, PklBuilder& pkl,
+                                    const CallOptions& options)
+{
+    vector<string> cplIds;
+    for (const string& unsignedCplXml : unsignedCplXmls)
+    {
+        cplIds.push_back(GetCplId(unsignedCplXml));
+    }
+
+    return _Sign(cplIds, [this, &unsignedCplXmls, &options](size_t index) {
+        return _client.Sign(unsignedCplXmls[index], options);
+    }, pkl, options);
+}
+
+SignedPackage SigningPipeline::SignFiles(const vector<string>& unsignedCplFilePaths, PklBuilder& pkl,
+                                         const CallOptions& options)
+{
+    vector<string> cplIds;
+    for (const string& unsignedCplFilePath : unsignedCplFilePaths)
+    {
+        cplIds.push_back(GetCplIdFromFile(unsignedCplFilePath));
+    }
+
+    shared_ptr<MemoryBudget> budget = _client.GetMemoryBudget();
+    return _Sign(cplIds, [this, &unsignedCplFilePaths, &options, budget](size_t index) {
+        const string& filePath = unsignedCplFilePaths[index];
+        return budget ? _client.Sign(GetFileContents(filePath, *budget, options), options)
+                      : _client.Sign(GetFileContents(filePath), options);
+    }, pkl, options);
+}
+
+SignedPackage SigningPipeline::_Sign(const vector<string>& cplIds, const CplSubmitter& submitCpl,
+                                     PklBuilder& pkl, const CallOptions& options)
+{
+    SignedPackage package;
+    package.cpls.resize(cplIds.size());
+    for (size_t i = 0; i < cplIds.size(); ++i)
+    {
+        package.cpls[i].id = cplIds[i];
+    }
+
+    // The chain's key is read once for all documents of the package
+    unique_ptr<SignatureVerifier> verifier;
+    if (_isSignatureVerified)
+    {
+        verifier.reset(new SignatureVerifier(*_client.GetParsedCertificateChain()));
+    }
+
+    // Track files don't depend on the CPLs, hash them while Qube Wire signs. Hashing is
+    // abandoned when signing fails or the package's deadline or cancellation fires, so that
+    // the error isn't held up by a large package.
+    CancellationToken hashingCancellation = CancellationToken::Create();
+    future<void> assetHashing = async(launch::async, [&pkl, &cplIds, hashingCancellation]() {
+        pkl.HashAssets(cplIds, hashingCancellation);
+    });
+
+    vector<AssetDigest> cplDigests(package.cpls.size());
+    try
+    {
+        _SignCpls(submitCpl, package, cplDigests, options);
+        _VerifySignatures(verifier.get(), package.cpls, "CPL", options);
+
+        while (assetHashing.wait_until(options.deadline.Min(Deadline::Clock::now() +
+                                                            HASHING_CHECK_INTERVAL)) !=
+               future_status::ready)
+        {
+            options.cancellation.ThrowIfCancelled();
+            if (options.deadline.IsExpired())
+            {
+                throw DeadlineExceededError("Hashing assets of package exceeded its deadline");
+            }
+        }
+    }
+    catch (...)
+    {
+        hashingCancellation.Cancel();
+        throw;
+    }
+
+    assetHashing.get();
+    for (size_t i = 0; i < package.cpls.size(); ++i)
+    {
+        if (!pkl.SetAssetDigest(package.cpls[i].id, cplDigests[i]))
+        {
+            PklAsset cplAsset;
+            cplAsset.id = package.cpls[i].id;
+            cplAsset.type = CPL_ASSET_TYPE;
+            cplAsset.hash = cplDigests[i].hash;
+            cplAsset.size = cplDigests[i].size;
+            pkl.AddAsset(cplAsset);
+        }
+    }
+
+    package.pkl.id = pkl.GetId();
+    package.pkl.jobId = _client.Sign(pkl.Build(), options);
+    package.pkl.xml = _client.WaitForSignedAssetXml(package.pkl.jobId, options, _pollInterval);
+    _VerifySignatures(verifier.get(), vector<SignedPackageAsset>(1, package.pkl), "PKL", options);
+
+    return package;
+}
+
+void SigningPipeline::_VerifySignatures(const SignatureVerifier* verifier,
+                                        const vector<SignedPackageAsset>& assets, const string& type,
+                                        const CallOptions& options)
+{
+    if (!verifier)
+    {
+        return;
+    }
+
+    vector<string> signedXmls;
+    for (const SignedPackageAsset& asset : assets)
+    {
+        signedXmls.push_back(asset.xml);
+    }
+
+    vector<SignatureVerification> verifications = verifier->VerifyAll(signedXmls, options.cancellation);
+    for (size_t i = 0; i < verifications.size(); ++i)
+    {
+        if (!verifications[i].isValid)
+        {
+            throw runtime_error("Signature of " + type + " " + assets[i].id + " is invalid: " +
+                                verifications[i].error);
+        }
+    }
+}
+
+void SigningPipeline::_SignCpls(const CplSubmitter& submitCpl, SignedPackage& package,
+                                vector<AssetDigest>& cplDigests, const CallOptions& options)
+{
+    for (size_t i = 0; i < package.cpls.size(); ++i)
+    {
+        package.cpls[i].jobId = submitCpl(i);
+    }
+
+    vector<size_t> pendingCpls;
+    for (size_t i = 0; i < package.cpls.size(); ++i)
+    {
+        pendingCpls.push_back(i);
+    }
+
+    while (!pendingCpls.empty())
+    {
+        vector<size_t> stillPending;
+        for (size_t index : pendingCpls)
+        {
+            SignedAssetResult result = _client.GetSignedAssetXml(package.cpls[index].jobId, options);
+            if (!result.isSigned)
+            {
+                stillPending.push_back(index);
+                continue;
+            }
+
+            cplDigests[index] = AssetHasher::HashBuffer(result.xml);
+            package.cpls[index].xml = move(result.xml);
+        }
+
+        pendingCpls.swap(stillPending);
+        if (pendingCpls.empty())
+        {
+            break;
+        }
+
+        Deadline::Clock::time_point nextPoll =
+            Deadline::Clock::now() + chrono::milliseconds(_pollInterval);
+        if (options.cancellation.WaitUntil(options.deadline.Min(nextPoll)))
+        {
+            throw OperationCancelledError();
+        }
+        if (options.deadline.IsExpired())
+        {
+            throw DeadlineExceededError("Signing CPLs of package exceeded its deadline");
+        }
+    }
+}
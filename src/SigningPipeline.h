@@ -0,0 +1,123 @@
+/**
+ * @file SigningPipeline.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains SigningPipeline, which signs the CPLs of a package and then its PKL through Qube Wire.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+#include "Cancellation.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+QUBE_WIRE_NS_START
+
+class QubeWireClient;
+class PklBuilder;
+class SignatureVerifier;
+struct AssetDigest;
+
+/**
+ * A CPL or PKL signed through the pipeline.
+ */
+struct SignedPackageAsset
+{
+    std::string id;    ///< CPL or PKL UUID
+    std::string jobId; ///< Qube Wire signing job identifier
+    std::string xml;   ///< signed XML
+};
+
+/**
+ * Signed documents of a package.
+ */
+struct SignedPackage
+{
+    std::vector<SignedPackageAsset> cpls; ///< signed CPLs, in the order they were given
+    SignedPackageAsset pkl;               ///< signed PKL listing the signed CPLs
+};
+
+/**
+ * SigningPipeline signs a package following its dependencies: the PKL carries the hash of
+ * every signed CPL, so it is built and submitted as soon as the last CPL is signed.
+ * All CPLs are submitted at once so Qube Wire signs them concurrently, and the remaining
+ * package assets are hashed in the background meanwhile.
+ */
+class SigningPipeline
+{
+public:
+    /**
+     * Construct SigningPipeline class object.
+     *
+     * @param[in] client Authenticated client used for signing
+     */
+    SigningPipeline(QubeWireClient& client);
+
+    /**
+     * Set the interval between polls of outstanding signing jobs.
+     *
+     * @param[in] milliseconds Poll interval; default is 2 seconds
+     */
+    void SetPollInterval(unsigned milliseconds);
+
+    /**
+     * Verify the signatures of the signed CPLs, in parallel, and of the signed PKL against the
+     * company's certificate chain before using them. A bad signature fails the package.
+     *
+     * @param[in] isEnabled true to verify signatures; default is false
+     */
+    void SetSignatureVerification(bool isEnabled);
+
+    /**
+     * Sign the CPLs and then the PKL of a package.
+     * Each CPL is listed in the PKL with the hash and size of its signed XML; CPLs missing
+     * from the PKL are added to it.
+     *
+     * @param[in] unsignedCplXmls unsigned CPLs of the package
+     * @param[in] pkl PKL of the package with its other assets, e.g. from PklBuilder::FromXml
+     * @param[in] options Deadline and cancellation token of the whole package; once either
+     *                    fires, hashing and polling stop and the error is thrown
+     *
+     * @returns signed CPLs and PKL
+     */
+    SignedPackage Sign(const std::vector<std::string>& unsignedCplXmls, PklBuilder& pkl,
+                       const CallOptions& options = CallOptions());
+
+    /**
+     * Sign the CPLs of a package read from files and then its PKL, as SigningPipeline::Sign.
+     * When the client has a memory budget, each CPL is read into a buffer drawn from it right
+     * before it is submitted, so only the CPL being uploaded is held.
+     *
+     * @param[in] unsignedCplFilePaths paths of the unsigned CPLs of the package
+     * @param[in] pkl PKL of the package with its other assets, e.g. from PklBuilder::FromXml
+     * @param[in] options Deadline and cancellation token of the whole package
+     *
+     * @returns signed CPLs and PKL
+     */
+    SignedPackage SignFiles(const std::vector<std::string>& unsignedCplFilePaths, PklBuilder& pkl,
+                            const CallOptions& options = CallOptions());
+
+private:
+    typedef std::function<std::string(size_t)> CplSubmitter;
+
+    SignedPackage _Sign(const std::vector<std::string>& cplIds, const CplSubmitter& submitCpl,
+                        PklBuilder& pkl, const CallOptions& options);
+
+    void _SignCpls(const CplSubmitter& submitCpl, SignedPackage& package,
+                   std::vector<AssetDigest>& cplDigests, const CallOptions& options);
+
+    static void _VerifySignatures(const SignatureVerifier* verifier,
+                                  const std::vector<SignedPackageAsset>& assets,
+                                  const std::string& type, const CallOptions& options);
+
+    QubeWireClient& _client;
+    unsigned _pollInterval;
+    bool _isSignatureVerified;
+};
+
+QUBE_WIRE_NS_STOP
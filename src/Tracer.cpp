@@ -0,0 +1,213 @@
+/**
+ * @file Tracer.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of Tracer and TraceSpan classes
+ */
+
+#include "Tracer.h"
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace filesystem = boost::filesystem;
+
+// Spans are appended to the trace file once this many are pending, which bounds the memory held
+const size_t MAX_PENDING_EVENTS = 1024;
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* category;
+        string name;
+        int64_t startTime;
+        int64_t duration;
+        size_t threadId;
+        Tracer::Tags tags;
+    };
+
+    string EscapeJson(const string& value)
+    {
+        ostringstream escaped;
+        for (char c : value)
+        {
+            switch (c)
+            {
+                case '"': escaped << "\\\""; break;
+                case '\\': escaped << "\\\\"; break;
+                case '\n': escaped << "\\n"; break;
+                case '\r': escaped << "\\r"; break;
+                case '\t': escaped << "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                    {
+                        escaped << "\\u00" << "0123456789abcdef"[(c >> 4) & 0xf]
+                                << "0123456789abcdef"[c & 0xf];
+                    }
+                    else
+                    {
+                        escaped << c;
+                    }
+            }
+        }
+        return escaped.str();
+    }
+}
+
+struct Tracer::Impl
+{
+    // The trace is written in the JSON array format, whose closing bracket is optional, so the
+    // file stays loadable while spans are appended and if the process dies before closing it
+    Impl(const string& traceFilePath)
+        : _traceFilePath(traceFilePath), _epoch(chrono::steady_clock::now()),
+          _traceFile(traceFilePath), _writtenCount(0)
+    {
+        if (!_traceFile.is_open())
+        {
+            throw runtime_error("Opening trace file " + _traceFilePath + " for writing failed");
+        }
+
+        _traceFile << "[";
+    }
+
+    ~Impl()
+    {
+        lock_guard<mutex> lock(_mutex);
+        _WritePending();
+        _traceFile << "\n]\n";
+    }
+
+    int64_t Now() const
+    {
+        return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - _epoch)
+            .count();
+    }
+
+    void AddSpan(const char* category, const string& name, int64_t startTime, int64_t duration,
+                 const Tags& tags)
+    {
+        TraceEvent event = {category, name, startTime, duration,
+                            hash<thread::id>()(this_thread::get_id()), tags};
+
+        lock_guard<mutex> lock(_mutex);
+        _events.push_back(move(event));
+        if (_events.size() >= MAX_PENDING_EVENTS)
+        {
+            _WritePending();
+        }
+    }
+
+    void Flush()
+    {
+        lock_guard<mutex> lock(_mutex);
+        _WritePending();
+        _traceFile.flush();
+        if (!_traceFile)
+        {
+            throw runtime_error("Writing trace file " + _traceFilePath + " failed");
+        }
+    }
+
+private:
+    void _WritePending()
+    {
+        for (const TraceEvent& event : _events)
+        {
+            _traceFile << (_writtenCount++ == 0 ? "\n" : ",\n")
+                       << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.threadId & 0xffffff)
+                       << ",\"cat\":\"" << event.category << "\",\"name\":\""
+                       << EscapeJson(event.name) << "\",\"ts\":" << event.startTime
+                       << ",\"dur\":" << event.duration << ",\"args\":{";
+            for (size_t j = 0; j < event.tags.size(); ++j)
+            {
+                _traceFile << (j == 0 ? "" : ",") << "\"" << EscapeJson(event.tags[j].first)
+                           << "\":\"" << EscapeJson(event.tags[j].second) << "\"";
+            }
+            _traceFile << "}}";
+        }
+        _events.clear();
+    }
+
+    string _traceFilePath;
+    chrono::steady_clock::time_point _epoch;
+
+    mutex _mutex;
+    filesystem::ofstream _traceFile;
+    size_t _writtenCount;
+    vector<TraceEvent> _events;
+};
+
+Tracer::Tracer(const string& traceFilePath)
+{
+    _impl.reset(new Impl(traceFilePath));
+}
+
+Tracer::~Tracer()
+{
+    try
+    {
+        _impl->Flush();
+    }
+    catch (...)
+    {
+        // intentionally ignored, destructor must not throw
+    }
+}
+
+int64_t Tracer::Now() const
+{
+    return _impl->Now();
+}
+
+void Tracer::AddSpan(const char* category, const string& name, int64_t startTime,
+                     int64_t duration, const Tags& tags)
+{
+    _impl->AddSpan(category, name, startTime, duration, tags);
+}
+
+void Tracer::Flush()
+{
+    _impl->Flush();
+}
+
+TraceSpan::TraceSpan(Tracer* tracer, const char* category, const char* name)
+    : _tracer(tracer), _category(category), _name(name), _startTime(0)
+{
+    if (_tracer)
+    {
+        _startTime = _tracer->Now();
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    End();
+}
+
+void TraceSpan::Tag(const char* key, const string& value)
+{
+    if (_tracer)
+    {
+        _tags.push_back(make_pair(string(key), value));
+    }
+}
+
+void TraceSpan::End()
+{
+    if (_tracer)
+    {
+        _tracer->AddSpan(_category, _name, _startTime, _tracer->Now() - _startTime, _tags);
+        _tracer = nullptr;
+    }
+}
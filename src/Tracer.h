@@ -0,0 +1,120 @@
+/**
+ * @file Tracer.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains Tracer and TraceSpan, which record timed spans of client operations and write them
+ * as a Chrome trace-event JSON file that can be loaded in Perfetto or chrome://tracing.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Tracer collects completed spans and appends them to the trace file in batches, on Flush and
+ * on destruction, so long running processes hold a bounded number of spans in memory.
+ * All methods are thread safe.
+ */
+class Tracer
+{
+public:
+    typedef std::vector<std::pair<std::string, std::string>> Tags;
+
+    /**
+     * Construct Tracer class object.
+     *
+     * @param[in] traceFilePath Path of the Chrome trace-event JSON file to be written; it is
+     *                          created right away, throwing if it can't be
+     */
+    Tracer(const std::string& traceFilePath);
+
+    /**
+     * Destruct Tracer class object. Pending spans are written to the trace file.
+     */
+    ~Tracer();
+
+    /**
+     * Get current time of the trace clock.
+     *
+     * @returns microseconds elapsed since the tracer was created
+     */
+    int64_t Now() const;
+
+    /**
+     * Record a completed span.
+     *
+     * @param[in] category Category of the span, e.g. "http" or "file"
+     * @param[in] name Name of the span
+     * @param[in] startTime Start of the span as returned by Tracer::Now
+     * @param[in] duration Duration of the span in microseconds
+     * @param[in] tags Key/value pairs attached to the span, e.g. the job id
+     */
+    void AddSpan(const char* category, const std::string& name, int64_t startTime,
+                 int64_t duration, const Tags& tags);
+
+    /**
+     * Append the spans recorded since the last write to the trace file.
+     */
+    void Flush();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+/**
+ * TraceSpan records the lifetime of a scope as a span of the given tracer.
+ * When the tracer is null, the span does nothing, so tracing costs a pointer check when off.
+ */
+class TraceSpan
+{
+public:
+    /**
+     * Start a span.
+     *
+     * @param[in] tracer Tracer to record the span into; may be null
+     * @param[in] category Category of the span
+     * @param[in] name Name of the span
+     */
+    TraceSpan(Tracer* tracer, const char* category, const char* name);
+
+    /**
+     * Ends the span, if not already ended through TraceSpan::End.
+     */
+    ~TraceSpan();
+
+    /**
+     * Attach a key/value pair to the span.
+     *
+     * @param[in] key Name of the tag, e.g. "job"
+     * @param[in] value Value of the tag
+     */
+    void Tag(const char* key, const std::string& value);
+
+    /**
+     * End the span and record it into the tracer.
+     */
+    void End();
+
+private:
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+
+    Tracer* _tracer;
+    const char* _category;
+    const char* _name;
+    int64_t _startTime;
+    Tracer::Tags _tags;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,115 @@
+/**
+ * @file TransferMeter.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of TransferMeter class
+ */
+
+#include "TransferMeter.h"
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+// Weight of the latest report's throughput in the smoothed throughput
+const double THROUGHPUT_SMOOTHING = 0.3;
+
+// Throughput over shorter windows than this is mostly noise
+const chrono::milliseconds MIN_MEASUREMENT_WINDOW(20);
+
+TransferMeter::TransferMeter(const ProgressCallback& callback, chrono::milliseconds interval,
+                             const string& operation, const string& jobId, uint64_t bytesToSend)
+    : _callback(callback), _interval(interval), _bytesSent(0), _start(Clock::now()),
+      _lastReport(_start), _lastMeasurement(_start), _lastMeasuredBytes(0), _reportCount(0),
+      _isMeasured(false)
+{
+    _progress.operation = operation;
+    _progress.jobId = jobId;
+    _progress.phase = bytesToSend != 0 ? TransferPhase::Uploading : TransferPhase::ServerProcessing;
+    _progress.bytesSent = 0;
+    _progress.bytesToSend = bytesToSend;
+    _progress.bytesReceived = 0;
+    _progress.bytesToReceive = 0;
+    _progress.bytesPerSecond = 0;
+    _progress.smoothedBytesPerSecond = 0;
+    _progress.elapsed = chrono::milliseconds(0);
+}
+
+void TransferMeter::AddBytesSent(uint64_t bytes)
+{
+    _bytesSent.fetch_add(bytes, memory_order_relaxed);
+}
+
+void TransferMeter::StartDownload(uint64_t bytesToReceive)
+{
+    _progress.bytesToReceive = bytesToReceive;
+    if (_progress.phase < TransferPhase::Downloading)
+    {
+        _progress.phase = TransferPhase::Downloading;
+        _Report(Clock::now());
+    }
+}
+
+void TransferMeter::Complete(uint64_t bytesReceived, const string& jobId)
+{
+    if (!jobId.empty())
+    {
+        _progress.jobId = jobId;
+    }
+    _progress.bytesReceived = bytesReceived;
+    _progress.bytesToReceive = bytesReceived;
+    _progress.phase = TransferPhase::Completed;
+    _Report(Clock::now());
+}
+
+void TransferMeter::Update()
+{
+    Clock::time_point now = Clock::now();
+    if (_progress.phase == TransferPhase::Uploading &&
+        _bytesSent.load(memory_order_relaxed) >= _progress.bytesToSend)
+    {
+        _progress.phase = TransferPhase::ServerProcessing;
+        _Report(now);
+    }
+    else if (now - _lastReport >= _interval || _reportCount == 0)
+    {
+        _Report(now);
+    }
+}
+
+TransferPhase TransferMeter::GetPhase() const
+{
+    return _progress.phase;
+}
+
+void TransferMeter::_Report(Clock::time_point now)
+{
+    _progress.bytesSent = _bytesSent.load(memory_order_relaxed);
+    _progress.elapsed = chrono::duration_cast<chrono::milliseconds>(now - _start);
+
+    // Both directions count, so throughput reflects whatever the link is doing. Reports
+    // closer together than a measurement window, e.g. on changes of phase, keep the last one.
+    uint64_t bytes = _progress.bytesSent + _progress.bytesReceived;
+    bool isWindowElapsed = now - _lastMeasurement >= MIN_MEASUREMENT_WINDOW;
+    if (_reportCount != 0 && isWindowElapsed)
+    {
+        double seconds = chrono::duration<double>(now - _lastMeasurement).count();
+        _progress.bytesPerSecond = (bytes - _lastMeasuredBytes) / seconds;
+        _progress.smoothedBytesPerSecond =
+            _isMeasured ? THROUGHPUT_SMOOTHING * _progress.bytesPerSecond +
+                              (1 - THROUGHPUT_SMOOTHING) * _progress.smoothedBytesPerSecond
+                        : _progress.bytesPerSecond;
+        _isMeasured = true;
+    }
+    if (_reportCount == 0 || isWindowElapsed)
+    {
+        _lastMeasurement = now;
+        _lastMeasuredBytes = bytes;
+    }
+
+    _lastReport = now;
+    ++_reportCount;
+
+    _callback(_progress);
+}
@@ -0,0 +1,126 @@
+/**
+ * @file TransferMeter.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains TransferMeter, which reports the progress and throughput of a job's transfer to and
+ * from Qube Wire at a limited rate.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+QUBE_WIRE_NS_START
+
+/**
+ * Phase of a transfer.
+ */
+enum class TransferPhase : uint8_t
+{
+    Uploading = 0,        ///< request body being sent
+    ServerProcessing = 1, ///< request sent, waiting for Qube Wire to respond
+    Downloading = 2,      ///< response headers received, body being received
+    Completed = 3         ///< response received; last report of the transfer
+};
+
+/**
+ * Progress of a transfer, as reported to a ProgressCallback.
+ */
+struct TransferProgress
+{
+    std::string operation;           ///< Sign, UploadKdm or GetSignedAssetXml
+    std::string jobId;               ///< job of the transfer; empty till Qube Wire assigns it
+    TransferPhase phase;             ///< current phase
+    uint64_t bytesSent;              ///< request body bytes sent so far
+    uint64_t bytesToSend;            ///< size of the request body
+    uint64_t bytesReceived;          ///< response body bytes received so far
+    uint64_t bytesToReceive;         ///< size of the response body, 0 while unknown
+    double bytesPerSecond;           ///< throughput since the previous report
+    double smoothedBytesPerSecond;   ///< exponentially weighted throughput of the transfer
+    std::chrono::milliseconds elapsed; ///< time since the transfer started
+};
+
+/**
+ * Receives progress reports. Called on the thread making the call being reported, so it should
+ * return quickly, and must not throw.
+ */
+typedef std::function<void(const TransferProgress&)> ProgressCallback;
+
+/**
+ * TransferMeter tracks one transfer and reports it to a ProgressCallback: on every change of
+ * phase, and otherwise at most once per report interval. Bytes sent may be counted from any
+ * thread, at the cost of one relaxed atomic add; everything else, including the callback, runs
+ * on the thread calling TransferMeter::Update.
+ */
+class TransferMeter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Construct TransferMeter class object in Uploading phase.
+     *
+     * @param[in] callback Callback receiving the reports
+     * @param[in] interval Least time between two reports within a phase
+     * @param[in] operation Operation being reported
+     * @param[in] jobId Job of the transfer, empty if not known yet
+     * @param[in] bytesToSend Size of the request body
+     */
+    TransferMeter(const ProgressCallback& callback, std::chrono::milliseconds interval,
+                  const std::string& operation, const std::string& jobId, uint64_t bytesToSend);
+
+    /**
+     * Count request body bytes handed to the connection. Safe to call from any thread.
+     *
+     * @param[in] bytes Bytes sent
+     */
+    void AddBytesSent(uint64_t bytes);
+
+    /**
+     * Move to Downloading phase once the response headers are received.
+     *
+     * @param[in] bytesToReceive Size of the response body, 0 if unknown
+     */
+    void StartDownload(uint64_t bytesToReceive);
+
+    /**
+     * Report the transfer completed.
+     *
+     * @param[in] bytesReceived Size of the response body
+     * @param[in] jobId Job assigned by the response, empty to keep the current one
+     */
+    void Complete(uint64_t bytesReceived, const std::string& jobId = std::string());
+
+    /**
+     * Move to ServerProcessing phase once the whole request body is sent, and report if a
+     * report is due.
+     */
+    void Update();
+
+    TransferPhase GetPhase() const;
+
+private:
+    void _Report(Clock::time_point now);
+
+    ProgressCallback _callback;
+    std::chrono::milliseconds _interval;
+    TransferProgress _progress;
+    std::atomic<uint64_t> _bytesSent;
+
+    Clock::time_point _start;
+    Clock::time_point _lastReport;
+    Clock::time_point _lastMeasurement;
+    uint64_t _lastMeasuredBytes;
+    uint64_t _reportCount;
+    bool _isMeasured;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,785 @@
+/**
+ * @file WireAgent.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of WireAgent class
+ */
+
+#include "WireAgent.h"
+#include "WireAgentProtocol.h"
+#include "QubeWireClient.h"
+#include "PriorityScheduler.h"
+#include "JobTable.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace protocol = WireAgentProtocol;
+typedef chrono::steady_clock Clock;
+
+// Completed jobs are kept this long for clients to fetch their results
+const chrono::minutes COMPLETED_JOB_RETENTION(10);
+
+// Requests to Qube Wire are made one at a time on the worker thread, so a stalled one holding up
+// the others is given up on after this
+const chrono::seconds REQUEST_DEADLINE(30);
+
+// Polls of a job failing in a row before the job is reported failed
+const uint16_t MAX_POLL_RETRIES = 3;
+
+// Resolution of poll times
+const chrono::milliseconds JOB_TABLE_TICK(100);
+
+namespace
+{
+    struct DescriptorGuard
+    {
+        DescriptorGuard(int descriptor) : fd(descriptor) {}
+        ~DescriptorGuard()
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+
+        int fd;
+    };
+
+    JobPriority GetPriority(const protocol::FrameHeader& request)
+    {
+        unsigned priority = request.flags & protocol::PRIORITY_FLAGS_MASK;
+        return priority < JOB_PRIORITY_COUNT ? static_cast<JobPriority>(priority)
+                                             : JobPriority::Normal;
+    }
+}
+
+struct WireAgent::Impl
+{
+    Impl(QubeWireClient& client, const string& socketPath)
+        : _client(client), _socketPath(socketPath), _pollInterval(2000), _jobTimeout(3600),
+          _jobTable(JOB_TABLE_TICK)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path))
+        {
+            throw runtime_error("Wire agent socket path " + socketPath + " is too long");
+        }
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+        if (pipe(_stopPipe) != 0 || pipe(_wakePipe) != 0)
+        {
+            _CloseAll();
+            throw runtime_error("Creating wire agent stop pipe failed");
+        }
+        for (int fd : {_stopPipe[0], _stopPipe[1], _wakePipe[0], _wakePipe[1]})
+        {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        fcntl(_stopPipe[1], F_SETFL, O_NONBLOCK);
+        fcntl(_wakePipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(_wakePipe[1], F_SETFL, O_NONBLOCK);
+
+        _listenSocket = protocol::CreateSocket();
+        if (_listenSocket < 0)
+        {
+            _CloseAll();
+            throw runtime_error("Creating wire agent socket failed");
+        }
+
+        // Only a stale socket is replaced, never a file that happens to be at the path
+        struct stat pathStatus;
+        if (lstat(socketPath.c_str(), &pathStatus) == 0)
+        {
+            if (!S_ISSOCK(pathStatus.st_mode))
+            {
+                _CloseAll();
+                throw runtime_error("Wire agent socket path " + socketPath + " is not a socket");
+            }
+            unlink(socketPath.c_str());
+        }
+
+        // The socket is made private to its owner before anyone can connect to it
+        if (bind(_listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(_listenSocket, SOMAXCONN) != 0)
+        {
+            _CloseAll();
+            throw runtime_error("Listening on wire agent socket " + socketPath + " failed: " +
+                                strerror(errno));
+        }
+    }
+
+    ~Impl()
+    {
+        _CloseAll();
+        unlink(_socketPath.c_str());
+    }
+
+    void SetPollInterval(unsigned milliseconds) { _pollInterval = chrono::milliseconds(milliseconds); }
+
+    void SetJobTimeout(unsigned seconds) { _jobTimeout = chrono::seconds(seconds); }
+
+    void Run()
+    {
+        _StartWorker();
+        try
+        {
+            _Serve();
+        }
+        catch (...)
+        {
+            _StopWorker();
+            throw;
+        }
+        _StopWorker();
+    }
+
+    void Stop()
+    {
+        // Only write(2) here, so this can be called from a signal handler
+        char stopRequest = 1;
+        ssize_t ignored = write(_stopPipe[1], &stopRequest, 1);
+        (void)ignored;
+    }
+
+private:
+    // A call to Qube Wire made on the worker thread, returning what is left to do on the loop
+    typedef function<void()> Completion;
+    typedef function<Completion()> Call;
+
+    struct Connection
+    {
+        int socket = -1;
+        protocol::FrameReceiver receiver;
+        deque<string> output;    // responses not sent yet
+        size_t outputOffset = 0; // bytes of the first response already sent
+    };
+
+    void _Serve()
+    {
+        while (true)
+        {
+            vector<pollfd> descriptors;
+            vector<uint64_t> connectionIds;
+            descriptors.push_back(_MakePollDescriptor(_stopPipe[0], POLLIN));
+            descriptors.push_back(_MakePollDescriptor(_wakePipe[0], POLLIN));
+            descriptors.push_back(_MakePollDescriptor(_listenSocket, POLLIN));
+            for (const map<uint64_t, Connection>::value_type& connection : _connections)
+            {
+                // Requests of a client aren't read while its responses wait to be sent, so a
+                // client that doesn't read them can't make them pile up
+                short events = connection.second.output.empty() ? POLLIN : POLLOUT;
+                descriptors.push_back(_MakePollDescriptor(connection.second.socket, events));
+                connectionIds.push_back(connection.first);
+            }
+
+            int timeout = -1;
+            if (!_isCalling && !_scheduler.IsEmpty())
+            {
+                timeout = 0;
+            }
+            else if (_jobTable.GetCount() != 0)
+            {
+                timeout = _GetTimeoutTill(_jobTable.GetNextDue());
+            }
+
+            if (poll(descriptors.data(), descriptors.size(), timeout) < 0 && errno != EINTR)
+            {
+                throw runtime_error("Waiting for wire agent requests failed");
+            }
+
+            if (descriptors[0].revents != 0)
+            {
+                char stopRequest;
+                while (read(_stopPipe[0], &stopRequest, 1) < 0 && errno == EINTR)
+                {
+                }
+                return;
+            }
+
+            if (descriptors[1].revents != 0)
+            {
+                _RunCompletions();
+            }
+
+            if (descriptors[2].revents & POLLIN)
+            {
+                int clientSocket = protocol::AcceptConnection(_listenSocket);
+                if (clientSocket >= 0 && _IsOwnUser(clientSocket) &&
+                    fcntl(clientSocket, F_SETFL, fcntl(clientSocket, F_GETFL) | O_NONBLOCK) == 0)
+                {
+                    _connections[_nextConnectionId++].socket = clientSocket;
+                }
+                else if (clientSocket >= 0)
+                {
+                    close(clientSocket);
+                }
+            }
+
+            for (size_t i = 3; i < descriptors.size(); ++i)
+            {
+                // Connections closed by a completion are skipped
+                uint64_t connectionId = connectionIds[i - 3];
+                if (descriptors[i].revents == 0 || _connections.find(connectionId) == _connections.end())
+                {
+                    continue;
+                }
+
+                bool isOpen = descriptors[i].events == POLLOUT ? _Flush(connectionId)
+                                                               : _ReceiveRequest(connectionId);
+                if (!isOpen)
+                {
+                    _CloseConnection(connectionId);
+                }
+            }
+
+            _CollectDueJobs();
+
+            // Queued work is handed to the worker one call at a time, so new requests are queued
+            // (and may go ahead of it) between any two calls to Qube Wire
+            while (!_isCalling && _scheduler.RunNext())
+            {
+            }
+        }
+    }
+
+    static pollfd _MakePollDescriptor(int fd, short events)
+    {
+        pollfd descriptor;
+        descriptor.fd = fd;
+        descriptor.events = events;
+        descriptor.revents = 0;
+
+        return descriptor;
+    }
+
+    // Qube Wire calls take up to REQUEST_DEADLINE, so they are made on a worker thread and the
+    // loop keeps serving other clients meanwhile. The client is used by one thread at a time.
+    void _StartWorker()
+    {
+        _cancellation = CancellationToken::Create();
+        _isWorkerStopping = false;
+        _isCalling = false;
+        _worker = thread([this]() { _RunWorker(); });
+    }
+
+    // A call in flight is cancelled, and its completion still run, so the job it was for is kept
+    void _StopWorker()
+    {
+        _cancellation.Cancel();
+        {
+            lock_guard<mutex> lock(_callMutex);
+            _isWorkerStopping = true;
+        }
+        _callAvailable.notify_one();
+        _worker.join();
+        _RunCompletions();
+    }
+
+    void _RunWorker()
+    {
+        unique_lock<mutex> lock(_callMutex);
+        while (true)
+        {
+            _callAvailable.wait(lock, [this]() { return _isWorkerStopping || _nextCall; });
+            if (!_nextCall)
+            {
+                return;
+            }
+
+            Call call;
+            call.swap(_nextCall);
+            lock.unlock();
+            Completion completion = call();
+            lock.lock();
+
+            _completions.push_back(move(completion));
+            char wakeUp = 1;
+            ssize_t ignored = write(_wakePipe[1], &wakeUp, 1);
+            (void)ignored;
+        }
+    }
+
+    void _Call(Call call)
+    {
+        {
+            lock_guard<mutex> lock(_callMutex);
+            _nextCall = move(call);
+        }
+        _isCalling = true;
+        _callAvailable.notify_one();
+    }
+
+    void _RunCompletions()
+    {
+        char wakeUps[64];
+        while (read(_wakePipe[0], wakeUps, sizeof(wakeUps)) > 0)
+        {
+        }
+
+        deque<Completion> completions;
+        {
+            lock_guard<mutex> lock(_callMutex);
+            completions.swap(_completions);
+        }
+        if (!completions.empty())
+        {
+            _isCalling = false;
+        }
+
+        for (Completion& completion : completions)
+        {
+            completion();
+        }
+    }
+
+    // Milliseconds to sleep till the given time, rounded up so the loop doesn't wake up early
+    static int _GetTimeoutTill(Clock::time_point time)
+    {
+        if (time == Clock::time_point::max())
+        {
+            return -1;
+        }
+
+        Clock::time_point now = Clock::now();
+        if (time <= now)
+        {
+            return 0;
+        }
+
+        chrono::milliseconds::rep timeout =
+            chrono::duration_cast<chrono::milliseconds>(time - now + chrono::milliseconds(1) -
+                                                        Clock::duration(1))
+                .count();
+        return static_cast<int>(min<chrono::milliseconds::rep>(timeout, INT_MAX));
+    }
+
+    // Requests are signed with the agent's Qube Wire account, so only its own user may make them
+    static bool _IsOwnUser(int clientSocket)
+    {
+        uid_t uid;
+        return protocol::GetPeerUser(clientSocket, uid) && uid == geteuid();
+    }
+
+    static protocol::FrameHeader _MakeResponse(const protocol::FrameHeader& request, uint16_t type)
+    {
+        protocol::FrameHeader response;
+        memset(&response, 0, sizeof(response));
+        response.type = type;
+        response.requestId = request.requestId;
+
+        return response;
+    }
+
+    // Returns false when the connection is to be closed; a partly received request is kept
+    // for the next call
+    bool _ReceiveRequest(uint64_t connectionId)
+    {
+        Connection& connection = _connections[connectionId];
+        protocol::FrameHeader request;
+        string payload;
+        int fd = -1;
+        try
+        {
+            if (!connection.receiver.Receive(connection.socket))
+            {
+                return false;
+            }
+            if (!connection.receiver.TakeFrame(request, payload, fd))
+            {
+                return true;
+            }
+        }
+        catch (const exception&)
+        {
+            return false;
+        }
+        shared_ptr<DescriptorGuard> passedFile = make_shared<DescriptorGuard>(fd);
+
+        switch (request.type)
+        {
+            case protocol::SIGN:
+            case protocol::UPLOAD_KDM:
+            {
+                // Submission waits for its turn; the file is read only when it is sent
+                _scheduler.Enqueue(GetPriority(request), [this, connectionId, request, passedFile]() {
+                    _Submit(connectionId, request, passedFile);
+                });
+                return true;
+            }
+
+            case protocol::STATUS:
+                return _Respond(connectionId, request, payload, passedFile->fd);
+
+            case protocol::STATISTICS:
+            {
+                string statistics;
+                for (unsigned i = 0; i < JOB_PRIORITY_COUNT; ++i)
+                {
+                    protocol::AppendStatistics(statistics,
+                                               _scheduler.GetStatistics(static_cast<JobPriority>(i)));
+                }
+                return _Send(connectionId, _MakeResponse(request, protocol::OK), statistics);
+            }
+
+            default:
+                return _Send(connectionId, _MakeResponse(request, protocol::ERROR),
+                             "Unknown wire agent request");
+        }
+    }
+
+    void _Submit(uint64_t connectionId, const protocol::FrameHeader& request,
+                 const shared_ptr<DescriptorGuard>& xmlFile)
+    {
+        if (_connections.find(connectionId) == _connections.end())
+        {
+            // Requester went away before its turn
+            return;
+        }
+
+        CancellationToken cancellation = _cancellation;
+        _Call([this, connectionId, request, xmlFile, cancellation]() -> Completion {
+            string jobId;
+            JobId id;
+            try
+            {
+                if (xmlFile->fd < 0)
+                {
+                    throw runtime_error("XML file descriptor not passed");
+                }
+
+                string xml = protocol::ReadDescriptor(xmlFile->fd);
+                CallOptions options;
+                options.deadline = Deadline::After(REQUEST_DEADLINE);
+                options.cancellation = cancellation;
+                jobId = request.type == protocol::SIGN ? _client.Sign(xml, options)
+                                                       : _client.UploadKdm(xml, options);
+                if (!JobId::TryParse(jobId, id))
+                {
+                    throw runtime_error("Unexpected job id " + jobId + " from Qube Wire");
+                }
+            }
+            catch (const exception& e)
+            {
+                string error = e.what();
+                return [this, connectionId, request, error]() {
+                    _SendOrClose(connectionId, _MakeResponse(request, protocol::ERROR), error);
+                };
+            }
+
+            return [this, connectionId, request, jobId, id]() {
+                _Track(id, GetPriority(request), Clock::now() + _pollInterval);
+                _SendOrClose(connectionId, _MakeResponse(request, protocol::OK), jobId);
+            };
+        });
+    }
+
+    bool _Respond(uint64_t connectionId, const protocol::FrameHeader& request, const string& jobId,
+                  int signedXmlFd)
+    {
+        JobId id;
+        if (!JobId::TryParse(jobId, id))
+        {
+            return _Send(connectionId, _MakeResponse(request, protocol::ERROR), "Invalid job id " + jobId);
+        }
+
+        JobHandle job = _jobTable.Find(id);
+        if (job == INVALID_JOB_HANDLE)
+        {
+            // Not submitted through this agent, start tracking it at the requested priority
+            job = _Track(id, GetPriority(request), Clock::now());
+        }
+
+        try
+        {
+            switch (_jobTable.GetState(job))
+            {
+                case JobState::Pending:
+                    return _Send(connectionId, _MakeResponse(request, protocol::PENDING), "");
+
+                case JobState::Failed:
+                    throw runtime_error(_results[job]);
+
+                case JobState::Signed:
+                    break;
+            }
+
+            const string& signedXml = _results[job];
+            if (signedXmlFd >= 0)
+            {
+                protocol::WriteDescriptor(signedXmlFd, signedXml);
+                return _Send(connectionId, _MakeResponse(request, protocol::SIGNED),
+                             to_string(signedXml.size()));
+            }
+
+            return _Send(connectionId, _MakeResponse(request, protocol::SIGNED), signedXml);
+        }
+        catch (const exception& e)
+        {
+            return _Send(connectionId, _MakeResponse(request, protocol::ERROR), e.what());
+        }
+    }
+
+    // Queues a response and sends what the socket takes right away; the rest is sent once the
+    // socket is writable
+    bool _Send(uint64_t connectionId, const protocol::FrameHeader& response, const string& payload)
+    {
+        map<uint64_t, Connection>::iterator connection = _connections.find(connectionId);
+        if (connection == _connections.end())
+        {
+            return false;
+        }
+
+        try
+        {
+            connection->second.output.push_back(protocol::EncodeFrame(response, payload));
+        }
+        catch (const exception&)
+        {
+            return false;
+        }
+
+        return _Flush(connectionId);
+    }
+
+    bool _Flush(uint64_t connectionId)
+    {
+        Connection& connection = _connections[connectionId];
+        return protocol::SendQueued(connection.socket, connection.output, connection.outputOffset);
+    }
+
+    void _SendOrClose(uint64_t connectionId, const protocol::FrameHeader& response,
+                      const string& payload)
+    {
+        if (!_Send(connectionId, response, payload))
+        {
+            _CloseConnection(connectionId);
+        }
+    }
+
+    void _CloseConnection(uint64_t connectionId)
+    {
+        map<uint64_t, Connection>::iterator connection = _connections.find(connectionId);
+        if (connection != _connections.end())
+        {
+            close(connection->second.socket);
+            _connections.erase(connection);
+        }
+    }
+
+    JobHandle _Track(const JobId& id, JobPriority priority, Clock::time_point firstPoll)
+    {
+        JobHandle job = _jobTable.Find(id);
+        if (job == INVALID_JOB_HANDLE)
+        {
+            job = _jobTable.Add(id, priority);
+        }
+        _jobTable.SetDeadline(job, Clock::now() + _jobTimeout);
+        _jobTable.Schedule(job, firstPoll);
+
+        return job;
+    }
+
+    // Due pending jobs get a poll queued at their priority; completed jobs are due once their
+    // results have been kept long enough
+    void _CollectDueJobs()
+    {
+        Clock::time_point now = Clock::now();
+        _dueJobs.clear();
+        _jobTable.CollectDue(now, _dueJobs);
+
+        for (JobHandle job : _dueJobs)
+        {
+            if (_jobTable.GetState(job) != JobState::Pending)
+            {
+                _results.erase(job);
+                _jobTable.Remove(job);
+            }
+            else if (_jobTable.IsExpired(job, now))
+            {
+                _Complete(job, JobState::Failed,
+                          "Signing job " + _jobTable.GetId(job).ToString() + " exceeded its deadline");
+            }
+            else
+            {
+                // The job is off the wheel till its poll has run, so it is never queued twice
+                JobId id = _jobTable.GetId(job);
+                _scheduler.Enqueue(_jobTable.GetPriority(job), [this, id]() { _PollJob(id); });
+            }
+        }
+    }
+
+    void _PollJob(const JobId& id)
+    {
+        JobHandle job = _jobTable.Find(id);
+        if (job == INVALID_JOB_HANDLE || _jobTable.GetState(job) != JobState::Pending)
+        {
+            return;
+        }
+
+        CancellationToken cancellation = _cancellation;
+        _Call([this, id, cancellation]() -> Completion {
+            shared_ptr<SignedAssetResult> result = make_shared<SignedAssetResult>();
+            try
+            {
+                CallOptions options;
+                options.deadline = Deadline::After(REQUEST_DEADLINE);
+                options.cancellation = cancellation;
+                *result = _client.GetSignedAssetXml(id.ToString(), options);
+            }
+            catch (const exception& e)
+            {
+                string error = e.what();
+                return [this, id, error]() { _OnPolled(id, nullptr, error); };
+            }
+
+            return [this, id, result]() { _OnPolled(id, result.get(), ""); };
+        });
+    }
+
+    // Result is null when the poll failed
+    void _OnPolled(const JobId& id, SignedAssetResult* result, const string& error)
+    {
+        JobHandle job = _jobTable.Find(id);
+        if (job == INVALID_JOB_HANDLE || _jobTable.GetState(job) != JobState::Pending)
+        {
+            return;
+        }
+
+        if (!result)
+        {
+            if (_jobTable.IncrementRetryCount(job) > MAX_POLL_RETRIES)
+            {
+                _Complete(job, JobState::Failed, error);
+                return;
+            }
+        }
+        else if (result->isSigned)
+        {
+            _Complete(job, JobState::Signed, move(result->xml));
+            return;
+        }
+        else
+        {
+            _jobTable.ResetRetryCount(job);
+        }
+
+        _jobTable.Schedule(job, Clock::now() + _pollInterval);
+    }
+
+    // Keeps the signed XML or error of a job for clients to fetch, and removes the job later
+    void _Complete(JobHandle job, JobState state, string result)
+    {
+        _jobTable.SetState(job, state);
+        _results[job] = move(result);
+        _jobTable.Schedule(job, Clock::now() + COMPLETED_JOB_RETENTION);
+    }
+
+    void _CloseAll()
+    {
+        for (const map<uint64_t, Connection>::value_type& connection : _connections)
+        {
+            close(connection.second.socket);
+        }
+        _connections.clear();
+
+        if (_listenSocket >= 0)
+        {
+            close(_listenSocket);
+            _listenSocket = -1;
+        }
+        for (int* fd : {&_stopPipe[0], &_stopPipe[1], &_wakePipe[0], &_wakePipe[1]})
+        {
+            if (*fd >= 0)
+            {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+private:
+    QubeWireClient& _client;
+    string _socketPath;
+    chrono::milliseconds _pollInterval;
+    chrono::seconds _jobTimeout;
+
+    int _listenSocket = -1;
+    int _stopPipe[2] = {-1, -1};
+    map<uint64_t, Connection> _connections;
+    uint64_t _nextConnectionId = 1;
+
+    // Worker making the Qube Wire calls handed to it by the loop, waking the loop through the wake
+    // pipe once a call completes
+    thread _worker;
+    int _wakePipe[2] = {-1, -1};
+    mutex _callMutex;
+    condition_variable _callAvailable;
+    Call _nextCall;
+    deque<Completion> _completions;
+    bool _isWorkerStopping = false;
+    bool _isCalling = false;
+    CancellationToken _cancellation;
+
+    PriorityScheduler _scheduler;
+    JobTable _jobTable;
+    vector<JobHandle> _dueJobs;
+
+    // Signed XML or error message of completed jobs
+    unordered_map<JobHandle, string> _results;
+};
+
+WireAgent::WireAgent(QubeWireClient& client, const string& socketPath)
+{
+    _impl.reset(new Impl(client, socketPath));
+}
+
+WireAgent::~WireAgent()
+{
+}
+
+void WireAgent::SetPollInterval(unsigned milliseconds)
+{
+    _impl->SetPollInterval(milliseconds);
+}
+
+void WireAgent::SetJobTimeout(unsigned seconds)
+{
+    _impl->SetJobTimeout(seconds);
+}
+
+void WireAgent::Run()
+{
+    _impl->Run();
+}
+
+void WireAgent::Stop()
+{
+    _impl->Stop();
+}
@@ -0,0 +1,77 @@
+/**
+ * @file WireAgent.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains WireAgent, a resident process serving signing requests of local clients over a
+ * Unix domain socket through one authenticated Qube Wire session.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <string>
+#include <memory>
+
+QUBE_WIRE_NS_START
+
+class QubeWireClient;
+
+/**
+ * WireAgent accepts Sign, UploadKdm and status requests from local processes (see
+ * WireAgentClient) and serves them through a single authenticated QubeWireClient, so local
+ * tools don't log in or set up connections of their own.
+ * Submitted jobs are polled by the agent in the background; status requests are answered
+ * from the agent's cache. Calls to Qube Wire are made on a worker thread, one at a time, so
+ * clients are served while one is in flight.
+ */
+class WireAgent
+{
+public:
+    /**
+     * Construct WireAgent class object and start listening on the socket.
+     * A stale socket at socketPath is replaced; any other file there is refused.
+     *
+     * @param[in] client Authenticated client used for all requests
+     * @param[in] socketPath Path of the Unix domain socket to listen on
+     */
+    WireAgent(QubeWireClient& client, const std::string& socketPath);
+
+    /**
+     * Destruct WireAgent class object. Closes all connections and removes the socket file.
+     */
+    ~WireAgent();
+
+    /**
+     * Set the interval at which outstanding jobs are polled.
+     *
+     * @param[in] milliseconds Poll interval; default is 2 seconds
+     */
+    void SetPollInterval(unsigned milliseconds);
+
+    /**
+     * Set how long a job may stay unsigned before the agent stops polling it and reports
+     * it failed to clients.
+     *
+     * @param[in] seconds Job timeout; default is 1 hour
+     */
+    void SetJobTimeout(unsigned seconds);
+
+    /**
+     * Serve requests until WireAgent::Stop is called.
+     */
+    void Run();
+
+    /**
+     * Make WireAgent::Run return. Safe to call from another thread or a signal handler.
+     */
+    void Stop();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> _impl;
+};
+
+QUBE_WIRE_NS_STOP
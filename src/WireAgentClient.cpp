@@ -0,0 +1,159 @@
+/**
+ * @file WireAgentClient.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of WireAgentClient class
+ */
+
+#include "WireAgentClient.h"
+#include "WireAgentProtocol.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+namespace protocol = WireAgentProtocol;
+
+WireAgentClient::WireAgentClient(const string& socketPath) : _socket(-1), _nextRequestId(1)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        throw runtime_error("Wire agent socket path " + socketPath + " is too long");
+    }
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    _socket = protocol::CreateSocket();
+    if (_socket < 0 ||
+        connect(_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        if (_socket >= 0)
+        {
+            close(_socket);
+        }
+        throw runtime_error("Connecting to wire agent at " + socketPath + " failed");
+    }
+}
+
+WireAgentClient::~WireAgentClient()
+{
+    close(_socket);
+}
+
+string WireAgentClient::Sign(const string& assetXml, JobPriority priority)
+{
+    int fd = protocol::CreateMemoryFile(assetXml);
+    try
+    {
+        string jobId = SignFile(fd, priority);
+        close(fd);
+        return jobId;
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+}
+
+string WireAgentClient::SignFile(int assetXmlFd, JobPriority priority)
+{
+    uint16_t responseType;
+    return _Request(protocol::SIGN, priority, "", assetXmlFd, responseType);
+}
+
+string WireAgentClient::UploadKdm(const string& kdmXml, JobPriority priority)
+{
+    int fd = protocol::CreateMemoryFile(kdmXml);
+    try
+    {
+        string kdmId = UploadKdmFile(fd, priority);
+        close(fd);
+        return kdmId;
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+}
+
+string WireAgentClient::UploadKdmFile(int kdmXmlFd, JobPriority priority)
+{
+    uint16_t responseType;
+    return _Request(protocol::UPLOAD_KDM, priority, "", kdmXmlFd, responseType);
+}
+
+SignedAssetResult WireAgentClient::GetSignedAssetXml(const string& assetId)
+{
+    uint16_t responseType;
+    SignedAssetResult result;
+    result.xml = _Request(protocol::STATUS, JobPriority::Normal, assetId, -1, responseType);
+    result.isSigned = responseType == protocol::SIGNED;
+
+    return result;
+}
+
+bool WireAgentClient::GetSignedAssetXmlToFile(const string& assetId, int signedXmlFd)
+{
+    uint16_t responseType;
+    _Request(protocol::STATUS, JobPriority::Normal, assetId, signedXmlFd, responseType);
+
+    return responseType == protocol::SIGNED;
+}
+
+PriorityClassStatistics WireAgentClient::GetStatistics(JobPriority priority)
+{
+    uint16_t responseType;
+    string statistics = _Request(protocol::STATISTICS, priority, "", -1, responseType);
+    if (statistics.size() != JOB_PRIORITY_COUNT * protocol::STATISTICS_RECORD_SIZE)
+    {
+        throw runtime_error("Unexpected statistics from wire agent");
+    }
+
+    return protocol::ReadStatistics(statistics, static_cast<unsigned>(priority));
+}
+
+string WireAgentClient::_Request(uint16_t type, JobPriority priority, const string& payload, int fd,
+                                 uint16_t& responseType)
+{
+    protocol::FrameHeader request;
+    memset(&request, 0, sizeof(request));
+    request.type = type;
+    request.flags = static_cast<uint16_t>(priority) & protocol::PRIORITY_FLAGS_MASK;
+    request.requestId = _nextRequestId++;
+    protocol::SendFrame(_socket, request, payload, fd);
+
+    protocol::FrameHeader response;
+    string responsePayload;
+    int responseFd = -1;
+    if (!protocol::ReceiveFrame(_socket, response, responsePayload, responseFd))
+    {
+        throw runtime_error("Wire agent closed the connection");
+    }
+    if (responseFd >= 0)
+    {
+        close(responseFd);
+    }
+
+    if (response.requestId != request.requestId)
+    {
+        throw runtime_error("Unexpected response from wire agent");
+    }
+    if (response.type == protocol::ERROR)
+    {
+        throw runtime_error(responsePayload);
+    }
+
+    responseType = response.type;
+    return responsePayload;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file WireAgentClient.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Contains WireAgentClient, which lets local tools sign through a running WireAgent.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+#include "QubeWireClient.h"
+#include "PriorityScheduler.h"
+
+#include <string>
+
+QUBE_WIRE_NS_START
+
+/**
+ * WireAgentClient sends requests to a WireAgent over its Unix domain socket.
+ * It needs no login of its own; the agent's Qube Wire session is used for all requests.
+ */
+class WireAgentClient
+{
+public:
+    /**
+     * Construct WireAgentClient class object connected to an agent.
+     *
+     * @param[in] socketPath Path of the agent's Unix domain socket
+     */
+    WireAgentClient(const std::string& socketPath);
+
+    /**
+     * Destruct WireAgentClient class object, closing the connection.
+     */
+    ~WireAgentClient();
+
+    /**
+     * Posts an asset XML to be signed by Qube Wire, see QubeWireClient::Sign.
+     *
+     * @param[in] assetXml to be signed
+     * @param[in] priority Priority of the job's submission and polls in the agent
+     *
+     * @returns unique identifier of the signing job
+     */
+    std::string Sign(const std::string& assetXml, JobPriority priority = JobPriority::Normal);
+
+    /**
+     * Posts an asset XML file to be signed by Qube Wire. The agent reads the file
+     * through the descriptor, so the document is not copied through the socket.
+     *
+     * @param[in] assetXmlFd Readable file descriptor of the asset XML
+     * @param[in] priority Priority of the job's submission and polls in the agent
+     *
+     * @returns unique identifier of the signing job
+     */
+    std::string SignFile(int assetXmlFd, JobPriority priority = JobPriority::Normal);
+
+    /**
+     * Uploads unsigned KDM, see QubeWireClient::UploadKdm.
+     *
+     * @param[in] kdmXml KDM to be uploaded and signed
+     * @param[in] priority Priority of the job's submission and polls in the agent
+     *
+     * @returns unique identifier of the KDM
+     */
+    std::string UploadKdm(const std::string& kdmXml, JobPriority priority = JobPriority::Normal);
+
+    /**
+     * Uploads an unsigned KDM file through its descriptor.
+     *
+     * @param[in] kdmXmlFd Readable file descriptor of the KDM
+     * @param[in] priority Priority of the job's submission and polls in the agent
+     *
+     * @returns unique identifier of the KDM
+     */
+    std::string UploadKdmFile(int kdmXmlFd, JobPriority priority = JobPriority::Normal);
+
+    /**
+     * Get status of signing of asset from the agent, see QubeWireClient::GetSignedAssetXml.
+     *
+     * @param[in] assetId Identifier returned by WireAgentClient::Sign
+     *
+     * @returns signing status, holding the signed CPL or PKL once signed
+     */
+    SignedAssetResult GetSignedAssetXml(const std::string& assetId);
+
+    /**
+     * Get status of signing of asset, writing the signed asset into a file once available.
+     *
+     * @param[in] assetId Identifier returned by WireAgentClient::Sign
+     * @param[in] signedXmlFd Writable file descriptor the signed asset is written to
+     *
+     * @returns true if the asset XML is signed and written, else false
+     */
+    bool GetSignedAssetXmlToFile(const std::string& assetId, int signedXmlFd);
+
+    /**
+     * Get queue depth and wait times of the agent's work queue.
+     *
+     * @param[in] priority Priority class
+     *
+     * @returns statistics of the priority class
+     */
+    PriorityClassStatistics GetStatistics(JobPriority priority);
+
+private:
+    WireAgentClient(const WireAgentClient&);
+    WireAgentClient& operator=(const WireAgentClient&);
+
+    std::string _Request(uint16_t type, JobPriority priority, const std::string& payload, int fd,
+                         uint16_t& responseType);
+
+    int _socket;
+    uint32_t _nextRequestId;
+};
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,464 @@
+/**
+ * @file WireAgentProtocol.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Implementation of WireAgent message framing
+ */
+
+#include "WireAgentProtocol.h"
+#include "PriorityScheduler.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+// Linux tells sends not to raise SIGPIPE, and receives to close passed descriptors on exec, by
+// flags; elsewhere sockets get SO_NOSIGPIPE, and passed descriptors FD_CLOEXEC once received
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+#ifdef MSG_CMSG_CLOEXEC
+const int RECEIVE_FLAGS = MSG_CMSG_CLOEXEC;
+#else
+const int RECEIVE_FLAGS = 0;
+#endif
+
+namespace
+{
+    // Closes the socket on exec, as platforms without SOCK_CLOEXEC can't create it so, and keeps
+    // it from raising SIGPIPE where sends can't be told not to
+    int PrepareSocket(int socket)
+    {
+        if (socket < 0)
+        {
+            return socket;
+        }
+
+        bool isPrepared = fcntl(socket, F_SETFD, FD_CLOEXEC) == 0;
+#ifdef SO_NOSIGPIPE
+        int isEnabled = 1;
+        isPrepared = isPrepared &&
+                     setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &isEnabled, sizeof(isEnabled)) == 0;
+#endif
+        if (!isPrepared)
+        {
+            int error = errno;
+            close(socket);
+            errno = error;
+            return -1;
+        }
+
+        return socket;
+    }
+}
+
+int WireAgentProtocol::CreateSocket()
+{
+#ifdef SOCK_CLOEXEC
+    return PrepareSocket(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+#else
+    return PrepareSocket(socket(AF_UNIX, SOCK_STREAM, 0));
+#endif
+}
+
+int WireAgentProtocol::AcceptConnection(int listenSocket)
+{
+#ifdef __linux__
+    return PrepareSocket(accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC));
+#else
+    return PrepareSocket(accept(listenSocket, nullptr, nullptr));
+#endif
+}
+
+bool WireAgentProtocol::GetPeerUser(int socket, uid_t& uid)
+{
+#ifdef SO_PEERCRED
+    ucred credentials;
+    socklen_t credentialsSize = sizeof(credentials);
+    if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsSize) != 0)
+    {
+        return false;
+    }
+    uid = credentials.uid;
+    return true;
+#else
+    gid_t gid;
+    return getpeereid(socket, &uid, &gid) == 0;
+#endif
+}
+
+void WireAgentProtocol::SendFrame(int socket, FrameHeader header, const string& payload, int fd)
+{
+    if (payload.size() > MAX_PAYLOAD_SIZE)
+    {
+        throw runtime_error("Wire agent message is too large");
+    }
+    header.magic = MAGIC;
+    header.payloadSize = static_cast<uint32_t>(payload.size());
+
+    // Header and payload go out in a single sendmsg so a frame costs one system call
+    iovec parts[2];
+    parts[0].iov_base = &header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = const_cast<char*>(payload.data());
+    parts[1].iov_len = payload.size();
+
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = payload.empty() ? 1 : 2;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0)
+    {
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsghdr* controlMessage = CMSG_FIRSTHDR(&message);
+        controlMessage->cmsg_level = SOL_SOCKET;
+        controlMessage->cmsg_type = SCM_RIGHTS;
+        controlMessage->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(controlMessage), &fd, sizeof(int));
+    }
+
+    size_t remaining = sizeof(header) + payload.size();
+    while (remaining > 0)
+    {
+        ssize_t bytesSent = sendmsg(socket, &message, SEND_FLAGS);
+        if (bytesSent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesSent < 0)
+        {
+            throw runtime_error("Writing to wire agent connection failed");
+        }
+        remaining -= static_cast<size_t>(bytesSent);
+
+        // The descriptor went with the first part; skip what was sent and resend the rest
+        message.msg_control = nullptr;
+        message.msg_controllen = 0;
+        while (message.msg_iovlen > 0 && static_cast<size_t>(bytesSent) >= message.msg_iov->iov_len)
+        {
+            bytesSent -= static_cast<ssize_t>(message.msg_iov->iov_len);
+            ++message.msg_iov;
+            --message.msg_iovlen;
+        }
+        if (message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + bytesSent;
+            message.msg_iov->iov_len -= static_cast<size_t>(bytesSent);
+        }
+    }
+}
+
+string WireAgentProtocol::EncodeFrame(FrameHeader header, const string& payload)
+{
+    if (payload.size() > MAX_PAYLOAD_SIZE)
+    {
+        throw runtime_error("Wire agent message is too large");
+    }
+    header.magic = MAGIC;
+    header.payloadSize = static_cast<uint32_t>(payload.size());
+
+    string frame;
+    frame.reserve(sizeof(header) + payload.size());
+    frame.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    frame.append(payload);
+
+    return frame;
+}
+
+bool WireAgentProtocol::SendQueued(int socket, deque<string>& frames, size_t& offset)
+{
+    while (!frames.empty())
+    {
+        const string& frame = frames.front();
+        ssize_t bytesSent = send(socket, frame.data() + offset, frame.size() - offset, SEND_FLAGS);
+        if (bytesSent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesSent < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        offset += static_cast<size_t>(bytesSent);
+        if (offset == frame.size())
+        {
+            frames.pop_front();
+            offset = 0;
+        }
+    }
+
+    return true;
+}
+
+void WireAgentProtocol::AppendStatistics(string& payload, const PriorityClassStatistics& statistics)
+{
+    // Field by field, so the record has neither the struct's padding nor its layout
+    payload.append(reinterpret_cast<const char*>(&statistics.queueDepth), sizeof(statistics.queueDepth));
+    payload.append(reinterpret_cast<const char*>(&statistics.completedCount),
+                   sizeof(statistics.completedCount));
+    payload.append(reinterpret_cast<const char*>(&statistics.averageWaitMilliseconds),
+                   sizeof(statistics.averageWaitMilliseconds));
+    payload.append(reinterpret_cast<const char*>(&statistics.maxWaitMilliseconds),
+                   sizeof(statistics.maxWaitMilliseconds));
+}
+
+PriorityClassStatistics WireAgentProtocol::ReadStatistics(const string& payload, size_t index)
+{
+    if (payload.size() < (index + 1) * STATISTICS_RECORD_SIZE)
+    {
+        throw runtime_error("Wire agent statistics are truncated");
+    }
+
+    const char* record = payload.data() + index * STATISTICS_RECORD_SIZE;
+    PriorityClassStatistics statistics;
+    memcpy(&statistics.queueDepth, record, sizeof(statistics.queueDepth));
+    record += sizeof(statistics.queueDepth);
+    memcpy(&statistics.completedCount, record, sizeof(statistics.completedCount));
+    record += sizeof(statistics.completedCount);
+    memcpy(&statistics.averageWaitMilliseconds, record, sizeof(statistics.averageWaitMilliseconds));
+    record += sizeof(statistics.averageWaitMilliseconds);
+    memcpy(&statistics.maxWaitMilliseconds, record, sizeof(statistics.maxWaitMilliseconds));
+
+    return statistics;
+}
+
+WireAgentProtocol::FrameReceiver::FrameReceiver() : _headerSize(0), _payloadSize(0), _fd(-1)
+{
+    memset(&_header, 0, sizeof(_header));
+}
+
+WireAgentProtocol::FrameReceiver::~FrameReceiver()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+bool WireAgentProtocol::FrameReceiver::Receive(int socket)
+{
+    iovec part;
+    if (_headerSize < sizeof(_header))
+    {
+        part.iov_base = reinterpret_cast<char*>(&_header) + _headerSize;
+        part.iov_len = sizeof(_header) - _headerSize;
+    }
+    else
+    {
+        part.iov_base = &_payload[_payloadSize];
+        part.iov_len = _payload.size() - _payloadSize;
+    }
+
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t bytesRead;
+    do
+    {
+        bytesRead = recvmsg(socket, &message, RECEIVE_FLAGS);
+    } while (bytesRead < 0 && errno == EINTR);
+
+    if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return true;
+    }
+
+    for (cmsghdr* controlMessage = CMSG_FIRSTHDR(&message); controlMessage;
+         controlMessage = CMSG_NXTHDR(&message, controlMessage))
+    {
+        if (controlMessage->cmsg_level == SOL_SOCKET && controlMessage->cmsg_type == SCM_RIGHTS)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(controlMessage), sizeof(int));
+            if (RECEIVE_FLAGS == 0)
+            {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+            }
+            if (_fd >= 0)
+            {
+                close(_fd);
+            }
+            _fd = fd;
+        }
+    }
+
+    if (bytesRead == 0 && _headerSize == 0)
+    {
+        return false;
+    }
+    if (bytesRead <= 0)
+    {
+        throw runtime_error("Reading from wire agent connection failed");
+    }
+
+    if (_headerSize < sizeof(_header))
+    {
+        _headerSize += static_cast<size_t>(bytesRead);
+        if (_headerSize == sizeof(_header))
+        {
+            if (_header.magic != MAGIC || _header.payloadSize > MAX_PAYLOAD_SIZE)
+            {
+                throw runtime_error("Invalid wire agent message");
+            }
+            _payload.resize(_header.payloadSize);
+        }
+    }
+    else
+    {
+        _payloadSize += static_cast<size_t>(bytesRead);
+    }
+
+    return true;
+}
+
+bool WireAgentProtocol::FrameReceiver::TakeFrame(FrameHeader& header, string& payload, int& fd)
+{
+    if (_headerSize < sizeof(_header) || _payloadSize < _payload.size())
+    {
+        return false;
+    }
+
+    header = _header;
+    payload.swap(_payload);
+    fd = _fd;
+
+    _headerSize = 0;
+    _payload.clear();
+    _payloadSize = 0;
+    _fd = -1;
+
+    return true;
+}
+
+bool WireAgentProtocol::ReceiveFrame(int socket, FrameHeader& header, string& payload, int& fd)
+{
+    FrameReceiver receiver;
+    while (!receiver.TakeFrame(header, payload, fd))
+    {
+        if (!receiver.Receive(socket))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+string WireAgentProtocol::ReadDescriptor(int fd)
+{
+    struct stat fileStatus;
+    if (fstat(fd, &fileStatus) != 0)
+    {
+        throw runtime_error("Reading passed file descriptor failed");
+    }
+    // Its size is trusted for the allocation, so a pipe or device, or an oversized file, is refused
+    if (!S_ISREG(fileStatus.st_mode))
+    {
+        throw runtime_error("Passed file descriptor is not a regular file");
+    }
+    if (fileStatus.st_size > static_cast<off_t>(MAX_DOCUMENT_SIZE))
+    {
+        throw runtime_error("Passed file is too large");
+    }
+
+    string content(static_cast<size_t>(fileStatus.st_size), '\0');
+    size_t offset = 0;
+    while (offset < content.size())
+    {
+        ssize_t bytesRead = pread(fd, &content[offset], content.size() - offset,
+                                  static_cast<off_t>(offset));
+        if (bytesRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            throw runtime_error("Reading passed file descriptor failed");
+        }
+        offset += static_cast<size_t>(bytesRead);
+    }
+
+    return content;
+}
+
+void WireAgentProtocol::WriteDescriptor(int fd, const string& content)
+{
+    if (ftruncate(fd, 0) != 0)
+    {
+        throw runtime_error("Writing passed file descriptor failed");
+    }
+
+    size_t offset = 0;
+    while (offset < content.size())
+    {
+        ssize_t bytesWritten = pwrite(fd, content.data() + offset, content.size() - offset,
+                                      static_cast<off_t>(offset));
+        if (bytesWritten < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesWritten <= 0)
+        {
+            throw runtime_error("Writing passed file descriptor failed");
+        }
+        offset += static_cast<size_t>(bytesWritten);
+    }
+}
+
+int WireAgentProtocol::CreateMemoryFile(const string& content)
+{
+#ifdef MFD_CLOEXEC
+    int fd = memfd_create("qubewire", MFD_CLOEXEC);
+#else
+    // No memfd on this platform, use an unlinked temporary file instead
+    FILE* file = tmpfile();
+    int fd = file ? dup(fileno(file)) : -1;
+    if (file)
+    {
+        fclose(file);
+    }
+#endif
+    if (fd < 0)
+    {
+        throw runtime_error("Creating memory file failed");
+    }
+
+    try
+    {
+        WriteDescriptor(fd, content);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+
+    return fd;
+}
@@ -0,0 +1,243 @@
+/**
+ * @file WireAgentProtocol.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Framing of messages exchanged between WireAgent and WireAgentClient over a Unix domain socket.
+ *
+ * Every message is a fixed size header followed by payloadSize bytes of payload. Large XML
+ * bodies are not copied through the socket: the sender attaches a file descriptor to the header
+ * (SCM_RIGHTS) and the receiver reads or writes the document through it.
+ *
+ * Requests:
+ *  - Sign, UploadKdm: descriptor of the XML to be submitted attached, no payload.
+ *    Answered with Ok and the job id as payload.
+ *  - Status: job id as payload, optionally a descriptor to write the signed XML into.
+ *    Answered with Pending, or Signed with the signed XML written to the descriptor (payload
+ *    holds its size) or carried as payload when no descriptor was attached.
+ *  - Statistics: no payload. Answered with Ok and a STATISTICS_RECORD_SIZE byte record per
+ *    priority class, in JobPriority order, as payload. A record holds the fields of
+ *    PriorityClassStatistics packed without padding: queueDepth (uint32), completedCount
+ *    (uint64), averageWaitMilliseconds and maxWaitMilliseconds (IEEE 754 doubles).
+ * Header and payload fields are in the byte order of the host, as both ends run on it.
+ * The flags of Sign, UploadKdm and Status requests carry the JobPriority of the job.
+ * Any request may be answered with Error and the error message as payload.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <sys/types.h>
+
+#include <deque>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+QUBE_WIRE_NS_START
+
+struct PriorityClassStatistics;
+
+namespace WireAgentProtocol
+{
+    const uint32_t MAGIC = 0x31415751; // "QWA1"
+    const uint32_t MAX_PAYLOAD_SIZE = 64 * 1024 * 1024;
+    const uint32_t MAX_DOCUMENT_SIZE = 64 * 1024 * 1024;
+    const size_t STATISTICS_RECORD_SIZE = sizeof(uint32_t) + sizeof(uint64_t) + 2 * sizeof(double);
+
+    enum MessageType : uint16_t
+    {
+        // Requests
+        SIGN = 1,
+        UPLOAD_KDM = 2,
+        STATUS = 3,
+        STATISTICS = 4,
+
+        // Responses
+        OK = 100,
+        PENDING = 101,
+        SIGNED = 102,
+        ERROR = 103
+    };
+
+    const uint16_t PRIORITY_FLAGS_MASK = 0x3;
+
+    struct FrameHeader
+    {
+        uint32_t magic;
+        uint16_t type;
+        uint16_t flags;
+        uint32_t requestId;
+        uint32_t payloadSize;
+    };
+
+    /**
+     * Create a Unix domain stream socket. The socket is closed on exec and never raises SIGPIPE,
+     * on platforms without SOCK_CLOEXEC and MSG_NOSIGNAL too.
+     *
+     * @returns socket owned by the caller, or -1 with errno set
+     */
+    int CreateSocket();
+
+    /**
+     * Accept a connection, set up as the sockets of WireAgentProtocol::CreateSocket.
+     *
+     * @param[in] listenSocket Listening Unix domain socket
+     *
+     * @returns connected socket owned by the caller, or -1 with errno set
+     */
+    int AcceptConnection(int listenSocket);
+
+    /**
+     * Get the effective user id of the process at the other end of a connection.
+     *
+     * @param[in] socket Connected Unix domain socket
+     * @param[out] uid User id of the peer
+     *
+     * @returns false if it can't be told
+     */
+    bool GetPeerUser(int socket, uid_t& uid);
+
+    /**
+     * Send a message, optionally attaching a file descriptor.
+     *
+     * @param[in] socket Connected Unix domain socket
+     * @param[in] header Header of the message; magic and payloadSize are filled in
+     * @param[in] payload Payload of the message
+     * @param[in] fd Descriptor to attach, or -1 for none
+     */
+    void SendFrame(int socket, FrameHeader header, const std::string& payload, int fd = -1);
+
+    /**
+     * Encode a message without attached descriptor, to be sent with WireAgentProtocol::SendQueued.
+     *
+     * @param[in] header Header of the message; magic and payloadSize are filled in
+     * @param[in] payload Payload of the message
+     *
+     * @returns header and payload of the message
+     */
+    std::string EncodeFrame(FrameHeader header, const std::string& payload);
+
+    /**
+     * Send queued messages on a non-blocking socket till they are sent or the socket is full.
+     *
+     * @param[in] socket Connected non-blocking Unix domain socket
+     * @param[in,out] frames Messages encoded by WireAgentProtocol::EncodeFrame; sent ones are removed
+     * @param[in,out] offset Bytes of the first message already sent
+     *
+     * @returns false if the connection failed
+     */
+    bool SendQueued(int socket, std::deque<std::string>& frames, size_t& offset);
+
+    /**
+     * FrameReceiver assembles the messages of one connection from whatever its socket has to
+     * give, so a peer sending a message piecemeal doesn't stall the receiver. Each read asks for
+     * no more than the rest of the current message, so an attached descriptor always belongs to it.
+     */
+    class FrameReceiver
+    {
+    public:
+        /**
+         * Construct FrameReceiver class object, expecting the start of a message.
+         */
+        FrameReceiver();
+
+        /**
+         * Destruct FrameReceiver class object, closing a descriptor that wasn't taken.
+         */
+        ~FrameReceiver();
+
+        /**
+         * Read the part of the current message available on the socket with a single read, so
+         * this doesn't block when called once the socket is readable. On a non-blocking socket,
+         * finding nothing to read is not an error.
+         *
+         * @param[in] socket Connected Unix domain socket
+         *
+         * @returns false if the peer closed the connection before a message started
+         */
+        bool Receive(int socket);
+
+        /**
+         * Take the current message once it is complete, and expect the next one.
+         *
+         * @param[out] header Header of the message
+         * @param[out] payload Payload of the message
+         * @param[out] fd Attached descriptor owned by the caller, or -1 if none was attached
+         *
+         * @returns false if the message isn't complete yet
+         */
+        bool TakeFrame(FrameHeader& header, std::string& payload, int& fd);
+
+    private:
+        FrameReceiver(const FrameReceiver&);
+        FrameReceiver& operator=(const FrameReceiver&);
+
+        FrameHeader _header;
+        size_t _headerSize;
+        std::string _payload;
+        size_t _payloadSize;
+        int _fd;
+    };
+
+    /**
+     * Receive a message along with an attached file descriptor, if any, blocking till it is
+     * complete.
+     *
+     * @param[in] socket Connected Unix domain socket
+     * @param[out] header Header of the message
+     * @param[out] payload Payload of the message
+     * @param[out] fd Attached descriptor owned by the caller, or -1 if none was attached
+     *
+     * @returns false if the peer closed the connection before a message started
+     */
+    bool ReceiveFrame(int socket, FrameHeader& header, std::string& payload, int& fd);
+
+    /**
+     * Append the statistics record of a priority class to a payload.
+     *
+     * @param[in,out] payload Payload of a Statistics response
+     * @param[in] statistics Statistics of the class
+     */
+    void AppendStatistics(std::string& payload, const PriorityClassStatistics& statistics);
+
+    /**
+     * Read the statistics record of a priority class from a payload.
+     *
+     * @param[in] payload Payload of a Statistics response
+     * @param[in] index Index of the record, which is the JobPriority of the class
+     *
+     * @returns statistics of the class
+     */
+    PriorityClassStatistics ReadStatistics(const std::string& payload, size_t index);
+
+    /**
+     * Read the whole content of a file descriptor from its start.
+     *
+     * @param[in] fd File descriptor of a regular or memory file of up to MAX_DOCUMENT_SIZE bytes
+     *
+     * @returns content of the file
+     */
+    std::string ReadDescriptor(int fd);
+
+    /**
+     * Replace the content of a file descriptor.
+     *
+     * @param[in] fd File descriptor of a regular or memory file
+     * @param[in] content Content to be written from its start
+     */
+    void WriteDescriptor(int fd, const std::string& content);
+
+    /**
+     * Create an anonymous in-memory file holding the given content.
+     *
+     * @param[in] content Content of the file
+     *
+     * @returns descriptor of the file, owned by the caller
+     */
+    int CreateMemoryFile(const std::string& content);
+}
+
+QUBE_WIRE_NS_STOP
@@ -0,0 +1,76 @@
+/**
+ * @file XmlHelpers.h
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Helpers to read DCP XML documents (CPL, PKL) parsed into a property tree.
+ */
+
+#pragma once
+
+#include "NamespaceMacros.h"
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <string>
+
+QUBE_WIRE_NS_START
+
+const std::string UUID_URN_PREFIX = "urn:uuid:";
+
+/**
+ * Find a child element by its local name, regardless of the namespace prefix of the document.
+ *
+ * @param[in] parent Parent element
+ * @param[in] localName Name of the child element without namespace prefix
+ *
+ * @returns first matching child element, or null if there is none
+ */
+inline const boost::property_tree::ptree* FindXmlElement(const boost::property_tree::ptree& parent,
+                                                         const std::string& localName)
+{
+    for (const boost::property_tree::ptree::value_type& child : parent)
+    {
+        const std::string& name = child.first;
+        size_t prefixEnd = name.find(':');
+        if (name.compare(prefixEnd == std::string::npos ? 0 : prefixEnd + 1, std::string::npos,
+                         localName) == 0)
+        {
+            return &child.second;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Get text of a child element by its local name.
+ *
+ * @param[in] parent Parent element
+ * @param[in] localName Name of the child element without namespace prefix
+ *
+ * @returns text of the child element, or empty if there is no such element
+ */
+inline std::string GetXmlElementText(const boost::property_tree::ptree& parent,
+                                     const std::string& localName)
+{
+    const boost::property_tree::ptree* element = FindXmlElement(parent, localName);
+    return element ? element->data() : "";
+}
+
+/**
+ * Remove the "urn:uuid:" prefix of a DCP identifier.
+ *
+ * @param[in] id Identifier as written in a CPL or PKL
+ *
+ * @returns bare UUID
+ */
+inline std::string StripUuidUrn(const std::string& id)
+{
+    return boost::algorithm::istarts_with(id, UUID_URN_PREFIX) ? id.substr(UUID_URN_PREFIX.size())
+                                                               : id;
+}
+
+QUBE_WIRE_NS_STOP
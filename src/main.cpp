@@ -1,23 +1,76 @@
 #include "QubeWireClient.h"
+#include "Tracer.h"
+#include "Logger.h"
+#include "MemoryBudget.h"
+#include "PklBuilder.h"
+#include "SigningPipeline.h"
+#include "SharedWorkQueue.h"
+#include "SignedAssetArchive.h"
+#include "FileHelpers.h"
+#ifndef WIN32
+#include "WireAgent.h"
+#endif
 
+#include <algorithm>
 #include <memory>
 #include <iostream>
 #include <chrono>
 #include <thread>
 #include <fstream>
 #include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <cctype>
+#include <limits>
+#include <vector>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/filesystem/path.hpp>
 
 using namespace QUBE_WIRE_NS;
 using namespace std;
 
+// Signing jobs not completed by Qube Wire within this time are given up on
+const chrono::hours JOB_TIMEOUT(1);
+
+SharedWorkQueue* runningQueue = nullptr;
+
+void StopQueue(int)
+{
+    if (runningQueue)
+        runningQueue->Stop();
+}
+
+#ifndef WIN32
+Logger* runningLogger = nullptr;
+
+// Switches logging between debug and info, to look into a long running agent or queue
+void ToggleDebugLogging(int)
+{
+    if (runningLogger)
+        runningLogger->SetLevel(runningLogger->GetLevel() == LogLevel::Debug ? LogLevel::Info
+                                                                             : LogLevel::Debug);
+}
+
+WireAgent* runningAgent = nullptr;
+
+void StopAgent(int)
+{
+    if (runningAgent)
+        runningAgent->Stop();
+}
+#endif
+
 void ShowActionMenu()
 {
     cout << endl;
     cout << "1. Sign PKL/CPL." << endl;
     cout << "2. Upload DKDM." << endl;
-    cout << "3. Quit." << endl << endl;
+    cout << "3. Quit." << endl;
+    cout << "4. Sign DCP package (CPLs and PKL)." << endl;
+    cout << "5. Get signed PKL/CPL from archive." << endl << endl;
     cout << "Please select an action? ";
 }
 
@@ -33,49 +86,196 @@ void LaunchCommand(string url)
     system(launchCmd.c_str());
 }
 
-string GetFileContents(const string& filePath)
+// Reads a comma separated list of URLs from an environment variable; empty when it isn't set,
+// which leaves the client on its default host
+vector<string> GetUrlList(const char* variableName)
 {
-    ifstream fileStream(filePath.c_str());
-    if (!fileStream.is_open())
-        throw runtime_error("Opening file " + filePath + " for reading failed");
+    vector<string> urls;
+    const char* value = getenv(variableName);
+    if (!value || !*value)
+        return urls;
+
+    boost::split(urls, value, boost::is_any_of(","), boost::token_compress_on);
+    urls.erase(remove(urls.begin(), urls.end(), ""), urls.end());
+    return urls;
+}
+
+// Reads a size in MB from an environment variable's value, rejecting anything but a positive number
+size_t GetMegabytes(const char* variableName, const char* value)
+{
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long megabytes = strtoull(value, &end, 10);
+    if (!isdigit(static_cast<unsigned char>(value[0])) || *end != '\0' || errno == ERANGE ||
+        megabytes == 0 || megabytes > numeric_limits<size_t>::max() / (1024 * 1024))
+        throw runtime_error(string("Invalid ") + variableName + " " + value + ", expected a size in MB");
 
-    string content((istreambuf_iterator<char>(fileStream)), (istreambuf_iterator<char>()));
-    return content;
+    return static_cast<size_t>(megabytes) * 1024 * 1024;
 }
 
 void WriteToFile(const string& filePath, const string& content)
 {
-    ofstream fileStream(filePath.c_str());
+    // Binary, so that the bytes on disk are the ones hashed into the PKL on every platform
+    ofstream fileStream(filePath.c_str(), ios::binary);
     if (!fileStream.is_open())
         throw runtime_error("Opening file " + filePath + " for writing failed");
 
     fileStream << content;
 }
 
+// The signed file written is the record of the job, so a failure to archive it only warns
+void ArchiveSignedAsset(SignedAssetArchive* archive, const string& id, const string& jobId,
+                        const string& signedXml)
+{
+    if (!archive)
+        return;
+
+    try
+    {
+        archive->Add(id.empty() ? SignedAssetArchive::GetAssetId(signedXml) : id, jobId, signedXml);
+    }
+    catch (const exception& e)
+    {
+        cout << "Archiving signed document failed: " << e.what() << endl;
+    }
+}
+
 int main (int argc, char *argv[])
 {
     unique_ptr<QubeWireClient> qubeWireClient;
     try
     {
-        if (argc != 2)
-            throw runtime_error("Usage: QubeWireClient <Client ID>");
+        bool isAgent = argc == 4 && string(argv[2]) == "--agent";
+        bool isQueue = argc == 4 && string(argv[2]) == "--queue";
+        if (argc != 2 && !isAgent && !isQueue)
+            throw runtime_error("Usage: QubeWireClient <Client ID> [--agent <Socket path> | --queue <Queue directory>]");
 
         qubeWireClient.reset(new QubeWireClient(argv[1]));
 
+        // Spans of every operation are written as a Chrome trace when this is set
+        shared_ptr<Tracer> tracer;
+        const char* traceFilePath = getenv("QUBEWIRE_TRACE_FILE");
+        if (traceFilePath)
+        {
+            tracer = make_shared<Tracer>(traceFilePath);
+            qubeWireClient->SetTracer(tracer);
+        }
+
+        // Requests and jobs are logged as JSON lines when this is set
+        shared_ptr<Logger> logger;
+        const char* logFilePath = getenv("QUBEWIRE_LOG_FILE");
+        if (logFilePath)
+        {
+            const char* logLevel = getenv("QUBEWIRE_LOG_LEVEL");
+            logger = make_shared<Logger>(logFilePath,
+                                         logLevel ? Logger::ParseLevel(logLevel) : LogLevel::Info);
+            qubeWireClient->SetLogger(logger);
+#ifndef WIN32
+            runningLogger = logger.get();
+            signal(SIGUSR1, ToggleDebugLogging);
+#endif
+        }
+
+        // Bounds the memory held by documents being uploaded, for batches on small machines
+        const char* memoryBudget = getenv("QUBEWIRE_MEMORY_BUDGET_MB");
+        if (memoryBudget && *memoryBudget)
+        {
+            qubeWireClient->SetMemoryBudget(
+                make_shared<MemoryBudget>(GetMegabytes("QUBEWIRE_MEMORY_BUDGET_MB", memoryBudget)));
+        }
+
+        // Signed CPLs/PKLs are kept locally, to be served again without Qube Wire, when this is set
+        shared_ptr<SignedAssetArchive> archive;
+        const char* archiveFilePath = getenv("QUBEWIRE_ARCHIVE_FILE");
+        if (archiveFilePath && *archiveFilePath)
+        {
+            archive = make_shared<SignedAssetArchive>(archiveFilePath);
+        }
+
+        // Regional hosts, a staging stack or a local stand-in can be given as ordered lists
+        qubeWireClient->SetEndpoints(GetUrlList("QUBEWIRE_URL"), GetUrlList("QUBEACCOUNT_URL"));
+
         LaunchCommand(qubeWireClient->GetLoginUrl());
         cout << "Qube Wire sign-in page opened in web browser. Please sign-in to proceed." << endl;
+        qubeWireClient->Prewarm();
+
+        // Login session started by GetLoginUrl is valid only for 15 minutes
+        CallOptions signInOptions;
+        signInOptions.deadline = Deadline::After(chrono::minutes(15));
 
         cout << "Waiting for user to sign-in..." << std::flush;
-        while (!qubeWireClient->IsAuthenticated())
+        while (!qubeWireClient->IsAuthenticated(signInOptions))
         {
-
+            if (signInOptions.deadline.IsExpired())
+            {
+                throw DeadlineExceededError("Sign-in session expired");
+            }
             this_thread::sleep_for(chrono::seconds(2)); // Waiting for 2 seconds to poll again
         }
         cout << endl;
 
-        string email, companyName;
-        qubeWireClient->GetUserInfo(email, companyName);
-        cout << "Successfully signed in as " << email << " (" << companyName << ")" << endl;
+        qubeWireClient->Bootstrap();
+        UserInfo userInfo = qubeWireClient->GetUserInfo();
+        cout << "Successfully signed in as " << userInfo.emailId << " (" << userInfo.companyName
+             << ")" << endl;
+
+        if (isQueue)
+        {
+            // Several nodes on one host need distinct ids
+            const char* nodeId = getenv("QUBEWIRE_NODE_ID");
+            SharedWorkQueue queue(*qubeWireClient, argv[3],
+                                  nodeId && *nodeId ? nodeId : SharedWorkQueue::GetDefaultNodeId());
+            queue.SetSignatureVerification(true);
+            queue.SetSignedAssetArchive(archive);
+            runningQueue = &queue;
+            signal(SIGINT, StopQueue);
+            signal(SIGTERM, StopQueue);
+
+            cout << "Signing documents queued in " << argv[3] << endl;
+            queue.Run();
+            runningQueue = nullptr;
+
+            qubeWireClient->ResetToken();
+            return 0;
+        }
+
+        if (isAgent)
+        {
+#ifndef WIN32
+            // Serve local tools through this session till interrupted
+            WireAgent agent(*qubeWireClient, argv[3]);
+            runningAgent = &agent;
+            signal(SIGINT, StopAgent);
+            signal(SIGTERM, StopAgent);
+
+            cout << "Wire agent listening on " << argv[3] << endl;
+            agent.Run();
+            runningAgent = nullptr;
+
+            qubeWireClient->ResetToken();
+            return 0;
+#else
+            throw runtime_error("Wire agent is not supported on this platform");
+#endif
+        }
+
+        // Uploads of large documents show how far along they are and how fast the link is
+        bool isUploading = false;
+        qubeWireClient->SetProgressCallback([isUploading](const TransferProgress& progress) mutable {
+            if (progress.phase == TransferPhase::Uploading)
+            {
+                isUploading = true;
+                cout << "\rUploaded " << progress.bytesSent / 1024 << " of "
+                     << progress.bytesToSend / 1024 << " KB at "
+                     << static_cast<uint64_t>(progress.smoothedBytesPerSecond / 1024) << " KB/s   "
+                     << std::flush;
+            }
+            else if (isUploading)
+            {
+                isUploading = false;
+                cout << endl;
+            }
+        }, 500);
 
         while (true)
         {
@@ -91,21 +291,37 @@ int main (int argc, char *argv[])
                     string filePath;
                     cin >> filePath;
 
-                    string unsignedXml = GetFileContents(filePath);
+                    CallOptions jobOptions;
+                    jobOptions.deadline = Deadline::After(JOB_TIMEOUT);
+
+                    // With a memory budget, the CPL/PKL is read into its slabs and sent from them
+                    shared_ptr<MemoryBudget> budget = qubeWireClient->GetMemoryBudget();
+                    TraceSpan jobSpan(tracer.get(), "job", "Sign PKL/CPL");
+                    TraceSpan readSpan(tracer.get(), "file", "read");
+                    BodyBuffer bufferedXml;
+                    string unsignedXml;
+                    if (budget)
+                        bufferedXml = GetFileContents(filePath, *budget, jobOptions);
+                    else
+                        unsignedXml = GetFileContents(filePath);
+                    readSpan.End();
 
                     cout << "Uploading CPL/PKL to Qube Wire for signing..." << endl;
-                    string xmlId = qubeWireClient->Sign(unsignedXml);
+                    string xmlId = budget ? qubeWireClient->Sign(move(bufferedXml), jobOptions)
+                                          : qubeWireClient->Sign(unsignedXml, jobOptions);
+                    jobSpan.Tag("job", xmlId);
 
                     cout << "Waiting for Qube Wire to sign the CPL/PKL..." << std::flush;
-                    string signedXml;
-                    while (!qubeWireClient->GetSignedAssetXml(xmlId, signedXml))
-                    {
-                        this_thread::sleep_for(chrono::seconds(2));
-                    }
+                    string signedXml = qubeWireClient->WaitForSignedAssetXml(xmlId, jobOptions);
                     cout << endl;
 
                     string signedFilePath = boost::ireplace_all_copy(filePath, ".xml", ".signed.xml");
+                    TraceSpan writeSpan(tracer.get(), "file", "write");
+                    writeSpan.Tag("job", xmlId);
                     WriteToFile(signedFilePath, signedXml);
+                    writeSpan.End();
+                    ArchiveSignedAsset(archive.get(), "", xmlId, signedXml);
+                    jobSpan.End();
 
                     cout << "CPL/PKL successfully signed and available here " << signedFilePath << endl;
                     break;
@@ -117,19 +333,31 @@ int main (int argc, char *argv[])
                     string filePath;
                     cin >> filePath;
 
-                    string xml = GetFileContents(filePath);
+                    CallOptions jobOptions;
+                    jobOptions.deadline = Deadline::After(JOB_TIMEOUT);
+
+                    shared_ptr<MemoryBudget> budget = qubeWireClient->GetMemoryBudget();
+                    TraceSpan jobSpan(tracer.get(), "job", "Upload DKDM");
+                    TraceSpan readSpan(tracer.get(), "file", "read");
+                    BodyBuffer bufferedXml;
+                    string xml;
+                    if (budget)
+                        bufferedXml = GetFileContents(filePath, *budget, jobOptions);
+                    else
+                        xml = GetFileContents(filePath);
+                    readSpan.End();
+
                     cout << "Uploading DKDM to Qube Wire..." << endl;
-                    string xmlId = qubeWireClient->UploadKdm(xml);
+                    string xmlId = budget ? qubeWireClient->UploadKdm(move(bufferedXml), jobOptions)
+                                          : qubeWireClient->UploadKdm(xml, jobOptions);
+                    jobSpan.Tag("job", xmlId);
 
                     // DKDMs are internally signed before getting stored. A successful DKDM sign
                     // indicates DKDM passes all validations and successfully uploaded.
                     cout << "Waiting for Qube Wire to compete the DKDM upload..." << std::flush;
-                    string statusJson;
-                    while (!qubeWireClient->GetSignedAssetXml(xmlId, statusJson))
-                    {
-                        this_thread::sleep_for(chrono::seconds(2));
-                    }
+                    qubeWireClient->WaitForSignedAssetXml(xmlId, jobOptions);
                     cout << endl;
+                    jobSpan.End();
 
                     // DKDMs once uploaded can't be retrieved out of Qube Wire. But we can generate
                     // DKDM/KDM from it through Qube Wire.
@@ -144,6 +372,82 @@ int main (int argc, char *argv[])
                     return 0;
                 }
 
+                case 4: // Sign DCP package
+                {
+                    cout << "Enter unsigned PKL file path? ";
+                    string pklFilePath;
+                    cin >> pklFilePath;
+
+                    cout << "Enter number of CPLs in the package? ";
+                    size_t cplCount = 0;
+                    cin >> cplCount;
+
+                    vector<string> cplFilePaths(cplCount);
+                    for (string& cplFilePath : cplFilePaths)
+                    {
+                        cout << "Enter unsigned CPL file path? ";
+                        cin >> cplFilePath;
+                    }
+
+                    // Assets without a hash in the PKL are read from the PKL's directory
+                    string assetDirectory = boost::filesystem::path(pklFilePath).parent_path().string();
+                    PklBuilder pkl = PklBuilder::FromXml(GetFileContents(pklFilePath), assetDirectory);
+
+                    CallOptions jobOptions;
+                    jobOptions.deadline = Deadline::After(JOB_TIMEOUT);
+
+                    cout << "Signing CPLs and PKL through Qube Wire..." << std::flush;
+                    SigningPipeline pipeline(*qubeWireClient);
+                    pipeline.SetSignatureVerification(true);
+                    SignedPackage package = pipeline.SignFiles(cplFilePaths, pkl, jobOptions);
+                    cout << endl;
+
+                    for (size_t i = 0; i < cplFilePaths.size(); ++i)
+                    {
+                        string signedFilePath =
+                            boost::ireplace_all_copy(cplFilePaths[i], ".xml", ".signed.xml");
+                        WriteToFile(signedFilePath, package.cpls[i].xml);
+                        ArchiveSignedAsset(archive.get(), package.cpls[i].id, package.cpls[i].jobId,
+                                           package.cpls[i].xml);
+                        cout << "CPL successfully signed and available here " << signedFilePath << endl;
+                    }
+
+                    string signedPklFilePath = boost::ireplace_all_copy(pklFilePath, ".xml", ".signed.xml");
+                    WriteToFile(signedPklFilePath, package.pkl.xml);
+                    ArchiveSignedAsset(archive.get(), package.pkl.id, package.pkl.jobId, package.pkl.xml);
+                    cout << "PKL successfully signed and available here " << signedPklFilePath << endl;
+                    break;
+                }
+
+                case 5: // Get signed PKL/CPL from archive
+                {
+                    if (!archive)
+                    {
+                        cout << "Set QUBEWIRE_ARCHIVE_FILE to archive signed CPLs/PKLs." << endl;
+                        break;
+                    }
+
+                    cout << "Enter CPL/PKL UUID or signing job id? ";
+                    string id;
+                    cin >> id;
+
+                    // Assets and jobs are both identified by UUIDs, so either is accepted
+                    SignedAssetRecord record;
+                    if (!archive->FindById(id, record) && !archive->FindByJobId(id, record))
+                    {
+                        cout << "No signed CPL/PKL with id " << id << " in the archive." << endl;
+                        break;
+                    }
+
+                    cout << "Enter file path to save the signed CPL/PKL? ";
+                    string signedFilePath;
+                    cin >> signedFilePath;
+                    WriteToFile(signedFilePath, record.xml);
+                    cout << "CPL/PKL " << record.id << " signed by job " << record.jobId
+                         << " available here " << signedFilePath << endl;
+                    break;
+                }
+
                 default:
                 {
                     cout << "Please select a valid option ... " << endl;
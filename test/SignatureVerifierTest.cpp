@@ -0,0 +1,58 @@
+/**
+ * @file SignatureVerifierTest.cpp
+ *
+ * @copyright Copyright &copy; 2017 Qube Cinema Inc. All Rights reserved
+ *
+ * @brief
+ * Known answer test of SignatureVerifier: a signed document must verify against the signer's
+ * certificate, and the same document with its content altered must not.
+ */
+
+#include "../src/CertificateChain.h"
+#include "../src/FileHelpers.h"
+#include "../src/SignatureVerifier.h"
+
+#include <iostream>
+#include <string>
+
+using namespace QUBE_WIRE_NS;
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        cerr << "Usage: " << argv[0] << " <test data directory>" << endl;
+        return 2;
+    }
+
+    try
+    {
+        string dataPath(argv[1]);
+        string pem = GetFileContents(dataPath + "/certificate.pem");
+        CertificateChain chain = CertificateChain::FromPem(pem);
+        SignatureVerifier verifier(chain);
+
+        SignatureVerification signedResult = verifier.Verify(GetFileContents(dataPath + "/signed.xml"));
+        if (!signedResult.isValid)
+        {
+            cerr << "signed.xml didn't verify: " << signedResult.error << endl;
+            return 1;
+        }
+
+        SignatureVerification tamperedResult =
+            verifier.Verify(GetFileContents(dataPath + "/tampered.xml"));
+        if (tamperedResult.isValid)
+        {
+            cerr << "tampered.xml verified" << endl;
+            return 1;
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}